@@ -1,14 +1,142 @@
 #include "./NRF52Serial2.h"
+#include "./Serial2Framer.h"
 #include "peripheral_alloc.h"
 #include "NotifyEvents.h"
 #include "CodalDmesg.h"
+#include "CodalFiber.h"
+#include "EventModel.h"
+#include "Timer.h"
 
 using namespace codal;
 
 extern int8_t target_get_irq_disabled();
 
-// Same as uBit.serial
-#define _DEFAULT_IRQ_PRIORITY 2
+#if IMQOPEN_NRF52SERIAL2_STATS
+#define SERIAL2_STATS(statement) statement
+#else
+#define SERIAL2_STATS(statement)
+#endif
+
+// Indexes of the events rate limited by NRF52Serial2::setEventInterval()
+#define SERIAL2_EVENT_DATA_RECEIVED 0
+#define SERIAL2_EVENT_OVERRUN 1
+#define SERIAL2_EVENT_FRAMING 2
+#define SERIAL2_EVENT_BREAK 3
+
+static const uint16_t rateLimitedEvents[IMQOPEN_NRF52SERIAL2_RATE_LIMITED_EVENTS] = {
+    IMQOPEN_NRF52SERIAL2_EVT_DATA_RECEIVED,
+    IMQOPEN_NRF52SERIAL2_EVT_ERROR_OVERRUN,
+    IMQOPEN_NRF52SERIAL2_EVT_ERROR_FRAMING,
+    IMQOPEN_NRF52SERIAL2_EVT_ERROR_BREAK,
+};
+
+#if IMQOPEN_NRF52SERIAL2_ERROR_EVENTS
+#define SERIAL2_ERROR_EVENT(index) raiseEvent(index, 1)
+#else
+#define SERIAL2_ERROR_EVENT(index)
+#endif
+
+// Reception errors are only worth an interrupt if they are reported or counted
+#define SERIAL2_ERRORS (IMQOPEN_NRF52SERIAL2_ERROR_EVENTS || IMQOPEN_NRF52SERIAL2_STATS)
+
+#if IMQOPEN_NRF52SERIAL2_RX && SERIAL2_ERRORS
+#define SERIAL2_INT_ERROR NRF_UARTE_INT_ERROR_MASK
+#else
+#define SERIAL2_INT_ERROR 0
+#endif
+
+// UARTE interrupts enabled for each direction, the others are never checked by the IRQ handler
+#if IMQOPEN_NRF52SERIAL2_RX
+#define SERIAL2_INT_RX (NRF_UARTE_INT_RXDRDY_MASK | NRF_UARTE_INT_RXSTARTED_MASK | NRF_UARTE_INT_ENDRX_MASK | \
+                        NRF_UARTE_INT_RXTO_MASK | SERIAL2_INT_ERROR)
+#else
+#define SERIAL2_INT_RX 0
+#endif
+
+#if IMQOPEN_NRF52SERIAL2_TX
+#define SERIAL2_INT_TX (NRF_UARTE_INT_ENDTX_MASK | NRF_UARTE_INT_TXSTOPPED_MASK)
+#else
+#define SERIAL2_INT_TX 0
+#endif
+
+// PPI channels currently allocated by any NRF52Serial2 instance
+static uint32_t ppiChannelsInUse = 0;
+
+static int allocatePpiChannel()
+{
+    for (int ch = 0; ch < 32; ch++)
+    {
+        uint32_t mask = 1UL << ch;
+        if ((IMQOPEN_NRF52SERIAL2_PPI_CHANNELS & mask) && !(ppiChannelsInUse & mask))
+        {
+            ppiChannelsInUse |= mask;
+            return ch;
+        }
+    }
+
+    return -1;
+}
+
+static void freePpiChannel(int ch)
+{
+    NRF_PPI->CHENCLR = 1UL << ch;
+    NRF_PPI->CH[ch].EEP = 0;
+    NRF_PPI->CH[ch].TEP = 0;
+    NRF_PPI->FORK[ch].TEP = 0;
+    ppiChannelsInUse &= ~(1UL << ch);
+}
+
+// PPI channel groups currently allocated by any NRF52Serial2 instance
+static uint32_t ppiGroupsInUse = 0;
+
+static int allocatePpiGroup()
+{
+    for (int g = 0; g < 6; g++)
+    {
+        uint32_t mask = 1UL << g;
+        if ((IMQOPEN_NRF52SERIAL2_PPI_GROUPS & mask) && !(ppiGroupsInUse & mask))
+        {
+            ppiGroupsInUse |= mask;
+            return g;
+        }
+    }
+
+    return -1;
+}
+
+static void freePpiGroup(int g)
+{
+    NRF_PPI->TASKS_CHG[g].DIS = 1;
+    NRF_PPI->CHG[g] = 0;
+    ppiGroupsInUse &= ~(1UL << g);
+}
+
+// Instances with idle line detection enabled, their timers share one IRQ callback
+#define IDLE_TIMER_OWNERS 4
+static imqopen::NRF52Serial2 *idleTimerOwners[IDLE_TIMER_OWNERS] = {NULL};
+
+// Instance in RS-485 mode, which owns the DE and /RE GPIOTE channels
+static imqopen::NRF52Serial2 *rs485Owner = NULL;
+
+// codal does not allocate GPIOTE channels or TIMERs. One that has been configured by
+// something else, e.g. a TIMER with interrupts enabled by the runtime, is taken to be in use.
+static bool isGpioteFree(int gpiote)
+{
+    return (NRF_GPIOTE->CONFIG[gpiote] & GPIOTE_CONFIG_MODE_Msk) == (GPIOTE_CONFIG_MODE_Disabled << GPIOTE_CONFIG_MODE_Pos);
+}
+
+static bool isTimerFree(NRF_TIMER_Type *timer)
+{
+    return timer->INTENSET == 0;
+}
+
+static void configureGpioteTask(int gpiote, int pin)
+{
+    NRF_GPIOTE->CONFIG[gpiote] = (GPIOTE_CONFIG_MODE_Task << GPIOTE_CONFIG_MODE_Pos) |
+                                 ((pin & 31) << GPIOTE_CONFIG_PSEL_Pos) |
+                                 ((pin >> 5) << GPIOTE_CONFIG_PORT_Pos) |
+                                 (GPIOTE_CONFIG_OUTINIT_Low << GPIOTE_CONFIG_OUTINIT_Pos);
+}
 
 namespace imqopen
 {
@@ -23,7 +151,23 @@ namespace imqopen
      **/
     NRF52Serial2::NRF52Serial2(Pin &tx, Pin &rx, uint16_t id, NRF_UARTE_Type *device)
         : Serial(tx, rx, CODAL_SERIAL_DEFAULT_BUFFER_SIZE, CODAL_SERIAL_DEFAULT_BUFFER_SIZE, id),
-          is_tx_in_progress_(false), bytesProcessed(0), p_uarte_(NULL)
+          is_tx_in_progress_(false), is_tx_burst_(false), is_tx_direct_(false),
+          txQueueHead_(0), txQueueTail_(0), txCompleted_(0), txPieceLength_(0),
+          txChainPpi_(-1), txChainGroup_(-1), txChainedLength_(0), is_tx_chained_(false), is_tx_piece_latched_(false), is_rx_running_(false), bytesProcessed(0),
+          rxDmaPool_(NULL), rxDmaSize_(CONFIG_SERIAL_DMA_BUFFER_SIZE), rxDmaCount_(CONFIG_SERIAL_DMA_BUFFER_COUNT),
+          rxDmaArmed_(0), rxDmaLength_(CONFIG_SERIAL_DMA_BUFFER_SIZE), is_rx_direct_(false),
+          rxActiveData_(NULL), rxActiveLength_(0), rxArmedData_(NULL), rxArmedLength_(0),
+          rxCounter_(NULL), rxCounterPpi_(-1), rxCountBase_(0), rxPollCount_(0), rxThreshold_(0), rxIdleTimeoutUs_(0),
+          rxIdleTimer_(NULL), rxIdlePpi_(-1), rxIdleBits_(0), is_rx_idle_pending_(false),
+          rxStampTimer_(NULL), rxStampGroup_(-1), rxStampOffset_(0), rxChunks_(NULL), rxChunkTail_(0), rxChunkCount_(0), is_rx_chunk_pending_(false),
+          rxChunkTime_(0), rxIdleTime_(0),
+          rts_(NULL), cts_(NULL), rtsHighWater_(0), is_rts_deasserted_(false),
+          rs485De_(NULL), rs485Re_(NULL), rs485Timer_(NULL),
+          rxRingSize_(CODAL_SERIAL_DEFAULT_BUFFER_SIZE), txRingSize_(CODAL_SERIAL_DEFAULT_BUFFER_SIZE), arena_(NULL), arenaSize_(0), rxHeadMatch_(-1), is_tx_room_waited_(false),
+          framer_(NULL), actualBaudrate_(115200), acceptedBaudrate_(115200),
+          lineIndexTail_(0), lineIndexCount_(0), lineScanned_(0), lineBuff_(NULL), lineBuffSize_(0), is_line_waited_(false),
+          tokenStates_(NULL), tokenStateCount_(1), tokenCount_(0), tokenState_(0), tokenEnd_(NULL), eventIntervalUs_(0),
+          p_uarte_(NULL)
     {
         if (device != NULL)
             p_uarte_ = (NRF_UARTE_Type *)allocate_peripheral((void *)device);
@@ -33,21 +177,31 @@ namespace imqopen
         if (p_uarte_ == NULL)
             target_panic(DEVICE_HARDWARE_CONFIGURATION_ERROR);
 
-        nrf_uarte_config_t hal_config;
-        hal_config.hwfc = NRF_UARTE_HWFC_DISABLED;
-        hal_config.parity = NRF_UARTE_PARITY_EXCLUDED;
-#if defined(UARTE_CONFIG_STOP_Msk)
-        hal_config.stop = NRF_UARTE_STOP_ONE;
-#endif
-#if defined(UARTE_CONFIG_PARITYTYPE_Msk)
-        hal_config.paritytype = NRF_UARTE_PARITYTYPE_EVEN;
-#endif
-
         nrf_uarte_baudrate_set(p_uarte_, NRF_UARTE_BAUDRATE_115200);
-        nrf_uarte_configure(p_uarte_, &hal_config);
+        configure();
 
+        for (int i = 0; i < 4; i++)
+            rs485Ppi_[i] = -1;
+        rxStampPpi_[0] = -1;
+        rxStampPpi_[1] = -1;
+        for (int i = 0; i < IMQOPEN_NRF52SERIAL2_RATE_LIMITED_EVENTS; i++)
+        {
+            eventPending_[i] = 0;
+            eventCount_[i] = 0;
+        }
+
+#if IMQOPEN_NRF52SERIAL2_STATS
+        resetStats();
+
+        // The cycle counter is only ever turned on, other code may use it too.
+        CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+        DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+#endif
+
+#if IMQOPEN_NRF52SERIAL2_RX
         // To be compatible with Serial.redirect()
         rx.setPull(PullMode::Up);
+#endif
 
         configurePins(tx, rx);
 
@@ -60,39 +214,49 @@ namespace imqopen
         nrf_uarte_event_clear(p_uarte_, NRF_UARTE_EVENT_RXSTARTED);
         nrf_uarte_shorts_enable(p_uarte_, NRF_UARTE_SHORT_ENDRX_STARTRX);
 
-        nrf_uarte_int_enable(p_uarte_, NRF_UARTE_INT_RXDRDY_MASK |
-                                           NRF_UARTE_INT_RXSTARTED_MASK |
-                                           NRF_UARTE_INT_ENDRX_MASK |
-                                           NRF_UARTE_INT_ENDTX_MASK |
-                                           NRF_UARTE_INT_ERROR_MASK |
-                                           NRF_UARTE_INT_RXTO_MASK |
-                                           NRF_UARTE_INT_TXSTOPPED_MASK);
+        nrf_uarte_int_enable(p_uarte_, SERIAL2_INT_RX | SERIAL2_INT_TX);
 
         set_alloc_peri_irq(p_uarte_, &_irqHandler, this);
 
         IRQn_Type IRQn = get_alloc_peri_irqn(p_uarte_);
 
-        NVIC_SetPriority(IRQn, _DEFAULT_IRQ_PRIORITY);
+        NVIC_SetPriority(IRQn, IMQOPEN_NRF52SERIAL2_IRQ_PRIORITY);
         NVIC_ClearPendingIRQ(IRQn);
         NVIC_EnableIRQ(IRQn);
 
         nrf_uarte_enable(p_uarte_);
+
+        if (IMQOPEN_NRF52SERIAL2_EVENT_INTERVAL_US > 0)
+            setEventInterval(IMQOPEN_NRF52SERIAL2_EVENT_INTERVAL_US);
+    }
+
+    NRF52Serial2 *NRF52Serial2::create(Pin &tx, Pin &rx, uint16_t id)
+    {
+        // Find a free UARTE without keeping it, the constructor allocates it again.
+        void *device = allocate_peripheral(PERI_MODE_UARTE);
+        if (device == NULL)
+            return NULL;
+
+        free_alloc_peri(device);
+
+        return new NRF52Serial2(tx, rx, id, (NRF_UARTE_Type *)device);
     }
 
     NRF52Serial2::~NRF52Serial2()
     {
-        nrf_uarte_int_disable(p_uarte_, NRF_UARTE_INT_RXDRDY_MASK |
-                                            NRF_UARTE_INT_ENDRX_MASK |
-                                            NRF_UARTE_INT_ENDTX_MASK |
-                                            NRF_UARTE_INT_ERROR_MASK |
-                                            NRF_UARTE_INT_RXTO_MASK |
-                                            NRF_UARTE_INT_TXSTOPPED_MASK);
+        // Stopping RX waits for RXTO, which a disabled UARTE never raises, so it has to come first.
+        // With RX stopped, setRxCoalescing() does not restart it.
+        stopRx();
+
+        if (rxCounter_ != NULL)
+            setRxCoalescing(NULL);
+
+        nrf_uarte_int_disable(p_uarte_, SERIAL2_INT_RX | SERIAL2_INT_TX | NRF_UARTE_INT_TXSTARTED_MASK);
         NVIC_DisableIRQ(get_alloc_peri_irqn(p_uarte_));
 
         // Make sure all transfers are finished before UARTE is disabled
         // to achieve the lowest power consumption.
         nrf_uarte_shorts_disable(p_uarte_, NRF_UARTE_SHORT_ENDRX_STARTRX);
-        nrf_uarte_task_trigger(p_uarte_, NRF_UARTE_TASK_STOPRX);
         nrf_uarte_event_clear(p_uarte_, NRF_UARTE_EVENT_TXSTOPPED);
         nrf_uarte_task_trigger(p_uarte_, NRF_UARTE_TASK_STOPTX);
         while (!nrf_uarte_event_check(p_uarte_, NRF_UARTE_EVENT_TXSTOPPED))
@@ -101,24 +265,56 @@ namespace imqopen
 
         nrf_uarte_disable(p_uarte_);
         nrf_uarte_txrx_pins_disconnect(p_uarte_);
+        nrf_uarte_hwfc_pins_disconnect(p_uarte_);
+
+        if (rxStampTimer_ != NULL)
+            setRxTimestamps(NULL);
+
+        if (rxIdleTimer_ != NULL)
+            setIdleTimeout(NULL, 0);
+
+        if (rs485De_ != NULL)
+            setRs485(NULL);
+
+        if (eventIntervalUs_ > 0)
+            setEventInterval(0);
+
+        if (txChainPpi_ >= 0)
+        {
+            freePpiChannel(txChainPpi_);
+            freePpiGroup(txChainGroup_);
+        }
+
+        clearTokens();
 
         free_alloc_peri(p_uarte_);
+        free(rxDmaPool_);
     }
 
     void NRF52Serial2::_irqHandler(void *self_)
     {
         NRF52Serial2 *self = (NRF52Serial2 *)self_;
         NRF_UARTE_Type *p_uarte = self->p_uarte_;
+        SERIAL2_STATS(uint32_t irqStart = DWT->CYCCNT);
 
-        while (nrf_uarte_event_check(p_uarte, NRF_UARTE_EVENT_RXDRDY) && self->bytesProcessed < CONFIG_SERIAL_DMA_BUFFER_SIZE)
+#if IMQOPEN_NRF52SERIAL2_RX
+        if (self->rxCounter_ != NULL)
         {
-            nrf_uarte_event_clear(p_uarte, NRF_UARTE_EVENT_RXDRDY);
-            self->dataReceivedDMA();
+            self->updateRxBufferFromCounter();
+        }
+        else
+        {
+            while (nrf_uarte_event_check(p_uarte, NRF_UARTE_EVENT_RXDRDY) && self->bytesProcessed < self->rxActiveLength_)
+            {
+                nrf_uarte_event_clear(p_uarte, NRF_UARTE_EVENT_RXDRDY);
+                self->dataReceivedDMA();
+            }
         }
 
         if (nrf_uarte_event_check(p_uarte, NRF_UARTE_EVENT_ENDRX))
         {
             nrf_uarte_event_clear(p_uarte, NRF_UARTE_EVENT_ENDRX);
+            SERIAL2_STATS(self->stats_.rxDmaTransfers++);
             self->updateRxBufferAfterENDRX();
         }
 
@@ -128,73 +324,160 @@ namespace imqopen
             self->updateRxBufferAfterRXSTARTED();
         }
 
+        // Raised after any pending bytes have been flushed above.
+        if (self->is_rx_idle_pending_)
+        {
+            self->is_rx_idle_pending_ = false;
+            if (self->rxStampTimer_ != NULL)
+            {
+                self->rxIdleTime_ = self->rxStampTimer_->CC[1] + self->rxStampOffset_;
+                self->is_rx_chunk_pending_ = true;
+            }
+            if (self->framer_ != NULL)
+                self->framer_->idle();
+            Event(self->id, IMQOPEN_NRF52SERIAL2_EVT_IDLE);
+        }
+
+#if SERIAL2_ERRORS
         if (nrf_uarte_event_check(p_uarte, NRF_UARTE_EVENT_ERROR))
         {
             nrf_uarte_event_clear(p_uarte, NRF_UARTE_EVENT_ERROR);
             uint32_t src = nrf_uarte_errorsrc_get_and_clear(p_uarte);
             self->errorDetected(src);
         }
+#endif
 
         if (nrf_uarte_event_check(p_uarte, NRF_UARTE_EVENT_RXTO))
         {
             nrf_uarte_event_clear(p_uarte, NRF_UARTE_EVENT_RXTO);
         }
+#endif
+
+#if IMQOPEN_NRF52SERIAL2_TX
+        // While a piece is chained, TXSTARTED belongs to it and is handled with the ENDTX that started it.
+        if (!self->is_tx_chained_ && nrf_uarte_event_check(p_uarte, NRF_UARTE_EVENT_TXSTARTED))
+        {
+            nrf_uarte_event_clear(p_uarte, NRF_UARTE_EVENT_TXSTARTED);
+            if (self->is_tx_direct_)
+            {
+                self->is_tx_piece_latched_ = true;
+                self->armTxChain();
+            }
+        }
 
         if (nrf_uarte_event_check(p_uarte, NRF_UARTE_EVENT_ENDTX))
         {
             nrf_uarte_event_clear(p_uarte, NRF_UARTE_EVENT_ENDTX);
 
-            self->is_tx_in_progress_ = false;
-            if (self->txBufferedSize() > 0)
+            bool chainStarted = false;
+            if (self->is_tx_chained_)
+            {
+                // The channel disables itself when it fires. Still enabled means ENDTX came before it was armed.
+                self->is_tx_chained_ = false;
+                if (NRF_PPI->CHEN & (1UL << self->txChainPpi_))
+                    NRF_PPI->CHENCLR = 1UL << self->txChainPpi_;
+                else
+                    chainStarted = true;
+            }
+
+            // Once PPI has started the chained piece, TXD.AMOUNT may already be its own. Nothing
+            // stops a piece that was chained, so the one that ended was sent in full.
+            int amount = chainStarted ? self->txPieceLength_ : nrf_uarte_tx_amount_get(p_uarte);
+            SERIAL2_STATS(self->stats_.txDmaTransfers++);
+            SERIAL2_STATS(self->stats_.txBytes += amount);
+
+            if (self->is_tx_burst_)
+            {
+                self->is_tx_burst_ = false;
+                self->updateTxBufferAfterENDTX(amount);
+            }
+            else if (self->is_tx_direct_)
+            {
+                self->is_tx_direct_ = false;
+                self->updateTxDirectAfterENDTX(amount);
+            }
+
+            if (chainStarted)
             {
-                self->dataTransmitted();
+                // PPI has already started the preloaded piece. TXD.PTR may only be written again once it
+                // has been latched, which TXSTARTED signals. If it is not there yet, the TXSTARTED
+                // interrupt chains the next piece instead of this handler waiting for it.
+                self->is_tx_direct_ = true;
+                self->is_tx_piece_latched_ = false;
+                self->txPieceLength_ = self->txChainedLength_;
+                if (nrf_uarte_event_check(p_uarte, NRF_UARTE_EVENT_TXSTARTED))
+                {
+                    nrf_uarte_event_clear(p_uarte, NRF_UARTE_EVENT_TXSTARTED);
+                    self->is_tx_piece_latched_ = true;
+                    self->armTxChain();
+                }
             }
             else
             {
-                // Transmitter has to be stopped by triggering STOPTX task to achieve
-                // the lowest possible level of the UARTE power consumption.
-                nrf_uarte_task_trigger(p_uarte, NRF_UARTE_TASK_STOPTX);
+                self->is_tx_in_progress_ = false;
+                if (self->txBufferedSize() > 0 || self->txQueueLength() > 0)
+                {
+                    self->startTxBurst();
+                }
+                else
+                {
+                    // Transmitter has to be stopped by triggering STOPTX task to achieve
+                    // the lowest possible level of the UARTE power consumption.
+                    nrf_uarte_task_trigger(p_uarte, NRF_UARTE_TASK_STOPTX);
+                }
+
+                if (!self->is_tx_in_progress_)
+                    Event(self->id, IMQOPEN_NRF52SERIAL2_EVT_TX_IDLE);
             }
         }
 
         if (nrf_uarte_event_check(p_uarte, NRF_UARTE_EVENT_TXSTOPPED))
         {
             nrf_uarte_event_clear(p_uarte, NRF_UARTE_EVENT_TXSTOPPED);
-            self->is_tx_in_progress_ = false;
+            if (self->is_tx_in_progress_)
+            {
+                self->is_tx_in_progress_ = false;
+                Event(self->id, IMQOPEN_NRF52SERIAL2_EVT_TX_IDLE);
+            }
         }
+#endif
+
+#if IMQOPEN_NRF52SERIAL2_STATS
+        uint32_t cycles = DWT->CYCCNT - irqStart;
+        NRF52Serial2Stats *stats = &self->stats_;
+        stats->irqCount++;
+        stats->irqCycles += cycles;
+        if (cycles < stats->irqCyclesMin || stats->irqCount == 1)
+            stats->irqCyclesMin = cycles;
+        if (cycles > stats->irqCyclesMax)
+            stats->irqCyclesMax = cycles;
+#endif
     }
 
     int NRF52Serial2::enableInterrupt(SerialInterruptType t)
     {
         if (t == RxInterrupt)
         {
+#if IMQOPEN_NRF52SERIAL2_RX
             if (!(status & CODAL_SERIAL_STATUS_RX_BUFF_INIT))
                 initialiseRx();
 
             if (status & CODAL_SERIAL_STATUS_RX_BUFF_INIT)
-            {
-                nrf_uarte_rx_buffer_set(p_uarte_, dmaBuffer, CONFIG_SERIAL_DMA_BUFFER_SIZE);
-                bytesProcessed = 0;
-                nrf_uarte_int_enable(p_uarte_, NRF_UARTE_INT_ERROR_MASK |
-                                                   NRF_UARTE_INT_ENDRX_MASK);
-                nrf_uarte_task_trigger(p_uarte_, NRF_UARTE_TASK_STARTRX);
-            }
+                return startRx();
+#else
+            return DEVICE_NOT_SUPPORTED;
+#endif
         }
         else if (t == TxInterrupt)
         {
-            if (!is_tx_in_progress_ && txBufferedSize())
-            {
-                // To prevent the same data from being sent by the TX_DONE event
-                // of the UARTE interrupt before processing the ring buffer.
-                // Only the order in the Serial.dataTransmitted() function is different.
-                uint16_t pre_txBuffTail = txBuffTail;
-                txBuffTail = (txBuffTail + 1) % txBuffSize;
-                putc((char)txBuff[pre_txBuffTail]);
-                if (txBuffTail == txBuffHead)
-                {
-                    Event(DEVICE_ID_NOTIFY, CODAL_SERIAL_EVT_TX_EMPTY);
-                }
-            }
+#if IMQOPEN_NRF52SERIAL2_TX
+            // The ENDTX handler may be starting the next burst at the same time.
+            target_disable_irq();
+            startTxBurst();
+            target_enable_irq();
+#else
+            return DEVICE_NOT_SUPPORTED;
+#endif
         }
 
         return DEVICE_OK;
@@ -204,8 +487,12 @@ namespace imqopen
     {
         if (t == RxInterrupt)
         {
-            nrf_uarte_int_disable(p_uarte_, NRF_UARTE_INT_ERROR_MASK |
-                                                NRF_UARTE_INT_ENDRX_MASK);
+            // The ringbuffer may be about to be freed (initialiseRx()),
+            // EasyDMA must not write into it anymore.
+            if (is_rx_direct_)
+                stopRx();
+
+            nrf_uarte_int_disable(p_uarte_, SERIAL2_INT_ERROR | NRF_UARTE_INT_ENDRX_MASK);
         }
         else if (t == TxInterrupt)
         {
@@ -238,30 +525,71 @@ namespace imqopen
         case 9600:
             baud = NRF_UARTE_BAUDRATE_9600;
             break;
+        case 14400:
+            baud = NRF_UARTE_BAUDRATE_14400;
+            break;
+        case 19200:
+            baud = NRF_UARTE_BAUDRATE_19200;
+            break;
+        case 28800:
+            baud = NRF_UARTE_BAUDRATE_28800;
+            break;
         case 31250:
             baud = NRF_UARTE_BAUDRATE_31250;
             break;
         case 38400:
             baud = NRF_UARTE_BAUDRATE_38400;
             break;
+        case 56000:
+            baud = NRF_UARTE_BAUDRATE_56000;
+            break;
         case 57600:
             baud = NRF_UARTE_BAUDRATE_57600;
             break;
+        case 76800:
+            baud = NRF_UARTE_BAUDRATE_76800;
+            break;
         case 115200:
             baud = NRF_UARTE_BAUDRATE_115200;
             break;
         case 230400:
             baud = NRF_UARTE_BAUDRATE_230400;
             break;
+        case 250000:
+            baud = NRF_UARTE_BAUDRATE_250000;
+            break;
+        case 460800:
+            baud = NRF_UARTE_BAUDRATE_460800;
+            break;
         case 921600:
             baud = NRF_UARTE_BAUDRATE_921600;
             break;
         case 1000000:
             baud = NRF_UARTE_BAUDRATE_1000000;
             break;
+        default:
+            // The UARTE divides 16 MHz by 2^32 / BAUDRATE, using the upper 20 bits of the register.
+            if (baudrate == 0 || baudrate > IMQOPEN_NRF52SERIAL2_BAUDRATE_MAX)
+                baud = (nrf_uarte_baudrate_t)0;
+            else
+                baud = (nrf_uarte_baudrate_t)(((((uint64_t)baudrate << 32) + 8000000) / 16000000 + 0x800) & 0xFFFFF000);
+            break;
+        }
+
+        if (baud == 0)
+        {
+            // Serial::setBaud() has already stored the rate, which redirect() and setEnabled() would apply again.
+            this->baudrate = acceptedBaudrate_;
+            return DEVICE_INVALID_PARAMETER;
         }
 
+        acceptedBaudrate_ = baudrate;
         nrf_uarte_baudrate_set(p_uarte_, baud);
+        actualBaudrate_ = (uint32_t)(((uint64_t)baud * 16000000 + 0x80000000) >> 32);
+
+        if (rxIdleTimer_ != NULL)
+            updateIdleTimeout(actualBaudrate_);
+
         return DEVICE_OK;
     }
 
@@ -271,121 +599,2314 @@ namespace imqopen
         // disableInterrupt(TxInterrupt) and enableInterrupt(TxInterrupt)
         // but NRF52Serial2's implementation of those doesn't change the interrupt.
         // When we get here tx is locked, but the tx interrupt is still working to empty the buffer
-        while (txBufferedSize() > 0 || is_tx_in_progress_) /*wait*/
-            ;
+        waitForTxIdle(SYNC_SLEEP);
+
+        // The pin of a direction compiled out is left free for other uses.
+        nrf_uarte_txrx_pins_set(p_uarte_, IMQOPEN_NRF52SERIAL2_TX ? (uint32_t)tx.name : NRF_UARTE_PSEL_DISCONNECTED,
+                                IMQOPEN_NRF52SERIAL2_RX ? (uint32_t)rx.name : NRF_UARTE_PSEL_DISCONNECTED);
+
+        // RTS is not handed to the UARTE, which would only deassert it when its own FIFO fills up.
+        nrf_uarte_hwfc_pins_set(p_uarte_, NRF_UARTE_PSEL_DISCONNECTED, cts_ != NULL ? cts_->name : NRF_UARTE_PSEL_DISCONNECTED);
+        configure();
 
-        nrf_uarte_txrx_pins_set(p_uarte_, tx.name, rx.name);
+        if (rts_ != NULL)
+            rts_->setDigitalValue(is_rts_deasserted_ ? 1 : 0);
 
         return DEVICE_OK;
     }
 
-    int NRF52Serial2::putc(char c)
+    void NRF52Serial2::configure()
     {
-        int res = DEVICE_OK;
+        nrf_uarte_config_t hal_config;
+        hal_config.hwfc = cts_ != NULL ? NRF_UARTE_HWFC_ENABLED : NRF_UARTE_HWFC_DISABLED;
+        hal_config.parity = NRF_UARTE_PARITY_EXCLUDED;
+#if defined(UARTE_CONFIG_STOP_Msk)
+        hal_config.stop = NRF_UARTE_STOP_ONE;
+#endif
+#if defined(UARTE_CONFIG_PARITYTYPE_Msk)
+        hal_config.paritytype = NRF_UARTE_PARITYTYPE_EVEN;
+#endif
 
-        while (!target_get_irq_disabled() && is_tx_in_progress_)
-            ;
+        nrf_uarte_configure(p_uarte_, &hal_config);
+    }
 
-        if (target_get_irq_disabled())
-        {
-            nrf_uarte_event_clear(p_uarte_, NRF_UARTE_EVENT_ENDTX);
-            nrf_uarte_event_clear(p_uarte_, NRF_UARTE_EVENT_TXSTOPPED);
-        }
-        is_tx_in_progress_ = true;
-        nrf_uarte_tx_buffer_set(p_uarte_, (const uint8_t *)&c, 1);
-        nrf_uarte_task_trigger(p_uarte_, NRF_UARTE_TASK_STARTTX);
+    int NRF52Serial2::redirect(Pin &tx, Pin &rx)
+    {
+        return redirect(tx, rx, NULL, NULL);
+    }
 
-        // Block for when not using Interrupt. (like codal::Serial::prtinf())
-        if (target_get_irq_disabled())
+    int NRF52Serial2::redirect(Pin &tx, Pin &rx, Pin *rts, Pin *cts)
+    {
+        rts_ = rts;
+        cts_ = cts;
+        is_rts_deasserted_ = false;
+
+        // Serial::redirect calls configurePins(), which picks up the flow control pins.
+        // It only restarts TX when its own txBufferedSize() sees data, which uses the 8 bit
+        // codal size, so the restart is done here regardless. configurePins() has drained the
+        // ring, so this only sends what other fibers queued in the meantime.
+        int res = Serial::redirect(tx, rx);
+        if (res == DEVICE_OK)
+            enableInterrupt(TxInterrupt);
+        updateRts();
+
+        return res;
+    }
+
+    int NRF52Serial2::setFlowControlThreshold(int highWater)
+    {
+        if (highWater < 0 || highWater >= 0xFFFF)
+            return DEVICE_INVALID_PARAMETER;
+
+        rtsHighWater_ = highWater;
+        updateRts();
+
+        return DEVICE_OK;
+    }
+
+    uint32_t NRF52Serial2::getBaudrate()
+    {
+        return actualBaudrate_;
+    }
+
+    int NRF52Serial2::autoBaud(NRF_TIMER_Type *timer, uint32_t timeoutMs)
+    {
+#if !IMQOPEN_NRF52SERIAL2_RX
+        return DEVICE_NOT_SUPPORTED;
+#else
+        if (timer == NULL || this->rx == NULL || timeoutMs > 60000)
+            return DEVICE_INVALID_PARAMETER;
+
+        if (timer == rxCounter_ || timer == rs485Timer_ || timer == rxStampTimer_ || (rxIdleTimer_ != NULL && timer == rxIdleTimer_->timer))
+            return DEVICE_BUSY;
+
+        const int gpiote = IMQOPEN_NRF52SERIAL2_AUTOBAUD_GPIOTE_CHANNEL;
+        if (!isTimerFree(timer) || !isGpioteFree(gpiote))
+            return DEVICE_BUSY;
+
+        int ch = allocatePpiChannel();
+        if (ch < 0)
+            return DEVICE_NO_RESOURCES;
+
+        int pin = this->rx->name;
+        NRF_GPIO_Type *port = (pin >> 5) ? NRF_P1 : NRF_P0;
+        uint32_t pinMask = 1UL << (pin & 31);
+
+        NRF_GPIOTE->CONFIG[gpiote] = (GPIOTE_CONFIG_MODE_Event << GPIOTE_CONFIG_MODE_Pos) |
+                                     ((pin & 31) << GPIOTE_CONFIG_PSEL_Pos) |
+                                     ((pin >> 5) << GPIOTE_CONFIG_PORT_Pos) |
+                                     (GPIOTE_CONFIG_POLARITY_Toggle << GPIOTE_CONFIG_POLARITY_Pos);
+        NRF_GPIOTE->EVENTS_IN[gpiote] = 0;
+
+        timer->TASKS_STOP = 1;
+        timer->MODE = TIMER_MODE_MODE_Timer;
+        timer->BITMODE = TIMER_BITMODE_BITMODE_32Bit;
+        timer->PRESCALER = 0;
+        timer->SHORTS = 0;
+        timer->TASKS_CLEAR = 1;
+        timer->TASKS_START = 1;
+
+        // The edge time is captured by hardware, so polling latency does not affect the measurement.
+        NRF_PPI->CH[ch].EEP = (uint32_t)&NRF_GPIOTE->EVENTS_IN[gpiote];
+        NRF_PPI->CH[ch].TEP = (uint32_t)&timer->TASKS_CAPTURE[0];
+        NRF_PPI->CHENSET = 1UL << ch;
+
+        // Falling edges at even, rising edges at odd indices: start bit to stop bit of 0x55.
+        uint32_t edges[10];
+        int n = 0;
+        int res = DEVICE_NO_DATA;
+        uint32_t deadline = timeoutMs * 16000;
+        uint32_t idle = IMQOPEN_NRF52SERIAL2_AUTOBAUD_IDLE_US * 16;
+
+        while (true)
         {
-            bool endtx;
-            bool txstopped;
-            do
+            timer->TASKS_CAPTURE[1] = 1;
+            uint32_t now = timer->CC[1];
+
+            if (!NRF_GPIOTE->EVENTS_IN[gpiote])
             {
-                endtx = nrf_uarte_event_check(p_uarte_, NRF_UARTE_EVENT_ENDTX);
-                txstopped = nrf_uarte_event_check(p_uarte_, NRF_UARTE_EVENT_TXSTOPPED);
-            } while ((!endtx) && (!txstopped));
-            if (txstopped)
+                if (now >= deadline)
+                    break;
+
+                // A missed edge would shift falling and rising edges, so start over on an idle line.
+                if (n > 0 && now - edges[n - 1] > idle)
+                    n = 0;
+
+                // Yield between frames, and between the edges of slow frames. The edges are still
+                // timestamped meanwhile; if one is overwritten, the bit lengths no longer match
+                // and the next sync byte is measured instead.
+                if (n == 0 || now - edges[n - 1] > IMQOPEN_NRF52SERIAL2_AUTOBAUD_SPIN_US * 16)
+                    schedule();
+                continue;
+            }
+
+            NRF_GPIOTE->EVENTS_IN[gpiote] = 0;
+            uint32_t t = timer->CC[0];
+
+            // Wait for a start bit, i.e. the line going low.
+            if (n == 0 && (port->IN & pinMask))
+                continue;
+
+            edges[n++] = t;
+            if (n < 10)
+                continue;
+
+            uint32_t total = edges[9] - edges[0];
+            bool valid = total >= 9 * 16;
+            for (int i = 0; i < 9 && valid; i++)
             {
-                res = DEVICE_INVALID_STATE;
+                // Each of the nine bits must be within 25% of the average.
+                uint32_t bit = (edges[i + 1] - edges[i]) * 9;
+                valid = bit * 4 >= total * 3 && bit * 4 <= total * 5;
             }
-            else
+
+            if (valid)
             {
-                // Transmitter has to be stopped by triggering the STOPTX task to achieve
-                // the lowest possible level of the UARTE power consumption.
-                nrf_uarte_task_trigger(p_uarte_, NRF_UARTE_TASK_STOPTX);
-                while (!nrf_uarte_event_check(p_uarte_, NRF_UARTE_EVENT_TXSTOPPED))
-                {
-                }
+                res = (int)(((uint64_t)16000000 * 9 + total / 2) / total);
+                break;
             }
-            is_tx_in_progress_ = false;
+
+            // Not a sync byte, e.g. a break or the tail of another byte: slide the window by one bit pair.
+            for (int i = 0; i < 8; i++)
+                edges[i] = edges[i + 2];
+            n = 8;
+        }
+
+        freePpiChannel(ch);
+        NRF_GPIOTE->CONFIG[gpiote] = 0;
+        timer->TASKS_STOP = 1;
+
+        if (res > 0)
+        {
+            if (setBaud(res) != DEVICE_OK)
+                return DEVICE_INVALID_PARAMETER;
+
+            // Whatever was received at the old baud rate is garbage.
+            clearRxBuffer();
         }
 
         return res;
+#endif
     }
 
-    int NRF52Serial2::getc()
+    void NRF52Serial2::updateRts()
     {
-        return this->getChar(codal::SerialMode::ASYNC);
-    }
+        if (rts_ == NULL || !(status & CODAL_SERIAL_STATUS_RX_BUFF_INIT))
+            return;
 
-    void NRF52Serial2::errorDetected(uint32_t src)
-    {
-        if (src & NRF_UARTE_ERROR_OVERRUN_MASK)
+        int highWater = rtsHighWater_;
+        if (highWater == 0 || highWater >= rxRingSize_)
         {
-            Event(this->id, IMQOPEN_NRF52SERIAL2_EVT_ERROR_OVERRUN);
+            // Received bytes only reach the ringbuffer when their DMA buffer ends, so the active
+            // and the next armed buffer may both still fill up after RTS has been deasserted.
+            int headroom = (rxDmaCount_ > 1 ? 2 : 1) * rxDmaLength_ + IMQOPEN_NRF52SERIAL2_RTS_HEADROOM;
+            highWater = rxRingSize_ > 2 * headroom ? rxRingSize_ - headroom : rxRingSize_ / 2;
         }
-        // if (src & NRF_UARTE_ERROR_PARITY_MASK)
-        // {
-        //     Event(this->id, IMQOPEN_NRF52SERIAL2_EVT_ERROR_PARITY);
-        // }
-        if (src & NRF_UARTE_ERROR_FRAMING_MASK)
+
+        // Called from both the IRQ handler and fibers.
+        target_disable_irq();
+
+        int level = rxBufferedSize();
+
+        // Half the high-water mark as hysteresis, so RTS does not toggle on every byte read.
+        if (!is_rts_deasserted_ && level >= highWater)
         {
-            Event(this->id, IMQOPEN_NRF52SERIAL2_EVT_ERROR_FRAMING);
+            is_rts_deasserted_ = true;
+            rts_->setDigitalValue(1);
         }
-        if (src & NRF_UARTE_ERROR_BREAK_MASK)
+        else if (is_rts_deasserted_ && level <= highWater / 2)
         {
-            Event(this->id, IMQOPEN_NRF52SERIAL2_EVT_ERROR_BREAK);
+            is_rts_deasserted_ = false;
+            rts_->setDigitalValue(0);
         }
-    }
 
-    void NRF52Serial2::dataReceivedDMA()
-    {
-        dataReceived(dmaBuffer[bytesProcessed++]);
+        target_enable_irq();
     }
 
-    void NRF52Serial2::updateRxBufferAfterENDRX()
+    void NRF52Serial2::indexLines()
     {
-        // A DMA transfer has been completed.
-        // Determine the number of bytes the UART hardware sucessfuly transferred.
-        // This is normally the size of the DMA buffer, but may be shorter if any exceptions occurred.
-        int rxBytes = nrf_uarte_rx_amount_get(p_uarte_);
+        int size = rxRingSize_;
+        if (rxBuff == NULL || size == 0)
+            return;
 
-        // Occasionally we may detect an ENDRX event before the RXRDY associated with the last byte in the DMA buffer..
-        // Clear the RXRDY event if we still have outstanding bytes to process - this protects against us accedentally
-        // processing the same byte twice.
-        if (bytesProcessed < rxBytes)
-            nrf_uarte_event_clear(p_uarte_, NRF_UARTE_EVENT_RXDRDY);
+        // The ringbuffer has been reallocated or reset behind our back.
+        if (lineBuff_ != rxBuff || lineBuffSize_ != size ||
+            (lineScanned_ - rxBuffTail + size) % size > (rxBuffHead - rxBuffTail + size) % size)
+        {
+            lineBuff_ = rxBuff;
+            lineBuffSize_ = size;
+            lineIndexCount_ = 0;
+            lineScanned_ = rxBuffTail;
+        }
 
-        // Flush any unprocessed bytes in the DMA buffer.
-        while (bytesProcessed < rxBytes)
-            dataReceivedDMA();
+        int delimLength = lineDelimiters_.length();
+        if (delimLength == 0)
+        {
+            lineScanned_ = rxBuffHead;
+            return;
+        }
 
-        // Reset received byte counter, as we have completed processing the last DMA buffer
-        // and will have started receiving into a new DMA buffer.
-        bytesProcessed = 0;
+        bool found = false;
+        while (lineScanned_ != rxBuffHead && lineIndexCount_ < IMQOPEN_NRF52SERIAL2_LINE_INDEX_LENGTH)
+        {
+            char c = (char)rxBuff[lineScanned_];
+            for (int i = 0; i < delimLength; i++)
+            {
+                if (lineDelimiters_.charAt(i) == c)
+                {
+                    lineIndex_[(lineIndexTail_ + lineIndexCount_) % IMQOPEN_NRF52SERIAL2_LINE_INDEX_LENGTH] = lineScanned_;
+                    lineIndexCount_++;
+                    found = true;
+                    break;
+                }
+            }
+            lineScanned_ = (lineScanned_ + 1) % size;
+        }
+
+        if (found && is_line_waited_)
+        {
+            is_line_waited_ = false;
+            Event(this->id, IMQOPEN_NRF52SERIAL2_EVT_LINE);
+        }
     }
 
-    void NRF52Serial2::updateRxBufferAfterRXSTARTED()
+    void NRF52Serial2::rxConsumed(uint16_t from)
     {
-        nrf_uarte_rx_buffer_set(p_uarte_, dmaBuffer, CONFIG_SERIAL_DMA_BUFFER_SIZE);
-    }
+        target_disable_irq();
 
-    /**
-     * Puts the component in (or out of) sleep (low power) mode.
-     *
-     * If CODAL_SERIAL_STATUS_DEEPSLEEP is set, then the peripheral will remain active during deep
-     * sleep, and will wake the processor if new data is received.
+        int size = rxRingSize_;
+        int consumed = (rxBuffTail - from + size) % size;
+
+        // Chunks read entirely. The oldest one left starts at the new tail.
+        while (rxChunkCount_ > 1 && (rxChunks_[(rxChunkTail_ + 1) % IMQOPEN_NRF52SERIAL2_RX_CHUNKS].start - from + size) % size <= consumed)
+        {
+            rxChunkTail_ = (rxChunkTail_ + 1) % IMQOPEN_NRF52SERIAL2_RX_CHUNKS;
+            rxChunkCount_--;
+        }
+        if (rxChunkCount_ > 0 && (rxChunks_[rxChunkTail_].start - from + size) % size < consumed)
+            rxChunks_[rxChunkTail_].start = rxBuffTail;
+
+        // Matches whose last byte has been read.
+        for (int i = 0; i < tokenCount_; i++)
+        {
+            if (tokenEnd_[i] >= 0 && (tokenEnd_[i] - 1 - from + 2 * size) % size < consumed)
+                tokenEnd_[i] = -1;
+        }
+
+        if (lineBuff_ == rxBuff && rxBuff != NULL)
+        {
+            while (lineIndexCount_ > 0 && (lineIndex_[lineIndexTail_] - from + size) % size < consumed)
+            {
+                lineIndexTail_ = (lineIndexTail_ + 1) % IMQOPEN_NRF52SERIAL2_LINE_INDEX_LENGTH;
+                lineIndexCount_--;
+            }
+
+            if ((lineScanned_ - from + size) % size < consumed)
+                lineScanned_ = rxBuffTail;
+        }
+
+        // Index what did not fit before.
+        indexLines();
+        target_enable_irq();
+
+        updateRts();
+    }
+
+    int NRF52Serial2::initialiseRx(int size)
+    {
+#if !IMQOPEN_NRF52SERIAL2_RX
+        return DEVICE_NOT_SUPPORTED;
+#else
+        if (status & CODAL_SERIAL_STATUS_RX_BUFF_INIT)
+        {
+            // Ensure that neither EasyDMA nor the IRQ handler write into the buffer once it has been freed.
+            disableInterrupt(RxInterrupt);
+
+            target_disable_irq();
+            status &= ~CODAL_SERIAL_STATUS_RX_BUFF_INIT;
+            target_enable_irq();
+
+            if (arena_ == NULL)
+                free(rxBuff);
+        }
+
+        if (size > 0)
+            rxRingSize_ = size;
+
+        rxBuff = arena_ != NULL ? arena_ : (uint8_t *)malloc(rxRingSize_);
+        if (rxBuff == NULL)
+            return DEVICE_NO_RESOURCES;
+
+        rxBuffHead = 0;
+        rxBuffTail = 0;
+        rxHeadMatch_ = -1;
+        rxChunkCount_ = 0;
+        resetTokenMatches();
+
+        status |= CODAL_SERIAL_STATUS_RX_BUFF_INIT;
+        enableInterrupt(RxInterrupt);
+
+        return DEVICE_OK;
+#endif
+    }
+
+    int NRF52Serial2::initialiseTx(int size)
+    {
+#if !IMQOPEN_NRF52SERIAL2_TX
+        return DEVICE_NOT_SUPPORTED;
+#else
+        if (status & CODAL_SERIAL_STATUS_TX_BUFF_INIT)
+        {
+            // EasyDMA may still be reading from the buffer, and sendDirect() buffers refer to positions in it.
+            waitForTxIdle(SYNC_SLEEP);
+
+            target_disable_irq();
+            status &= ~CODAL_SERIAL_STATUS_TX_BUFF_INIT;
+            target_enable_irq();
+
+            if (arena_ == NULL)
+                free(txBuff);
+        }
+
+        if (size > 0)
+            txRingSize_ = size;
+
+        txBuff = arena_ != NULL ? arena_ + arenaSize_ - txRingSize_ : (uint8_t *)malloc(txRingSize_);
+        if (txBuff == NULL)
+            return DEVICE_NO_RESOURCES;
+
+        txBuffHead = 0;
+        txBuffTail = 0;
+
+        status |= CODAL_SERIAL_STATUS_TX_BUFF_INIT;
+
+        return DEVICE_OK;
+#endif
+    }
+
+    int NRF52Serial2::setBufferArena(uint8_t *arena, uint32_t size)
+    {
+        if (arena == NULL || size < 4)
+            return DEVICE_INVALID_PARAMETER;
+
+        if (status & (CODAL_SERIAL_STATUS_RX_BUFF_INIT | CODAL_SERIAL_STATUS_TX_BUFF_INIT))
+            return DEVICE_BUSY;
+
+        // Neither ringbuffer can be larger than 65535 bytes.
+        if (size > 2 * 0xFFFF)
+            size = 2 * 0xFFFF;
+
+        arena_ = arena;
+        arenaSize_ = size;
+        rxRingSize_ = size / 2;
+        txRingSize_ = size - size / 2;
+
+        return DEVICE_OK;
+    }
+
+    int NRF52Serial2::setRxBufferSize(uint16_t size)
+    {
+        if (size < 2 || (arena_ != NULL && (uint32_t)size + txRingSize_ > arenaSize_))
+            return DEVICE_INVALID_PARAMETER;
+
+        if (rxInUse())
+            return DEVICE_SERIAL_IN_USE;
+
+        lockRx();
+        int result = initialiseRx(size);
+        unlockRx();
+
+        return result;
+    }
+
+    int NRF52Serial2::setTxBufferSize(uint16_t size)
+    {
+        if (size < 2 || (arena_ != NULL && (uint32_t)size + rxRingSize_ > arenaSize_))
+            return DEVICE_INVALID_PARAMETER;
+
+        if (txInUse())
+            return DEVICE_SERIAL_IN_USE;
+
+        lockTx();
+        int result = initialiseTx(size);
+        unlockTx();
+
+        return result;
+    }
+
+    int NRF52Serial2::getRxBufferSize()
+    {
+        return rxRingSize_;
+    }
+
+    int NRF52Serial2::getTxBufferSize()
+    {
+        return txRingSize_;
+    }
+
+    int NRF52Serial2::peekRxSpan(const uint8_t **data)
+    {
+        if (rxInUse())
+            return DEVICE_SERIAL_IN_USE;
+
+        // lazy initialisation of our rx buffer
+        if (!(status & CODAL_SERIAL_STATUS_RX_BUFF_INIT) && initialiseRx() != DEVICE_OK)
+            return 0;
+
+        uint16_t head = rxBuffHead;
+        *data = rxBuff + rxBuffTail;
+
+        return head >= rxBuffTail ? head - rxBuffTail : rxRingSize_ - rxBuffTail;
+    }
+
+    void NRF52Serial2::consumeRx(int length)
+    {
+        if (length <= 0 || length > rxBufferedSize())
+            return;
+
+        uint16_t from = rxBuffTail;
+        rxBuffTail = (from + length) % rxRingSize_;
+        rxConsumed(from);
+    }
+
+    int NRF52Serial2::rxBufferedSize()
+    {
+        if (!(status & CODAL_SERIAL_STATUS_RX_BUFF_INIT))
+            return 0;
+
+        return (rxBuffHead - rxBuffTail + rxRingSize_) % rxRingSize_;
+    }
+
+    int NRF52Serial2::txBufferedSize()
+    {
+        if (!(status & CODAL_SERIAL_STATUS_TX_BUFF_INIT))
+            return 0;
+
+        return (txBuffHead - txBuffTail + txRingSize_) % txRingSize_;
+    }
+
+    int NRF52Serial2::sendChar(char c, SerialMode mode)
+    {
+        return send((uint8_t *)&c, 1, mode);
+    }
+
+    int NRF52Serial2::send(ManagedString s, SerialMode mode)
+    {
+        return send((uint8_t *)s.toCharArray(), s.length(), mode);
+    }
+
+    int NRF52Serial2::send(uint8_t *buffer, int bufferLen, SerialMode mode)
+    {
+#if !IMQOPEN_NRF52SERIAL2_TX
+        return DEVICE_NOT_SUPPORTED;
+#else
+        if (txInUse())
+            return DEVICE_SERIAL_IN_USE;
+
+        if (buffer == NULL || bufferLen <= 0)
+            return DEVICE_INVALID_PARAMETER;
+
+        // lazy initialisation of our tx buffer
+        if (!(status & CODAL_SERIAL_STATUS_TX_BUFF_INIT) && initialiseTx() != DEVICE_OK)
+            return DEVICE_NO_RESOURCES;
+
+        lockTx();
+
+        int count = 0;
+        for (;;)
+        {
+            // Only the IRQ handler moves the tail, and only send() moves the head.
+            uint16_t head = txBuffHead;
+            int space = (txBuffTail - head - 1 + txRingSize_) % txRingSize_;
+            int length = bufferLen - count < space ? bufferLen - count : space;
+            int first = txRingSize_ - head;
+
+            if (length <= first)
+            {
+                memcpy(txBuff + head, buffer + count, length);
+            }
+            else
+            {
+                memcpy(txBuff + head, buffer + count, first);
+                memcpy(txBuff, buffer + count + first, length - first);
+            }
+
+            txBuffHead = (head + length) % txRingSize_;
+            count += length;
+
+            enableInterrupt(TxInterrupt);
+
+            if (count >= bufferLen || mode == ASYNC)
+                break;
+
+            if (mode == SYNC_SLEEP && fiber_scheduler_running() && !target_get_irq_disabled())
+            {
+                // Register for the wake up before re-checking, so that room
+                // freed by the IRQ handler in between can not be missed.
+                target_disable_irq();
+                if (txBufferedSize() >= txRingSize_ - 1)
+                {
+                    is_tx_room_waited_ = true;
+                    fiber_wake_on_event(this->id, IMQOPEN_NRF52SERIAL2_EVT_TX_ROOM);
+                }
+                target_enable_irq();
+                schedule();
+            }
+        }
+
+        unlockTx();
+
+        return count;
+#endif
+    }
+
+    void NRF52Serial2::waitForRx(int length, SerialMode mode)
+    {
+        if (length > rxRingSize_ - 1)
+            length = rxRingSize_ - 1;
+
+        while (mode != ASYNC && rxBufferedSize() < length)
+        {
+            if (mode == SYNC_SLEEP && fiber_scheduler_running() && !target_get_irq_disabled())
+            {
+                // Register for the wake up before re-checking, so that
+                // bytes received in between can not be missed.
+                target_disable_irq();
+                if (rxBufferedSize() < length)
+                {
+                    rxHeadMatch_ = (rxBuffTail + length) % rxRingSize_;
+                    fiber_wake_on_event(this->id, CODAL_SERIAL_EVT_HEAD_MATCH);
+                }
+                target_enable_irq();
+                schedule();
+            }
+        }
+    }
+
+    int NRF52Serial2::takeBytes(uint8_t *buffer, int length)
+    {
+        uint16_t from = rxBuffTail;
+        int available = rxBufferedSize();
+        int first = rxRingSize_ - from;
+
+        if (length > available)
+            length = available;
+
+        if (length <= first)
+        {
+            memcpy(buffer, rxBuff + from, length);
+        }
+        else
+        {
+            memcpy(buffer, rxBuff + from, first);
+            memcpy(buffer + first, rxBuff, length - first);
+        }
+
+        rxBuffTail = (from + length) % rxRingSize_;
+        rxConsumed(from);
+
+        return length;
+    }
+
+    ManagedString NRF52Serial2::takeString(int length, int skip)
+    {
+        uint16_t from = rxBuffTail;
+        int first = rxRingSize_ - from;
+        ManagedString s;
+
+        if (length <= first)
+        {
+            s = ManagedString((char *)rxBuff + from, length);
+        }
+        else
+        {
+            // Assembled in place, rather than concatenating two temporary strings.
+            StringData *data = (StringData *)malloc(sizeof(StringData) + length + 1);
+            if (data == NULL)
+                return s;
+
+            data->init();
+            data->len = length;
+            memcpy(data->data, rxBuff + from, first);
+            memcpy(data->data + first, rxBuff, length - first);
+            data->data[length] = 0;
+
+            s = ManagedString(data);
+            data->decr();
+        }
+
+        rxBuffTail = (from + length + skip) % rxRingSize_;
+        rxConsumed(from);
+
+        return s;
+    }
+
+    int NRF52Serial2::read(SerialMode mode)
+    {
+        uint8_t c;
+        int res = read(&c, 1, mode);
+
+        if (res == 1)
+            return c;
+
+        return res == 0 ? DEVICE_NO_DATA : res;
+    }
+
+    ManagedString NRF52Serial2::read(int size, SerialMode mode)
+    {
+        if (size <= 0 || rxInUse())
+            return ManagedString();
+
+        // lazy initialisation of our rx buffer
+        if (!(status & CODAL_SERIAL_STATUS_RX_BUFF_INIT) && initialiseRx() != DEVICE_OK)
+            return ManagedString();
+
+        // The longest ManagedString
+        if (size > 0x7FFF)
+            size = 0x7FFF;
+
+        lockRx();
+
+        waitForRx(size, mode);
+
+        int length = rxBufferedSize();
+        ManagedString s = takeString(length < size ? length : size, 0);
+
+        unlockRx();
+
+        return s;
+    }
+
+    int NRF52Serial2::read(uint8_t *buffer, int bufferLen, SerialMode mode)
+    {
+        if (rxInUse())
+            return DEVICE_SERIAL_IN_USE;
+
+        if (buffer == NULL || bufferLen <= 0)
+            return DEVICE_INVALID_PARAMETER;
+
+        // lazy initialisation of our rx buffer
+        if (!(status & CODAL_SERIAL_STATUS_RX_BUFF_INIT) && initialiseRx() != DEVICE_OK)
+            return DEVICE_NO_RESOURCES;
+
+        lockRx();
+
+        int count = 0;
+        do
+        {
+            waitForRx(bufferLen - count, mode);
+            count += takeBytes(buffer + count, bufferLen - count);
+        } while (count < bufferLen && mode != ASYNC);
+
+        unlockRx();
+
+        return count;
+    }
+
+    ManagedString NRF52Serial2::readUntil(ManagedString delimeters, SerialMode mode)
+    {
+        if (rxInUse())
+            return ManagedString();
+
+        // lazy initialisation of our rx buffer
+        if (!(status & CODAL_SERIAL_STATUS_RX_BUFF_INIT) && initialiseRx() != DEVICE_OK)
+            return ManagedString();
+
+        lockRx();
+        setLineDelimiters(delimeters);
+
+        int length;
+        while ((length = peekLineLength()) < 0 && mode != ASYNC)
+        {
+            if (mode == SYNC_SLEEP && fiber_scheduler_running() && !target_get_irq_disabled())
+            {
+                // Register for the wake up before re-checking, so a line
+                // indexed by the IRQ handler in between can not be missed.
+                target_disable_irq();
+                if (lineIndexCount_ == 0)
+                {
+                    is_line_waited_ = true;
+                    fiber_wake_on_event(this->id, IMQOPEN_NRF52SERIAL2_EVT_LINE);
+                }
+                target_enable_irq();
+                schedule();
+            }
+        }
+
+        // plus one for the delimiter
+        ManagedString s;
+        if (length >= 0)
+            s = takeString(length, 1);
+
+        unlockRx();
+        return s;
+    }
+
+    void NRF52Serial2::setLineDelimiters(ManagedString delimeters)
+    {
+        // Lines can only be received with the codal Serial RX buffer.
+        if (!(status & CODAL_SERIAL_STATUS_RX_BUFF_INIT))
+            initialiseRx();
+
+        if (delimeters == lineDelimiters_)
+            return;
+
+        target_disable_irq();
+        lineDelimiters_ = delimeters;
+        lineIndexCount_ = 0;
+        lineScanned_ = rxBuffTail;
+        indexLines();
+        target_enable_irq();
+    }
+
+    int NRF52Serial2::peekLineLength()
+    {
+        int length = DEVICE_NO_DATA;
+
+        target_disable_irq();
+        indexLines();
+        if (lineIndexCount_ > 0)
+            length = (lineIndex_[lineIndexTail_] - rxBuffTail + rxRingSize_) % rxRingSize_;
+        target_enable_irq();
+
+        return length;
+    }
+
+    int NRF52Serial2::availableLines()
+    {
+        target_disable_irq();
+        indexLines();
+        int lines = lineIndexCount_;
+        target_enable_irq();
+
+        return lines;
+    }
+
+    int NRF52Serial2::tokenChild(int state, uint8_t c)
+    {
+        for (int s = tokenStates_[state].child; s != 0; s = tokenStates_[s].sibling)
+        {
+            if (tokenStates_[s].c == c)
+                return s;
+        }
+
+        return 0;
+    }
+
+    void NRF52Serial2::linkTokenStates()
+    {
+        // Parents come before their children in the queue, so their fail links are already known.
+        uint8_t queue[IMQOPEN_NRF52SERIAL2_TOKEN_STATES];
+        int head = 0;
+        int tail = 0;
+
+        tokenStates_[0].fail = 0;
+        tokenStates_[0].matches = 0;
+        queue[tail++] = 0;
+
+        while (head < tail)
+        {
+            int parent = queue[head++];
+
+            for (int s = tokenStates_[parent].child; s != 0; s = tokenStates_[s].sibling)
+            {
+                int fail = 0;
+                for (int f = tokenStates_[parent].fail; parent != 0; f = tokenStates_[f].fail)
+                {
+                    fail = tokenChild(f, tokenStates_[s].c);
+                    if (fail != 0 || f == 0)
+                        break;
+                }
+
+                NRF52Serial2TokenState &state = tokenStates_[s];
+                state.fail = fail;
+                state.matches = tokenStates_[fail].matches;
+                if (state.token != 0)
+                    state.matches |= 1UL << (state.token - 1);
+
+                queue[tail++] = s;
+            }
+        }
+    }
+
+    void NRF52Serial2::matchTokens(uint8_t c, uint16_t end)
+    {
+        int state = tokenState_;
+        int next;
+        while ((next = tokenChild(state, c)) == 0 && state != 0)
+            state = tokenStates_[state].fail;
+
+        tokenState_ = next;
+
+        uint32_t matches = tokenStates_[next].matches;
+        for (int i = 0; matches != 0; i++, matches >>= 1)
+        {
+            if (matches & 1)
+            {
+                tokenEnd_[i] = end;
+                Event(this->id, IMQOPEN_NRF52SERIAL2_EVT_TOKEN + i);
+            }
+        }
+    }
+
+    void NRF52Serial2::resetTokenMatches()
+    {
+        tokenState_ = 0;
+        for (int i = 0; i < tokenCount_; i++)
+            tokenEnd_[i] = -1;
+    }
+
+    int NRF52Serial2::addToken(ManagedString token)
+    {
+#if !IMQOPEN_NRF52SERIAL2_RX
+        return DEVICE_NOT_SUPPORTED;
+#else
+        int length = token.length();
+        if (length == 0)
+            return DEVICE_INVALID_PARAMETER;
+
+        // Tokens are matched as bytes enter the codal Serial RX buffer.
+        if (!(status & CODAL_SERIAL_STATUS_RX_BUFF_INIT))
+            initialiseRx();
+
+        if (tokenStates_ == NULL)
+        {
+            NRF52Serial2TokenState *states = (NRF52Serial2TokenState *)malloc(sizeof(NRF52Serial2TokenState) * IMQOPEN_NRF52SERIAL2_TOKEN_STATES +
+                                                                               sizeof(int32_t) * IMQOPEN_NRF52SERIAL2_TOKEN_COUNT);
+            if (states == NULL)
+                return DEVICE_NO_RESOURCES;
+
+            states[0].child = 0;
+            states[0].token = 0;
+            states[0].fail = 0;
+            states[0].matches = 0;
+
+            // Not walked by the IRQ handler until tokenCount_ is raised.
+            tokenEnd_ = (int32_t *)(states + IMQOPEN_NRF52SERIAL2_TOKEN_STATES);
+            tokenStates_ = states;
+        }
+
+        // Follow the states shared with the tokens already added.
+        int state = 0;
+        int i = 0;
+        for (; i < length; i++)
+        {
+            int next = tokenChild(state, (uint8_t)token.charAt(i));
+            if (next == 0)
+                break;
+            state = next;
+        }
+
+        if (i == length && tokenStates_[state].token != 0)
+            return tokenStates_[state].token - 1;
+
+        if (tokenCount_ >= IMQOPEN_NRF52SERIAL2_TOKEN_COUNT || tokenStateCount_ + length - i > IMQOPEN_NRF52SERIAL2_TOKEN_STATES)
+            return DEVICE_NO_RESOURCES;
+
+        // The IRQ handler walks the states.
+        target_disable_irq();
+
+        for (; i < length; i++)
+        {
+            NRF52Serial2TokenState &added = tokenStates_[tokenStateCount_];
+            added.c = (uint8_t)token.charAt(i);
+            added.child = 0;
+            added.sibling = tokenStates_[state].child;
+            added.token = 0;
+
+            tokenStates_[state].child = tokenStateCount_;
+            state = tokenStateCount_++;
+        }
+
+        int index = tokenCount_++;
+        tokenStates_[state].token = index + 1;
+        tokenEnd_[index] = -1;
+        tokenState_ = 0;
+        linkTokenStates();
+
+        target_enable_irq();
+
+        return index;
+#endif
+    }
+
+    void NRF52Serial2::clearTokens()
+    {
+        target_disable_irq();
+
+        NRF52Serial2TokenState *states = tokenStates_;
+        tokenStates_ = NULL;
+        tokenEnd_ = NULL;
+        tokenStateCount_ = 1;
+        tokenCount_ = 0;
+        tokenState_ = 0;
+
+        target_enable_irq();
+
+        free(states);
+    }
+
+    int NRF52Serial2::tokenOffset(int index)
+    {
+        if (index < 0 || index >= tokenCount_)
+            return DEVICE_INVALID_PARAMETER;
+
+        int offset = DEVICE_NO_DATA;
+
+        target_disable_irq();
+        int end = tokenEnd_[index];
+        if (end >= 0 && rxBuff != NULL)
+        {
+            int distance = (end - rxBuffTail + rxRingSize_) % rxRingSize_;
+            if (distance > 0 && distance <= rxBufferedSize())
+                offset = distance;
+        }
+        target_enable_irq();
+
+        return offset;
+    }
+
+    int NRF52Serial2::clearRxBuffer()
+    {
+        if (rxInUse())
+            return DEVICE_SERIAL_IN_USE;
+
+        target_disable_irq();
+        rxBuffTail = rxBuffHead;
+        lineIndexCount_ = 0;
+        lineScanned_ = rxBuffTail;
+        rxChunkCount_ = 0;
+        resetTokenMatches();
+        target_enable_irq();
+
+        updateRts();
+        return DEVICE_OK;
+    }
+
+    int NRF52Serial2::putc(char c)
+    {
+#if !IMQOPEN_NRF52SERIAL2_TX
+        return DEVICE_NOT_SUPPORTED;
+#else
+        int res = DEVICE_OK;
+
+        if (!target_get_irq_disabled())
+            waitForTxIdle(SYNC_SLEEP, false);
+
+        if (target_get_irq_disabled())
+        {
+            // Complete a burst or sendDirect() piece started before interrupts were disabled,
+            // so that its bytes are neither lost nor sent twice.
+            if (is_tx_direct_ && is_tx_chained_)
+            {
+                // PPI must not start the chained piece on top of the byte below.
+                NRF_PPI->CHENCLR = 1UL << txChainPpi_;
+                is_tx_chained_ = false;
+
+                // TXSTARTED is left set while a piece is chained, so it tells whether PPI has already started it.
+                if (nrf_uarte_event_check(p_uarte_, NRF_UARTE_EVENT_TXSTARTED))
+                {
+                    nrf_uarte_event_clear(p_uarte_, NRF_UARTE_EVENT_TXSTARTED);
+                    nrf_uarte_event_clear(p_uarte_, NRF_UARTE_EVENT_ENDTX);
+                    updateTxDirectAfterENDTX(txPieceLength_);
+                    txPieceLength_ = txChainedLength_;
+                }
+            }
+            if (is_tx_burst_ || is_tx_direct_)
+            {
+                while (!nrf_uarte_event_check(p_uarte_, NRF_UARTE_EVENT_ENDTX) &&
+                       !nrf_uarte_event_check(p_uarte_, NRF_UARTE_EVENT_TXSTOPPED))
+                {
+                }
+                if (is_tx_burst_)
+                {
+                    is_tx_burst_ = false;
+                    updateTxBufferAfterENDTX(nrf_uarte_tx_amount_get(p_uarte_));
+                }
+                else
+                {
+                    is_tx_direct_ = false;
+                    updateTxDirectAfterENDTX(nrf_uarte_tx_amount_get(p_uarte_));
+                }
+            }
+            nrf_uarte_event_clear(p_uarte_, NRF_UARTE_EVENT_ENDTX);
+            nrf_uarte_event_clear(p_uarte_, NRF_UARTE_EVENT_TXSTOPPED);
+        }
+        is_tx_in_progress_ = true;
+        nrf_uarte_tx_buffer_set(p_uarte_, (const uint8_t *)&c, 1);
+        nrf_uarte_task_trigger(p_uarte_, NRF_UARTE_TASK_STARTTX);
+
+        // Block for when not using Interrupt. (like codal::Serial::prtinf())
+        if (target_get_irq_disabled())
+        {
+            bool endtx;
+            bool txstopped;
+            do
+            {
+                endtx = nrf_uarte_event_check(p_uarte_, NRF_UARTE_EVENT_ENDTX);
+                txstopped = nrf_uarte_event_check(p_uarte_, NRF_UARTE_EVENT_TXSTOPPED);
+            } while ((!endtx) && (!txstopped));
+            if (txstopped)
+            {
+                res = DEVICE_INVALID_STATE;
+            }
+            else
+            {
+                // Transmitter has to be stopped by triggering the STOPTX task to achieve
+                // the lowest possible level of the UARTE power consumption.
+                nrf_uarte_task_trigger(p_uarte_, NRF_UARTE_TASK_STOPTX);
+                while (!nrf_uarte_event_check(p_uarte_, NRF_UARTE_EVENT_TXSTOPPED))
+                {
+                }
+            }
+            is_tx_in_progress_ = false;
+        }
+
+        return res;
+#endif
+    }
+
+    int NRF52Serial2::getc()
+    {
+        // Serial::getChar() indexes the ringbuffer with the 8 bit codal size.
+        return read(ASYNC);
+    }
+
+    int NRF52Serial2::eventAfter(int len, SerialMode mode)
+    {
+        if (mode == SYNC_SPINWAIT || len <= 0)
+            return DEVICE_INVALID_PARAMETER;
+
+        if (!(status & CODAL_SERIAL_STATUS_RX_BUFF_INIT) && initialiseRx() != DEVICE_OK)
+            return DEVICE_NO_RESOURCES;
+
+        if (len > rxRingSize_ - 1)
+            return DEVICE_INVALID_PARAMETER;
+
+        target_disable_irq();
+        rxHeadMatch_ = (rxBuffHead + len) % rxRingSize_;
+        if (mode == SYNC_SLEEP)
+            fiber_wake_on_event(this->id, CODAL_SERIAL_EVT_HEAD_MATCH);
+        target_enable_irq();
+
+        if (mode == SYNC_SLEEP)
+            schedule();
+
+        return DEVICE_OK;
+    }
+
+    int NRF52Serial2::isReadable()
+    {
+        if (!(status & CODAL_SERIAL_STATUS_RX_BUFF_INIT))
+        {
+            int res = initialiseRx();
+            if (res != DEVICE_OK)
+                return res;
+        }
+
+        return rxBuffTail != rxBuffHead ? 1 : 0;
+    }
+
+    int NRF52Serial2::isWriteable()
+    {
+        return txBufferedSize() < txRingSize_ - 1 ? 1 : 0;
+    }
+
+    void NRF52Serial2::errorDetected(uint32_t src)
+    {
+        if (src & NRF_UARTE_ERROR_OVERRUN_MASK)
+        {
+            SERIAL2_STATS(stats_.overrunErrors++);
+            SERIAL2_ERROR_EVENT(SERIAL2_EVENT_OVERRUN);
+        }
+        // if (src & NRF_UARTE_ERROR_PARITY_MASK)
+        // {
+        //     Event(this->id, IMQOPEN_NRF52SERIAL2_EVT_ERROR_PARITY);
+        // }
+        if (src & NRF_UARTE_ERROR_FRAMING_MASK)
+        {
+            SERIAL2_STATS(stats_.framingErrors++);
+            SERIAL2_ERROR_EVENT(SERIAL2_EVENT_FRAMING);
+        }
+        if (src & NRF_UARTE_ERROR_BREAK_MASK)
+        {
+            SERIAL2_STATS(stats_.breakErrors++);
+            SERIAL2_ERROR_EVENT(SERIAL2_EVENT_BREAK);
+        }
+    }
+
+    void NRF52Serial2::dataReceivedDMA()
+    {
+        dataReceivedBlock(rxActiveData_ + bytesProcessed, 1);
+        bytesProcessed++;
+    }
+
+    void NRF52Serial2::dataReceivedBlock(const uint8_t *data, int len)
+    {
+        SERIAL2_STATS(stats_.rxBytes += len);
+
+        if (framer_ != NULL)
+        {
+            framer_->receive(data, len);
+            return;
+        }
+
+        if (!(status & CODAL_SERIAL_STATUS_RX_BUFF_INIT) || len <= 0)
+            return;
+
+        // Direct RX into the sink: the ringbuffer was full when the transfer was armed, and the region
+        // armed after it starts at the current head, so the bytes can not be copied there either.
+        if (is_rx_direct_ && (data < rxBuff || data >= rxBuff + rxRingSize_))
+        {
+            tokenState_ = 0;
+            SERIAL2_STATS(stats_.rxDropped += len);
+            return;
+        }
+
+        int received = len;
+        startRxChunk();
+
+        int delimLength = this->delimeters.length();
+        bool full = false;
+
+        // Direct RX: EasyDMA has already stored the bytes at the head of the ringbuffer.
+        if (data == rxBuff + rxBuffHead)
+        {
+            for (int i = 0; i < len && delimLength > 0; i++)
+            {
+                for (int delimeterOffset = 0; delimeterOffset < delimLength; delimeterOffset++)
+                {
+                    if (this->delimeters.charAt(delimeterOffset) == (char)data[i])
+                        Event(this->id, CODAL_SERIAL_EVT_DELIM_MATCH);
+                }
+            }
+
+            // Distance from the head to the position a fiber is waiting for, if any.
+            int match = rxHeadMatch_ >= 0 ? (rxHeadMatch_ - rxBuffHead + rxRingSize_) % rxRingSize_ : 0;
+
+            uint16_t start = rxBuffHead;
+            rxBuffHead = (rxBuffHead + len) % rxRingSize_;
+
+            for (int i = 0; i < len && tokenCount_ > 0; i++)
+                matchTokens(data[i], (start + i + 1) % rxRingSize_);
+
+            if (match > 0 && match <= len)
+            {
+                rxHeadMatch_ = -1;
+                Event(this->id, CODAL_SERIAL_EVT_HEAD_MATCH);
+            }
+
+            len = 0;
+        }
+
+        for (int i = 0; i < len; i++)
+        {
+            char c = (char)data[i];
+
+            //iterate through our delimeters (if any) to see if there is a match
+            for (int delimeterOffset = 0; delimeterOffset < delimLength; delimeterOffset++)
+            {
+                if (this->delimeters.charAt(delimeterOffset) == c)
+                    Event(this->id, CODAL_SERIAL_EVT_DELIM_MATCH);
+            }
+
+            uint16_t newHead = (rxBuffHead + 1) % rxRingSize_;
+
+            //look ahead to our newHead value to see if we are about to collide with the tail
+            if (newHead == rxBuffTail)
+            {
+                // A token can not be matched across the dropped byte.
+                tokenState_ = 0;
+                SERIAL2_STATS(stats_.rxDropped++);
+                full = true;
+                continue;
+            }
+
+            this->rxBuff[rxBuffHead] = c;
+            rxBuffHead = newHead;
+
+            if (tokenCount_ > 0)
+                matchTokens(c, rxBuffHead);
+
+            //if we have any fibers waiting for a specific number of characters, unblock them
+            if (rxHeadMatch_ >= 0 && rxBuffHead == rxHeadMatch_)
+            {
+                rxHeadMatch_ = -1;
+                Event(this->id, CODAL_SERIAL_EVT_HEAD_MATCH);
+            }
+        }
+
+#ifdef CODAL_SERIAL_STATUS_RXD
+        status |= CODAL_SERIAL_STATUS_RXD;
+#endif
+
+#if IMQOPEN_NRF52SERIAL2_STATS
+        uint32_t buffered = rxBufferedSize();
+        if (buffered > stats_.rxHighWater)
+            stats_.rxHighWater = buffered;
+#endif
+
+        indexLines();
+
+        updateRts();
+
+        if (full)
+            Event(this->id, CODAL_SERIAL_EVT_RX_FULL);
+
+        raiseEvent(SERIAL2_EVENT_DATA_RECEIVED, received);
+    }
+
+    void NRF52Serial2::raiseEvent(int index, uint32_t count)
+    {
+        if (eventIntervalUs_ > 0)
+        {
+            // The dispatch may run at a lower priority, and take the counts in between.
+            target_disable_irq();
+            eventPending_[index] += count;
+            target_enable_irq();
+            return;
+        }
+
+        eventCount_[index] = count;
+        Event(this->id, rateLimitedEvents[index]);
+    }
+
+    void NRF52Serial2::dispatchEvents()
+    {
+        uint32_t counts[IMQOPEN_NRF52SERIAL2_RATE_LIMITED_EVENTS];
+
+        target_disable_irq();
+        for (int i = 0; i < IMQOPEN_NRF52SERIAL2_RATE_LIMITED_EVENTS; i++)
+        {
+            counts[i] = eventPending_[i];
+            eventPending_[i] = 0;
+        }
+        target_enable_irq();
+
+        for (int i = 0; i < IMQOPEN_NRF52SERIAL2_RATE_LIMITED_EVENTS; i++)
+        {
+            if (counts[i] > 0)
+            {
+                eventCount_[i] = counts[i];
+                Event(this->id, rateLimitedEvents[i]);
+            }
+        }
+    }
+
+    void NRF52Serial2::onEventDispatch(Event)
+    {
+        dispatchEvents();
+    }
+
+    int NRF52Serial2::setEventInterval(uint32_t intervalUs)
+    {
+        if (eventIntervalUs_ > 0)
+        {
+            system_timer_cancel_event(this->id, IMQOPEN_NRF52SERIAL2_EVT_DISPATCH);
+            EventModel::defaultEventBus->ignore(this->id, IMQOPEN_NRF52SERIAL2_EVT_DISPATCH, this, &NRF52Serial2::onEventDispatch);
+
+            // From now on the IRQ handler raises the events itself, deliver those it has counted.
+            target_disable_irq();
+            eventIntervalUs_ = 0;
+            target_enable_irq();
+            dispatchEvents();
+        }
+
+        if (intervalUs == 0)
+            return DEVICE_OK;
+
+        if (!EventModel::defaultEventBus)
+            return DEVICE_NOT_SUPPORTED;
+
+        EventModel::defaultEventBus->listen(this->id, IMQOPEN_NRF52SERIAL2_EVT_DISPATCH, this, &NRF52Serial2::onEventDispatch, MESSAGE_BUS_LISTENER_IMMEDIATE);
+        system_timer_event_every_us(intervalUs, this->id, IMQOPEN_NRF52SERIAL2_EVT_DISPATCH);
+        eventIntervalUs_ = intervalUs;
+
+        return DEVICE_OK;
+    }
+
+    uint32_t NRF52Serial2::getEventCount(uint16_t value)
+    {
+        for (int i = 0; i < IMQOPEN_NRF52SERIAL2_RATE_LIMITED_EVENTS; i++)
+        {
+            if (rateLimitedEvents[i] == value)
+                return eventCount_[i];
+        }
+
+        return 0;
+    }
+
+    void NRF52Serial2::updateRxBufferFromCounter()
+    {
+        rxCounter_->TASKS_CAPTURE[0] = 1;
+        uint32_t rxBytes = rxCounter_->CC[0] - rxCountBase_;
+
+        // The counter runs ahead of the active buffer once EasyDMA has moved on to the next one,
+        // those bytes are processed after ENDRX.
+        if (rxBytes > rxActiveLength_)
+            rxBytes = rxActiveLength_;
+
+        if ((int)rxBytes > bytesProcessed)
+        {
+            dataReceivedBlock(rxActiveData_ + bytesProcessed, rxBytes - bytesProcessed);
+            bytesProcessed = rxBytes;
+        }
+    }
+
+    void NRF52Serial2::onRxPoll(Event)
+    {
+        rxCounter_->TASKS_CAPTURE[1] = 1;
+        uint32_t count = rxCounter_->CC[1];
+
+        if (count == rxPollCount_ && count != rxCountBase_ + bytesProcessed)
+            NVIC_SetPendingIRQ(get_alloc_peri_irqn(p_uarte_));
+
+        rxPollCount_ = count;
+    }
+
+    void NRF52Serial2::updateRxBufferAfterENDRX()
+    {
+        // A DMA transfer has been completed.
+        // Determine the number of bytes the UART hardware sucessfuly transferred.
+        // This is normally the size of the DMA buffer, but may be shorter if any exceptions occurred.
+        int rxBytes = nrf_uarte_rx_amount_get(p_uarte_);
+
+        // Occasionally we may detect an ENDRX event before the RXRDY associated with the last byte in the DMA buffer..
+        // Clear the RXRDY event if we still have outstanding bytes to process - this protects against us accedentally
+        // processing the same byte twice.
+        if (bytesProcessed < rxBytes)
+            nrf_uarte_event_clear(p_uarte_, NRF_UARTE_EVENT_RXDRDY);
+
+        // Flush any unprocessed bytes in the DMA buffer.
+        if (bytesProcessed < rxBytes)
+        {
+            SERIAL2_STATS(stats_.rxLateFlushes++);
+            dataReceivedBlock(rxActiveData_ + bytesProcessed, rxBytes - bytesProcessed);
+        }
+
+        // Reset received byte counter, as we have completed processing the last DMA buffer
+        // and will have started receiving into a new DMA buffer.
+        bytesProcessed = 0;
+        rxCountBase_ += rxBytes;
+        rxActiveData_ = rxArmedData_;
+        rxActiveLength_ = rxArmedLength_;
+    }
+
+    void NRF52Serial2::startTxBurst()
+    {
+#if IMQOPEN_NRF52SERIAL2_STATS
+        // Called after each write to the TX ringbuffer.
+        uint32_t buffered = txBufferedSize();
+        if (buffered > stats_.txHighWater)
+            stats_.txHighWater = buffered;
+#endif
+
+        if (is_tx_in_progress_)
+            return;
+
+        // A sendDirect() buffer goes out once the bytes queued before it have been sent.
+        TxSegment *segment = txQueueLength() > 0 ? &txQueue_[txQueueTail_] : NULL;
+        if (segment != NULL && txBuffTail == segment->mark)
+        {
+            int length = segment->length < IMQOPEN_NRF52SERIAL2_DMA_MAX_LENGTH ? segment->length : IMQOPEN_NRF52SERIAL2_DMA_MAX_LENGTH;
+
+            is_tx_in_progress_ = true;
+            is_tx_direct_ = true;
+            is_tx_piece_latched_ = false;
+            txPieceLength_ = length;
+            nrf_uarte_tx_buffer_set(p_uarte_, segment->data, length);
+            nrf_uarte_task_trigger(p_uarte_, NRF_UARTE_TASK_STARTTX);
+            return;
+        }
+
+        if (txBuffTail == txBuffHead)
+            return;
+
+        // Bytes are only released from the ringbuffer once the transfer has completed,
+        // so Serial::send() can not overwrite the span while EasyDMA is reading it.
+        uint16_t head = segment != NULL ? segment->mark : txBuffHead;
+        uint16_t length = head > txBuffTail ? head - txBuffTail : txRingSize_ - txBuffTail;
+
+        is_tx_in_progress_ = true;
+        is_tx_burst_ = true;
+        nrf_uarte_tx_buffer_set(p_uarte_, &txBuff[txBuffTail], length);
+        nrf_uarte_task_trigger(p_uarte_, NRF_UARTE_TASK_STARTTX);
+    }
+
+    void NRF52Serial2::updateTxBufferAfterENDTX(int txBytes)
+    {
+        // TXD.AMOUNT may be shorter than the burst if the transmitter was stopped early.
+        txBuffTail = (txBuffTail + txBytes) % txRingSize_;
+
+        if (is_tx_room_waited_ && txBytes > 0)
+        {
+            is_tx_room_waited_ = false;
+            Event(this->id, IMQOPEN_NRF52SERIAL2_EVT_TX_ROOM);
+        }
+
+        if (txBuffTail == txBuffHead)
+            Event(DEVICE_ID_NOTIFY, CODAL_SERIAL_EVT_TX_EMPTY);
+    }
+
+    void NRF52Serial2::updateTxDirectAfterENDTX(int txBytes)
+    {
+        TxSegment *segment = &txQueue_[txQueueTail_];
+
+        segment->length -= txBytes;
+        if (segment->length > 0)
+        {
+            segment->data += txBytes;
+            return;
+        }
+
+        txQueueTail_ = (txQueueTail_ + 1) % IMQOPEN_NRF52SERIAL2_TX_QUEUE_LENGTH;
+        txCompleted_++;
+        Event(this->id, IMQOPEN_NRF52SERIAL2_EVT_TX_COMPLETE);
+    }
+
+    int NRF52Serial2::nextTxPiece(const uint8_t **data)
+    {
+        TxSegment *segment = &txQueue_[txQueueTail_];
+
+        if (segment->length > txPieceLength_)
+        {
+            *data = segment->data + txPieceLength_;
+            int length = segment->length - txPieceLength_;
+            return length < IMQOPEN_NRF52SERIAL2_DMA_MAX_LENGTH ? length : IMQOPEN_NRF52SERIAL2_DMA_MAX_LENGTH;
+        }
+
+        if (txQueueLength() < 2)
+            return 0;
+
+        segment = &txQueue_[(txQueueTail_ + 1) % IMQOPEN_NRF52SERIAL2_TX_QUEUE_LENGTH];
+        if (segment->mark != txBuffTail)
+            return 0;
+
+        *data = segment->data;
+        return segment->length < IMQOPEN_NRF52SERIAL2_DMA_MAX_LENGTH ? segment->length : IMQOPEN_NRF52SERIAL2_DMA_MAX_LENGTH;
+    }
+
+    void NRF52Serial2::armTxChain()
+    {
+        const uint8_t *data;
+        int length;
+
+        if (txChainPpi_ < 0 || is_tx_chained_ || (length = nextTxPiece(&data)) == 0)
+            return;
+
+        // Both ENDTX events merge if the chained piece ends before this handler has seen the first one, and
+        // the second transfer would go unaccounted. Too short a piece is started by the IRQ handler instead.
+        if ((uint64_t)length * 10 * 1000000 < (uint64_t)IMQOPEN_NRF52SERIAL2_TX_CHAIN_MIN_US * actualBaudrate_)
+            return;
+
+        nrf_uarte_tx_buffer_set(p_uarte_, data, length);
+        txChainedLength_ = length;
+        is_tx_chained_ = true;
+        NRF_PPI->TASKS_CHG[txChainGroup_].EN = 1;
+    }
+
+    int NRF52Serial2::txQueueLength()
+    {
+        return (txQueueHead_ - txQueueTail_ + IMQOPEN_NRF52SERIAL2_TX_QUEUE_LENGTH) % IMQOPEN_NRF52SERIAL2_TX_QUEUE_LENGTH;
+    }
+
+    int NRF52Serial2::sendDirect(const uint8_t *buffer, int bufferLen, SerialMode mode)
+    {
+#if !IMQOPEN_NRF52SERIAL2_TX
+        return DEVICE_NOT_SUPPORTED;
+#else
+        // EasyDMA can not read flash, it would send garbage or raise a bus error.
+        if (buffer == NULL || bufferLen <= 0 || !nrfx_is_in_ram(buffer))
+            return DEVICE_INVALID_PARAMETER;
+
+        // One slot is left empty to tell a full queue from an empty one.
+        const int maxQueued = IMQOPEN_NRF52SERIAL2_TX_QUEUE_LENGTH - 1;
+
+        if (mode == ASYNC && txQueueLength() == maxQueued)
+            return DEVICE_BUSY;
+
+        waitForTxDirect(mode, maxQueued - 1);
+
+        if (txChainPpi_ < 0)
+        {
+            // Without a free channel and group, each buffer is started by the IRQ handler instead.
+            int ch = allocatePpiChannel();
+            int g = ch >= 0 ? allocatePpiGroup() : -1;
+
+            if (g >= 0)
+            {
+                NRF_PPI->CH[ch].EEP = nrf_uarte_event_address_get(p_uarte_, NRF_UARTE_EVENT_ENDTX);
+                NRF_PPI->CH[ch].TEP = nrf_uarte_task_address_get(p_uarte_, NRF_UARTE_TASK_STARTTX);
+                NRF_PPI->FORK[ch].TEP = (uint32_t)&NRF_PPI->TASKS_CHG[g].DIS;
+                NRF_PPI->CHG[g] = 1UL << ch;
+
+                txChainGroup_ = g;
+                txChainPpi_ = ch;
+                nrf_uarte_event_clear(p_uarte_, NRF_UARTE_EVENT_TXSTARTED);
+                nrf_uarte_int_enable(p_uarte_, NRF_UARTE_INT_TXSTARTED_MASK);
+            }
+            else if (ch >= 0)
+            {
+                freePpiChannel(ch);
+            }
+        }
+
+        target_disable_irq();
+        TxSegment *segment = &txQueue_[txQueueHead_];
+        segment->data = buffer;
+        segment->length = bufferLen;
+        segment->mark = txBuffHead;
+        txQueueHead_ = (txQueueHead_ + 1) % IMQOPEN_NRF52SERIAL2_TX_QUEUE_LENGTH;
+
+        // The buffer in flight may have started with nothing to chain after it.
+        if (is_tx_direct_ && is_tx_piece_latched_)
+            armTxChain();
+
+        startTxBurst();
+        target_enable_irq();
+
+        if (mode != ASYNC)
+            waitForTxDirect(mode);
+
+        return bufferLen;
+#endif
+    }
+
+    void NRF52Serial2::waitForTxDirect(SerialMode mode, int maxPending)
+    {
+        while (txQueueLength() > maxPending)
+        {
+            if (mode == SYNC_SLEEP && fiber_scheduler_running() && !target_get_irq_disabled())
+            {
+                // Register for the wake up before re-checking, so a completion
+                // raised by the IRQ handler in between can not be missed.
+                target_disable_irq();
+                if (txQueueLength() > maxPending)
+                    fiber_wake_on_event(this->id, IMQOPEN_NRF52SERIAL2_EVT_TX_COMPLETE);
+                target_enable_irq();
+                schedule();
+            }
+        }
+    }
+
+    bool NRF52Serial2::isTxDirectPending()
+    {
+        return txQueueLength() > 0;
+    }
+
+    uint32_t NRF52Serial2::getTxDirectCompleted()
+    {
+        return txCompleted_;
+    }
+
+    int NRF52Serial2::setFramer(Serial2Framer *framer)
+    {
+        if (framer != NULL && is_rx_direct_)
+            return DEVICE_NOT_SUPPORTED;
+
+        target_disable_irq();
+        framer_ = framer;
+        target_enable_irq();
+
+        // Reception only starts with the codal Serial RX buffer.
+        if (framer != NULL && !(status & CODAL_SERIAL_STATUS_RX_BUFF_INIT))
+            initialiseRx();
+
+        return DEVICE_OK;
+    }
+
+    bool NRF52Serial2::isTxBusy()
+    {
+        return txBufferedSize() > 0 || is_tx_in_progress_ || txQueueLength() > 0;
+    }
+
+    void NRF52Serial2::waitForTxIdle(SerialMode mode, bool pending)
+    {
+        while (pending ? isTxBusy() : is_tx_in_progress_)
+        {
+            // schedule() may only be called from thread mode.
+            if (mode == SYNC_SLEEP && fiber_scheduler_running() && !target_get_irq_disabled() && __get_IPSR() == 0)
+            {
+                // Register for the wake up before re-checking, so that an
+                // IMQOPEN_NRF52SERIAL2_EVT_TX_IDLE raised in between can not be missed.
+                target_disable_irq();
+                if (pending ? isTxBusy() : is_tx_in_progress_)
+                    fiber_wake_on_event(this->id, IMQOPEN_NRF52SERIAL2_EVT_TX_IDLE);
+                target_enable_irq();
+                schedule();
+            }
+        }
+    }
+
+    int NRF52Serial2::flush(SerialMode mode)
+    {
+        if (mode == ASYNC)
+            return isTxBusy() ? DEVICE_BUSY : DEVICE_OK;
+
+        waitForTxIdle(mode);
+        return DEVICE_OK;
+    }
+
+    int NRF52Serial2::getStats(NRF52Serial2Stats &stats)
+    {
+#if IMQOPEN_NRF52SERIAL2_STATS
+        target_disable_irq();
+        stats = stats_;
+        target_enable_irq();
+        return DEVICE_OK;
+#else
+        stats = NRF52Serial2Stats();
+        return DEVICE_NOT_SUPPORTED;
+#endif
+    }
+
+    void NRF52Serial2::resetStats()
+    {
+#if IMQOPEN_NRF52SERIAL2_STATS
+        target_disable_irq();
+        stats_ = NRF52Serial2Stats();
+        target_enable_irq();
+#endif
+    }
+
+    void NRF52Serial2::updateRxBufferAfterRXSTARTED()
+    {
+        armNextRxBuffer(false);
+    }
+
+    void NRF52Serial2::armNextRxBuffer(bool first)
+    {
+        if (!is_rx_direct_)
+        {
+            rxDmaArmed_ = first ? 0 : (rxDmaArmed_ + 1) % rxDmaCount_;
+            rxArmedData_ = rxDmaBuffer(rxDmaArmed_);
+            rxArmedLength_ = rxDmaLength_;
+        }
+        else
+        {
+            // Continue after the active region, or at the head if there is none.
+            int start = rxBuffHead;
+            if (!first && rxActiveData_ >= rxBuff && rxActiveData_ < rxBuff + rxRingSize_)
+                start = (rxActiveData_ - rxBuff + rxActiveLength_) % rxRingSize_;
+
+            // Always leave one free byte, so that a full ringbuffer is not mistaken for an empty one.
+            int length = (rxBuffTail + rxRingSize_ - 1 - start) % rxRingSize_;
+            if (length > rxRingSize_ - start)
+                length = rxRingSize_ - start;
+            if (length > rxDmaLength_)
+                length = rxDmaLength_;
+
+            if (length > 0)
+            {
+                rxArmedData_ = rxBuff + start;
+                rxArmedLength_ = length;
+            }
+            else
+            {
+                rxArmedData_ = rxDmaBuffer(0);
+                rxArmedLength_ = rxDmaLength_;
+                Event(this->id, CODAL_SERIAL_EVT_RX_FULL);
+            }
+        }
+
+        nrf_uarte_rx_buffer_set(p_uarte_, rxArmedData_, rxArmedLength_);
+    }
+
+    uint8_t *NRF52Serial2::rxDmaBuffer(int index)
+    {
+        return rxDmaPool_ + index * rxDmaSize_;
+    }
+
+    int NRF52Serial2::startRx()
+    {
+        if (!is_rx_running_)
+        {
+            if (rxDmaPool_ == NULL)
+            {
+                rxDmaPool_ = (uint8_t *)malloc(rxDmaCount_ * rxDmaSize_);
+                if (rxDmaPool_ == NULL)
+                    return DEVICE_NO_RESOURCES;
+            }
+
+            rxDmaLength_ = rxCounter_ != NULL && rxThreshold_ > 0 && rxThreshold_ < rxDmaSize_ ? rxThreshold_ : rxDmaSize_;
+            bytesProcessed = 0;
+            armNextRxBuffer(true);
+            rxActiveData_ = rxArmedData_;
+            rxActiveLength_ = rxArmedLength_;
+
+            if (rxCounter_ != NULL)
+            {
+                rxCounter_->TASKS_CLEAR = 1;
+                rxCountBase_ = 0;
+                rxPollCount_ = 0;
+            }
+        }
+
+        nrf_uarte_int_enable(p_uarte_, SERIAL2_INT_ERROR | NRF_UARTE_INT_ENDRX_MASK);
+
+        if (!is_rx_running_)
+        {
+            is_rx_running_ = true;
+            nrf_uarte_task_trigger(p_uarte_, NRF_UARTE_TASK_STARTRX);
+        }
+
+        return DEVICE_OK;
+    }
+
+    void NRF52Serial2::stopRx()
+    {
+        if (!is_rx_running_)
+            return;
+
+        IRQn_Type IRQn = get_alloc_peri_irqn(p_uarte_);
+        bool irqEnabled = NVIC_GetEnableIRQ(IRQn);
+
+        // Keep the IRQ handler out of the way, the final ENDRX is handled here.
+        NVIC_DisableIRQ(IRQn);
+
+        nrf_uarte_shorts_disable(p_uarte_, NRF_UARTE_SHORT_ENDRX_STARTRX);
+        nrf_uarte_event_clear(p_uarte_, NRF_UARTE_EVENT_RXTO);
+        nrf_uarte_task_trigger(p_uarte_, NRF_UARTE_TASK_STOPRX);
+        while (!nrf_uarte_event_check(p_uarte_, NRF_UARTE_EVENT_RXTO))
+        {
+        }
+        nrf_uarte_event_clear(p_uarte_, NRF_UARTE_EVENT_RXTO);
+
+        // The UARTE generates ENDRX before RXTO, even if the DMA buffer is not full.
+        if (nrf_uarte_event_check(p_uarte_, NRF_UARTE_EVENT_ENDRX))
+        {
+            nrf_uarte_event_clear(p_uarte_, NRF_UARTE_EVENT_ENDRX);
+            updateRxBufferAfterENDRX();
+        }
+        nrf_uarte_event_clear(p_uarte_, NRF_UARTE_EVENT_RXDRDY);
+        nrf_uarte_event_clear(p_uarte_, NRF_UARTE_EVENT_RXSTARTED);
+
+        nrf_uarte_shorts_enable(p_uarte_, NRF_UARTE_SHORT_ENDRX_STARTRX);
+        is_rx_running_ = false;
+
+        if (irqEnabled)
+            NVIC_EnableIRQ(IRQn);
+    }
+
+    int NRF52Serial2::setIdleTimeout(NRFLowLevelTimer *timer, int bitTimes)
+    {
+#if !IMQOPEN_NRF52SERIAL2_RX
+        return DEVICE_NOT_SUPPORTED;
+#else
+        if (bitTimes < 0)
+            return DEVICE_INVALID_PARAMETER;
+
+        if (rxIdleTimer_ != NULL)
+        {
+            NRF_TIMER_Type *t = rxIdleTimer_->timer;
+
+            // Chunks are delimited by the idle timer.
+            if (rxStampTimer_ != NULL)
+                setRxTimestamps(NULL);
+
+            freePpiChannel(rxIdlePpi_);
+            t->TASKS_STOP = 1;
+            t->SHORTS = 0;
+            rxIdleTimer_->clearCompare(0);
+
+            for (int i = 0; i < IDLE_TIMER_OWNERS; i++)
+                if (idleTimerOwners[i] == this)
+                    idleTimerOwners[i] = NULL;
+
+            rxIdleTimer_ = NULL;
+            rxIdlePpi_ = -1;
+            rxIdleBits_ = 0;
+        }
+
+        if (timer == NULL || bitTimes == 0)
+            return DEVICE_OK;
+
+        int owner = 0;
+        while (owner < IDLE_TIMER_OWNERS && idleTimerOwners[owner] != NULL)
+            owner++;
+
+        int ch = allocatePpiChannel();
+        if (ch < 0 || owner == IDLE_TIMER_OWNERS)
+        {
+            if (ch >= 0)
+                freePpiChannel(ch);
+            return DEVICE_NO_RESOURCES;
+        }
+
+        NRF_TIMER_Type *t = timer->timer;
+
+        // 16 MHz, so that the timeout resolution is well below a bit-time at 1 Mbaud.
+        t->TASKS_STOP = 1;
+        t->MODE = TIMER_MODE_MODE_Timer;
+        t->BITMODE = TIMER_BITMODE_BITMODE_32Bit;
+        t->PRESCALER = 0;
+        t->SHORTS = TIMER_SHORTS_COMPARE0_STOP_Msk;
+        t->TASKS_CLEAR = 1;
+
+        rxIdleTimer_ = timer;
+        rxIdlePpi_ = ch;
+        rxIdleBits_ = bitTimes;
+        idleTimerOwners[owner] = this;
+
+        updateIdleTimeout(actualBaudrate_);
+        timer->setIRQ(&NRF52Serial2::_idleTimerIrq);
+        timer->enableIRQ();
+
+        // Every received byte restarts the timeout.
+        NRF_PPI->CH[ch].EEP = nrf_uarte_event_address_get(p_uarte_, NRF_UARTE_EVENT_RXDRDY);
+        NRF_PPI->CH[ch].TEP = (uint32_t)&t->TASKS_CLEAR;
+        NRF_PPI->FORK[ch].TEP = (uint32_t)&t->TASKS_START;
+        NRF_PPI->CHENSET = 1UL << ch;
+
+        return DEVICE_OK;
+#endif
+    }
+
+    int NRF52Serial2::setRs485(Pin *de, Pin *re, NRF_TIMER_Type *guardTimer, uint32_t guardUs)
+    {
+#if !IMQOPEN_NRF52SERIAL2_TX
+        return DEVICE_NOT_SUPPORTED;
+#else
+        if (de != NULL && ((guardUs > 0 && guardTimer == NULL) || guardUs > 0xFFFFFFFF / 16 || re == de))
+            return DEVICE_INVALID_PARAMETER;
+
+        if (de != NULL && rs485Owner != NULL && rs485Owner != this)
+            return DEVICE_BUSY;
+
+        if (guardUs > 0 && (guardTimer == rxCounter_ || guardTimer == rxStampTimer_ || (rxIdleTimer_ != NULL && guardTimer == rxIdleTimer_->timer)))
+            return DEVICE_BUSY;
+
+        // Let the current transmission complete with the current pins.
+        flush(SYNC_SLEEP);
+
+        if (rs485De_ != NULL)
+        {
+            for (int i = 0; i < 4; i++)
+            {
+                if (rs485Ppi_[i] >= 0)
+                    freePpiChannel(rs485Ppi_[i]);
+                rs485Ppi_[i] = -1;
+            }
+
+            if (rs485Timer_ != NULL)
+            {
+                rs485Timer_->TASKS_STOP = 1;
+                rs485Timer_->SHORTS = 0;
+            }
+
+            // Hand the pins back to the GPIO, still driving the transceiver off the bus.
+            NRF_GPIOTE->CONFIG[IMQOPEN_NRF52SERIAL2_RS485_DE_GPIOTE_CHANNEL] = 0;
+            rs485De_->setDigitalValue(0);
+            if (rs485Re_ != NULL)
+            {
+                NRF_GPIOTE->CONFIG[IMQOPEN_NRF52SERIAL2_RS485_RE_GPIOTE_CHANNEL] = 0;
+                rs485Re_->setDigitalValue(0);
+            }
+
+            rs485De_ = NULL;
+            rs485Re_ = NULL;
+            rs485Timer_ = NULL;
+            rs485Owner = NULL;
+        }
+
+        if (de == NULL)
+            return DEVICE_OK;
+
+        if (!isGpioteFree(IMQOPEN_NRF52SERIAL2_RS485_DE_GPIOTE_CHANNEL) ||
+            (re != NULL && !isGpioteFree(IMQOPEN_NRF52SERIAL2_RS485_RE_GPIOTE_CHANNEL)) ||
+            (guardUs > 0 && !isTimerFree(guardTimer)))
+            return DEVICE_BUSY;
+
+        // Assert on TXSTARTED, release on TXSTOPPED or once the guard time has elapsed after it.
+        // With a guard time, TXSTARTED also cancels a pending release.
+        int count = guardUs > 0 ? 4 : 2;
+        for (int i = 0; i < count; i++)
+        {
+            rs485Ppi_[i] = allocatePpiChannel();
+            if (rs485Ppi_[i] < 0)
+            {
+                for (int j = 0; j < i; j++)
+                {
+                    freePpiChannel(rs485Ppi_[j]);
+                    rs485Ppi_[j] = -1;
+                }
+                return DEVICE_NO_RESOURCES;
+            }
+        }
+
+        const int deGpiote = IMQOPEN_NRF52SERIAL2_RS485_DE_GPIOTE_CHANNEL;
+        const int reGpiote = IMQOPEN_NRF52SERIAL2_RS485_RE_GPIOTE_CHANNEL;
+
+        de->setDigitalValue(0);
+        configureGpioteTask(deGpiote, de->name);
+        if (re != NULL)
+        {
+            re->setDigitalValue(0);
+            configureGpioteTask(reGpiote, re->name);
+        }
+
+        uint32_t releaseEvent = nrf_uarte_event_address_get(p_uarte_, NRF_UARTE_EVENT_TXSTOPPED);
+        if (guardUs > 0)
+        {
+            guardTimer->TASKS_STOP = 1;
+            guardTimer->MODE = TIMER_MODE_MODE_Timer;
+            guardTimer->BITMODE = TIMER_BITMODE_BITMODE_32Bit;
+            guardTimer->PRESCALER = 0;
+            guardTimer->SHORTS = TIMER_SHORTS_COMPARE0_STOP_Msk | TIMER_SHORTS_COMPARE0_CLEAR_Msk;
+            guardTimer->CC[0] = guardUs * 16;
+            guardTimer->TASKS_CLEAR = 1;
+
+            NRF_PPI->CH[rs485Ppi_[2]].EEP = releaseEvent;
+            NRF_PPI->CH[rs485Ppi_[2]].TEP = (uint32_t)&guardTimer->TASKS_CLEAR;
+            NRF_PPI->FORK[rs485Ppi_[2]].TEP = (uint32_t)&guardTimer->TASKS_START;
+
+            NRF_PPI->CH[rs485Ppi_[3]].EEP = nrf_uarte_event_address_get(p_uarte_, NRF_UARTE_EVENT_TXSTARTED);
+            NRF_PPI->CH[rs485Ppi_[3]].TEP = (uint32_t)&guardTimer->TASKS_STOP;
+            NRF_PPI->FORK[rs485Ppi_[3]].TEP = (uint32_t)&guardTimer->TASKS_CLEAR;
+
+            releaseEvent = (uint32_t)&guardTimer->EVENTS_COMPARE[0];
+        }
+
+        NRF_PPI->CH[rs485Ppi_[0]].EEP = nrf_uarte_event_address_get(p_uarte_, NRF_UARTE_EVENT_TXSTARTED);
+        NRF_PPI->CH[rs485Ppi_[0]].TEP = (uint32_t)&NRF_GPIOTE->TASKS_SET[deGpiote];
+        NRF_PPI->FORK[rs485Ppi_[0]].TEP = re != NULL ? (uint32_t)&NRF_GPIOTE->TASKS_SET[reGpiote] : 0;
+
+        NRF_PPI->CH[rs485Ppi_[1]].EEP = releaseEvent;
+        NRF_PPI->CH[rs485Ppi_[1]].TEP = (uint32_t)&NRF_GPIOTE->TASKS_CLR[deGpiote];
+        NRF_PPI->FORK[rs485Ppi_[1]].TEP = re != NULL ? (uint32_t)&NRF_GPIOTE->TASKS_CLR[reGpiote] : 0;
+
+        for (int i = 0; i < count; i++)
+            NRF_PPI->CHENSET = 1UL << rs485Ppi_[i];
+
+        rs485De_ = de;
+        rs485Re_ = re;
+        rs485Timer_ = guardUs > 0 ? guardTimer : NULL;
+        rs485Owner = this;
+
+        return DEVICE_OK;
+#endif
+    }
+
+    void NRF52Serial2::updateIdleTimeout(uint32_t baudrate)
+    {
+        if (baudrate == 0)
+            return;
+
+        rxIdleTimer_->setCompare(0, (uint32_t)((uint64_t)rxIdleBits_ * 16000000 / baudrate));
+    }
+
+    void NRF52Serial2::_idleTimerIrq(uint16_t)
+    {
+        // The callback does not tell which timer fired, so every owner checks its own.
+        for (int i = 0; i < IDLE_TIMER_OWNERS; i++)
+            if (idleTimerOwners[i] != NULL)
+                idleTimerOwners[i]->idleTimerIrq();
+    }
+
+    void NRF52Serial2::idleTimerIrq()
+    {
+        NRF_TIMER_Type *t = rxIdleTimer_->timer;
+
+        t->TASKS_CAPTURE[1] = 1;
+        if (t->CC[1] < t->CC[0])
+            return;
+
+        // Rewind the stopped timer, so the same silence is not reported twice.
+        t->TASKS_CLEAR = 1;
+
+        is_rx_idle_pending_ = true;
+        NVIC_SetPendingIRQ(get_alloc_peri_irqn(p_uarte_));
+    }
+
+    void NRF52Serial2::startRxChunk()
+    {
+        if (rxStampTimer_ == NULL || !is_rx_chunk_pending_)
+            return;
+
+        is_rx_chunk_pending_ = false;
+        rxChunkTime_ = rxStampTimer_->CC[0] + rxStampOffset_;
+
+        // A chunk left empty once the ringbuffer has been read is replaced.
+        int last = (rxChunkTail_ + rxChunkCount_ - 1) % IMQOPEN_NRF52SERIAL2_RX_CHUNKS;
+        if (rxChunkCount_ > 0 && rxChunks_[last].start == rxBuffHead)
+            rxChunkCount_--;
+
+        // Otherwise the bytes join the previous chunk.
+        if (rxChunkCount_ == IMQOPEN_NRF52SERIAL2_RX_CHUNKS)
+            return;
+
+        NRF52Serial2RxChunk &chunk = rxChunks_[(rxChunkTail_ + rxChunkCount_) % IMQOPEN_NRF52SERIAL2_RX_CHUNKS];
+        chunk.start = rxBuffHead;
+        chunk.time = rxChunkTime_;
+        rxChunkCount_++;
+    }
+
+    int NRF52Serial2::setRxTimestamps(NRF_TIMER_Type *timer)
+    {
+#if !IMQOPEN_NRF52SERIAL2_RX
+        return DEVICE_NOT_SUPPORTED;
+#else
+        if (timer != NULL && rxIdleTimer_ == NULL)
+            return DEVICE_NOT_SUPPORTED;
+
+        if (timer != NULL && (timer == rxCounter_ || timer == rs485Timer_ || timer == rxIdleTimer_->timer))
+            return DEVICE_BUSY;
+
+        if (rxStampTimer_ != NULL)
+        {
+            freePpiChannel(rxStampPpi_[0]);
+            freePpiChannel(rxStampPpi_[1]);
+            freePpiGroup(rxStampGroup_);
+            rxStampTimer_->TASKS_STOP = 1;
+
+            target_disable_irq();
+            rxStampTimer_ = NULL;
+            is_rx_chunk_pending_ = false;
+            rxChunkCount_ = 0;
+            NRF52Serial2RxChunk *chunks = rxChunks_;
+            rxChunks_ = NULL;
+            target_enable_irq();
+
+            free(chunks);
+            rxStampPpi_[0] = -1;
+            rxStampPpi_[1] = -1;
+            rxStampGroup_ = -1;
+        }
+
+        if (timer == NULL)
+            return DEVICE_OK;
+
+        int first = allocatePpiChannel();
+        int idle = allocatePpiChannel();
+        int group = allocatePpiGroup();
+        NRF52Serial2RxChunk *chunks = (NRF52Serial2RxChunk *)malloc(sizeof(NRF52Serial2RxChunk) * IMQOPEN_NRF52SERIAL2_RX_CHUNKS);
+        if (first < 0 || idle < 0 || group < 0 || chunks == NULL)
+        {
+            if (first >= 0)
+                freePpiChannel(first);
+            if (idle >= 0)
+                freePpiChannel(idle);
+            if (group >= 0)
+                freePpiGroup(group);
+            free(chunks);
+            return DEVICE_NO_RESOURCES;
+        }
+
+        // 1 MHz, wrapping around after 71 minutes like the 32-bit microsecond system time.
+        timer->TASKS_STOP = 1;
+        timer->MODE = TIMER_MODE_MODE_Timer;
+        timer->BITMODE = TIMER_BITMODE_BITMODE_32Bit;
+        timer->PRESCALER = 4;
+        timer->SHORTS = 0;
+        timer->TASKS_CLEAR = 1;
+        timer->TASKS_START = 1;
+
+        // The first byte of a chunk is captured, then the channel disables itself until the line is idle again.
+        NRF_PPI->CH[first].EEP = nrf_uarte_event_address_get(p_uarte_, NRF_UARTE_EVENT_RXDRDY);
+        NRF_PPI->CH[first].TEP = (uint32_t)&timer->TASKS_CAPTURE[0];
+        NRF_PPI->FORK[first].TEP = (uint32_t)&NRF_PPI->TASKS_CHG[group].DIS;
+        NRF_PPI->CHG[group] = 1UL << first;
+
+        NRF_PPI->CH[idle].EEP = (uint32_t)&rxIdleTimer_->timer->EVENTS_COMPARE[0];
+        NRF_PPI->CH[idle].TEP = (uint32_t)&timer->TASKS_CAPTURE[1];
+        NRF_PPI->FORK[idle].TEP = (uint32_t)&NRF_PPI->TASKS_CHG[group].EN;
+
+        target_disable_irq();
+
+        // The system timer runs off the same clock, so the offset between the two does not drift.
+        timer->TASKS_CAPTURE[2] = 1;
+        rxStampOffset_ = (uint32_t)system_timer_current_time_us() - timer->CC[2];
+
+        rxStampTimer_ = timer;
+        rxChunks_ = chunks;
+        rxStampPpi_[0] = first;
+        rxStampPpi_[1] = idle;
+        rxStampGroup_ = group;
+        is_rx_chunk_pending_ = true;
+
+        NRF_PPI->CHENSET = 1UL << idle;
+        NRF_PPI->TASKS_CHG[group].EN = 1;
+
+        target_enable_irq();
+
+        // Data received so far has no timestamp.
+        clearRxBuffer();
+
+        return DEVICE_OK;
+#endif
+    }
+
+    int NRF52Serial2::rxChunkLength(uint32_t *timestamp)
+    {
+        int length = 0;
+
+        target_disable_irq();
+        if (rxChunkCount_ > 0 && rxBuff != NULL)
+        {
+            int end = rxChunkCount_ > 1 ? rxChunks_[(rxChunkTail_ + 1) % IMQOPEN_NRF52SERIAL2_RX_CHUNKS].start : rxBuffHead;
+            length = (end - rxBuffTail + rxRingSize_) % rxRingSize_;
+            if (timestamp != NULL)
+                *timestamp = rxChunks_[rxChunkTail_].time;
+        }
+        target_enable_irq();
+
+        return length > 0 ? length : DEVICE_NO_DATA;
+    }
+
+    int NRF52Serial2::readTimestamped(uint8_t *buffer, int bufferLen, uint32_t *timestamp)
+    {
+        // The IRQ handler only replaces the newest chunk when it is empty, so the oldest one stays put.
+        int length = rxChunkLength(timestamp);
+        if (length < 0)
+            return length;
+
+        return read(buffer, length < bufferLen ? length : bufferLen, ASYNC);
+    }
+
+    uint32_t NRF52Serial2::lastRxTimestamp()
+    {
+        return rxChunkTime_;
+    }
+
+    uint32_t NRF52Serial2::lastRxIdleTimestamp()
+    {
+        return rxIdleTime_;
+    }
+
+    int NRF52Serial2::setRxDirect(bool direct)
+    {
+#if !IMQOPEN_NRF52SERIAL2_RX
+        return DEVICE_NOT_SUPPORTED;
+#else
+        if (direct == is_rx_direct_)
+            return DEVICE_OK;
+
+        if (direct && framer_ != NULL)
+            return DEVICE_NOT_SUPPORTED;
+
+        bool running = is_rx_running_;
+        stopRx();
+
+        is_rx_direct_ = direct;
+
+        if (running)
+            return startRx();
+
+        return DEVICE_OK;
+#endif
+    }
+
+    int NRF52Serial2::setRxDmaBuffers(int count, int size)
+    {
+        if (count < 1 || count > IMQOPEN_NRF52SERIAL2_RX_DMA_MAX_COUNT ||
+            size < 1 || size > IMQOPEN_NRF52SERIAL2_DMA_MAX_LENGTH || size < rxThreshold_)
+            return DEVICE_INVALID_PARAMETER;
+
+        uint8_t *pool = (uint8_t *)malloc(count * size);
+        if (pool == NULL)
+            return DEVICE_NO_RESOURCES;
+
+        bool running = is_rx_running_;
+        stopRx();
+
+        free(rxDmaPool_);
+        rxDmaPool_ = pool;
+        rxDmaCount_ = count;
+        rxDmaSize_ = size;
+
+        if (running)
+            return startRx();
+
+        return DEVICE_OK;
+    }
+
+    int NRF52Serial2::setRxCoalescing(NRF_TIMER_Type *counter, int threshold, uint32_t idleTimeoutUs)
+    {
+#if !IMQOPEN_NRF52SERIAL2_RX
+        return DEVICE_NOT_SUPPORTED;
+#else
+        if (threshold < 0 || threshold > rxDmaSize_)
+            return DEVICE_INVALID_PARAMETER;
+
+        if (counter != NULL && (counter == rxStampTimer_ || counter == rs485Timer_))
+            return DEVICE_BUSY;
+
+        bool running = is_rx_running_;
+        stopRx();
+
+        if (rxCounter_ != NULL)
+        {
+            if (rxIdleTimeoutUs_ > 0)
+            {
+                system_timer_cancel_event(this->id, IMQOPEN_NRF52SERIAL2_EVT_RX_POLL);
+                EventModel::defaultEventBus->ignore(this->id, IMQOPEN_NRF52SERIAL2_EVT_RX_POLL, this, &NRF52Serial2::onRxPoll);
+            }
+
+            freePpiChannel(rxCounterPpi_);
+            rxCounter_->TASKS_STOP = 1;
+            rxCounter_ = NULL;
+            rxCounterPpi_ = -1;
+        }
+
+        rxThreshold_ = 0;
+        rxIdleTimeoutUs_ = 0;
+
+        int result = DEVICE_OK;
+
+        if (counter != NULL)
+        {
+            int ch = allocatePpiChannel();
+
+            if (ch < 0)
+            {
+                result = DEVICE_NO_RESOURCES;
+            }
+            else
+            {
+                counter->TASKS_STOP = 1;
+                counter->MODE = TIMER_MODE_MODE_LowPowerCounter;
+                counter->BITMODE = TIMER_BITMODE_BITMODE_32Bit;
+                counter->TASKS_CLEAR = 1;
+                counter->TASKS_START = 1;
+
+                NRF_PPI->CH[ch].EEP = nrf_uarte_event_address_get(p_uarte_, NRF_UARTE_EVENT_RXDRDY);
+                NRF_PPI->CH[ch].TEP = (uint32_t)&counter->TASKS_COUNT;
+                NRF_PPI->CHENSET = 1UL << ch;
+
+                rxCounter_ = counter;
+                rxCounterPpi_ = ch;
+                rxThreshold_ = threshold;
+                rxIdleTimeoutUs_ = idleTimeoutUs;
+
+                if (idleTimeoutUs > 0 && EventModel::defaultEventBus)
+                {
+                    EventModel::defaultEventBus->listen(this->id, IMQOPEN_NRF52SERIAL2_EVT_RX_POLL, this, &NRF52Serial2::onRxPoll, MESSAGE_BUS_LISTENER_IMMEDIATE);
+                    system_timer_event_every_us(idleTimeoutUs, this->id, IMQOPEN_NRF52SERIAL2_EVT_RX_POLL);
+                }
+            }
+        }
+
+        if (rxCounter_ != NULL)
+            nrf_uarte_int_disable(p_uarte_, NRF_UARTE_INT_RXDRDY_MASK);
+        else
+            nrf_uarte_int_enable(p_uarte_, NRF_UARTE_INT_RXDRDY_MASK);
+
+        if (running)
+        {
+            int restarted = startRx();
+            if (result == DEVICE_OK)
+                result = restarted;
+        }
+
+        return result;
+#endif
+    }
+
+    /**
+     * Puts the component in (or out of) sleep (low power) mode.
+     *
+     * If CODAL_SERIAL_STATUS_DEEPSLEEP is set, then the peripheral will remain active during deep
+     * sleep, and will wake the processor if new data is received.
      */
     int NRF52Serial2::setSleep(bool doSleep)
     {
@@ -397,8 +2918,7 @@ namespace imqopen
             disableInterrupt(RxInterrupt);
 
             // wait...
-            while (txBufferedSize() > 0 || is_tx_in_progress_)
-                ;
+            waitForTxIdle(SYNC_SLEEP);
 
             NVIC_DisableIRQ(IRQn);
         }
@@ -446,8 +2966,10 @@ namespace imqopen
             disableInterrupt(RxInterrupt);
 
             // When we get here tx is locked, but the tx interrupt is still working to empty the buffer
-            while (txBufferedSize() > 0 || is_tx_in_progress_) /*wait*/
-                ;
+            waitForTxIdle(SYNC_SLEEP);
+
+            // Stop the receiver, so that it restarts from the first DMA buffer once enabled again.
+            stopRx();
 
             nrf_uarte_disable(p_uarte_);
         }
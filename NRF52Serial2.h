@@ -6,12 +6,35 @@
 #include "CodalComponent.h"
 #include "CodalConfig.h"
 #include "Serial.h"
+#include "NRFLowLevelTimer.h"
 #include "hal/nrf_uarte.h"
 
 #ifndef CONFIG_SERIAL_DMA_BUFFER_SIZE
 #define CONFIG_SERIAL_DMA_BUFFER_SIZE 32
 #endif
 
+#ifndef CONFIG_SERIAL_DMA_BUFFER_COUNT
+#define CONFIG_SERIAL_DMA_BUFFER_COUNT 2
+#endif
+
+// Upper limit for the number of RX DMA buffers set with setRxDmaBuffers()
+#define IMQOPEN_NRF52SERIAL2_RX_DMA_MAX_COUNT 8
+
+// PPI channels the driver may allocate for its hardware assisted modes (bit n = channel n)
+#ifndef IMQOPEN_NRF52SERIAL2_PPI_CHANNELS
+#define IMQOPEN_NRF52SERIAL2_PPI_CHANNELS 0x000FF000
+#endif
+
+// PPI channel groups the driver may allocate (bit n = group n)
+#ifndef IMQOPEN_NRF52SERIAL2_PPI_GROUPS
+#define IMQOPEN_NRF52SERIAL2_PPI_GROUPS 0x30
+#endif
+
+// Number of sendDirect() buffers that can be queued
+#ifndef IMQOPEN_NRF52SERIAL2_TX_QUEUE_LENGTH
+#define IMQOPEN_NRF52SERIAL2_TX_QUEUE_LENGTH 8
+#endif
+
 // Suggested range for device-specific IDs: 50-79
 #define IMQOPEN_NRF52SERIAL2_DEFAULT_DEVICE_ID 70
 
@@ -23,17 +46,318 @@
 // #define IMQOPEN_NRF52SERIAL2_EVT_ERROR_PARITY 11
 #define IMQOPEN_NRF52SERIAL2_EVT_ERROR_FRAMING 12
 #define IMQOPEN_NRF52SERIAL2_EVT_ERROR_BREAK 13
+#define IMQOPEN_NRF52SERIAL2_EVT_TX_COMPLETE 20
+#define IMQOPEN_NRF52SERIAL2_EVT_IDLE 21
+#define IMQOPEN_NRF52SERIAL2_EVT_FRAME 22
+#define IMQOPEN_NRF52SERIAL2_EVT_FRAME_ERROR 23
+#define IMQOPEN_NRF52SERIAL2_EVT_TX_IDLE 24
+// Raised as IMQOPEN_NRF52SERIAL2_EVT_TOKEN + index, see NRF52Serial2::addToken()
+#define IMQOPEN_NRF52SERIAL2_EVT_TOKEN 32
+
+// Internal, raised by the system timer to poll for an idle line in coalesced RX mode
+#define IMQOPEN_NRF52SERIAL2_EVT_RX_POLL 90
+#define IMQOPEN_NRF52SERIAL2_EVT_LINE 91
+#define IMQOPEN_NRF52SERIAL2_EVT_TX_ROOM 92
+// Internal, raised by the system timer to dispatch the rate limited events, see NRF52Serial2::setEventInterval()
+#define IMQOPEN_NRF52SERIAL2_EVT_DISPATCH 93
+
+// Number of events NRF52Serial2::setEventInterval() rate limits: DATA_RECEIVED, ERROR_OVERRUN, ERROR_FRAMING, ERROR_BREAK
+#define IMQOPEN_NRF52SERIAL2_RATE_LIMITED_EVENTS 4
+
+// Largest transfer EasyDMA accepts in one go (16-bit TXD.MAXCNT)
+#define IMQOPEN_NRF52SERIAL2_DMA_MAX_LENGTH 0xFFFF
+
+// Bytes the UARTE FIFO and a slow sender may still deliver once RTS is deasserted. The default
+// high-water mark leaves this much free in the RX ringbuffer on top of the armed RX DMA buffers.
+#ifndef IMQOPEN_NRF52SERIAL2_RTS_HEADROOM
+#define IMQOPEN_NRF52SERIAL2_RTS_HEADROOM 8
+#endif
+
+// Worst-case latency of the UARTE IRQ handler. sendDirect() only chains a piece lasting longer than
+// this, a shorter one could end before its ENDTX is told apart from the one of the piece before it.
+#ifndef IMQOPEN_NRF52SERIAL2_TX_CHAIN_MIN_US
+#define IMQOPEN_NRF52SERIAL2_TX_CHAIN_MIN_US 2000
+#endif
+
+// Highest baud rate the UARTE supports
+#define IMQOPEN_NRF52SERIAL2_BAUDRATE_MAX 1000000
+
+// GPIOTE channel timestamping the RX pin edges in autoBaud()
+#ifndef IMQOPEN_NRF52SERIAL2_AUTOBAUD_GPIOTE_CHANNEL
+#define IMQOPEN_NRF52SERIAL2_AUTOBAUD_GPIOTE_CHANNEL 7
+#endif
+
+// GPIOTE channels driving the RS-485 DE and /RE pins, see setRs485(). Only one instance can use them at a time.
+#ifndef IMQOPEN_NRF52SERIAL2_RS485_DE_GPIOTE_CHANNEL
+#define IMQOPEN_NRF52SERIAL2_RS485_DE_GPIOTE_CHANNEL 6
+#endif
+#ifndef IMQOPEN_NRF52SERIAL2_RS485_RE_GPIOTE_CHANNEL
+#define IMQOPEN_NRF52SERIAL2_RS485_RE_GPIOTE_CHANNEL 5
+#endif
+
+// Silence after which autoBaud() assumes the line is idle, longer than a frame at 1200 baud
+#ifndef IMQOPEN_NRF52SERIAL2_AUTOBAUD_IDLE_US
+#define IMQOPEN_NRF52SERIAL2_AUTOBAUD_IDLE_US 10000
+#endif
+
+// Time autoBaud() polls for the next edge of a frame before yielding to other fibers,
+// longer than a bit at 19200 baud so that faster frames are measured without yielding
+#ifndef IMQOPEN_NRF52SERIAL2_AUTOBAUD_SPIN_US
+#define IMQOPEN_NRF52SERIAL2_AUTOBAUD_SPIN_US 100
+#endif
+
+// Number of received line delimiters whose position is remembered for readUntil()
+#ifndef IMQOPEN_NRF52SERIAL2_LINE_INDEX_LENGTH
+#define IMQOPEN_NRF52SERIAL2_LINE_INDEX_LENGTH 16
+#endif
+
+// Number of received chunks whose arrival time is remembered in timestamped RX mode
+#ifndef IMQOPEN_NRF52SERIAL2_RX_CHUNKS
+#define IMQOPEN_NRF52SERIAL2_RX_CHUNKS 8
+#endif
+
+// Set to 0 to compile out the driver statistics returned by getStats()
+#ifndef IMQOPEN_NRF52SERIAL2_STATS
+#define IMQOPEN_NRF52SERIAL2_STATS 1
+#endif
+
+// Set to 0 for a transmit-only driver, which leaves the RX pin free and never allocates RX buffers
+#ifndef IMQOPEN_NRF52SERIAL2_RX
+#define IMQOPEN_NRF52SERIAL2_RX 1
+#endif
+
+// Set to 0 for a receive-only driver, which leaves the TX pin free and never allocates the TX buffer
+#ifndef IMQOPEN_NRF52SERIAL2_TX
+#define IMQOPEN_NRF52SERIAL2_TX 1
+#endif
+
+// Set to 0 not to raise events on reception errors, which are then only counted in the statistics
+#ifndef IMQOPEN_NRF52SERIAL2_ERROR_EVENTS
+#define IMQOPEN_NRF52SERIAL2_ERROR_EVENTS 1
+#endif
+
+// Initial interval of the rate limited events in microseconds, see NRF52Serial2::setEventInterval(). 0 raises them at once.
+#ifndef IMQOPEN_NRF52SERIAL2_EVENT_INTERVAL_US
+#define IMQOPEN_NRF52SERIAL2_EVENT_INTERVAL_US 0
+#endif
+
+// Priority of the UARTE interrupt, the same as uBit.serial by default
+#ifndef IMQOPEN_NRF52SERIAL2_IRQ_PRIORITY
+#define IMQOPEN_NRF52SERIAL2_IRQ_PRIORITY 2
+#endif
+
+#if !IMQOPEN_NRF52SERIAL2_RX && !IMQOPEN_NRF52SERIAL2_TX
+#error "IMQOPEN_NRF52SERIAL2_RX and IMQOPEN_NRF52SERIAL2_TX cannot both be 0"
+#endif
+
+// Number of tokens matched in the received data, each raising its own event
+#ifndef IMQOPEN_NRF52SERIAL2_TOKEN_COUNT
+#define IMQOPEN_NRF52SERIAL2_TOKEN_COUNT 8
+#endif
+
+// Number of states of the token matcher, one plus the total length of the tokens without common prefixes
+#ifndef IMQOPEN_NRF52SERIAL2_TOKEN_STATES
+#define IMQOPEN_NRF52SERIAL2_TOKEN_STATES 64
+#endif
+
+#if IMQOPEN_NRF52SERIAL2_TOKEN_COUNT > 32 || IMQOPEN_NRF52SERIAL2_TOKEN_STATES > 255
+#error "IMQOPEN_NRF52SERIAL2_TOKEN_COUNT must be at most 32 and IMQOPEN_NRF52SERIAL2_TOKEN_STATES at most 255"
+#endif
 
 namespace imqopen
 {
 
   using namespace codal;
 
+  class Serial2Framer;
+
+  /**
+   * A burst of received data in timestamped RX mode, see NRF52Serial2::setRxTimestamps().
+   **/
+  struct NRF52Serial2RxChunk
+  {
+    uint16_t start; // position of its first byte in the RX ringbuffer
+    uint32_t time;  // arrival time of its first byte, in microseconds
+  };
+
+  /**
+   * A state of the token matcher, see NRF52Serial2::addToken(). State 0 is the root.
+   **/
+  struct NRF52Serial2TokenState
+  {
+    uint8_t c;        // byte leading to this state from its parent
+    uint8_t child;    // first child, 0 if none
+    uint8_t sibling;  // next child of the same parent, 0 if none
+    uint8_t fail;     // state of the longest proper suffix, 0 for none
+    uint8_t token;    // one plus the index of the token ending in this state, 0 if none
+    uint32_t matches; // bit mask of the tokens ending in this state or in its suffixes
+  };
+
+  /**
+   * Driver statistics, see NRF52Serial2::getStats(). Counters wrap around.
+   **/
+  struct NRF52Serial2Stats
+  {
+    uint32_t rxBytes;
+    uint32_t txBytes;
+    // ENDRX and ENDTX events
+    uint32_t rxDmaTransfers;
+    uint32_t txDmaTransfers;
+    // ENDRX events that found bytes whose RXDRDY had not been handled yet
+    uint32_t rxLateFlushes;
+    uint32_t overrunErrors;
+    uint32_t framingErrors;
+    uint32_t breakErrors;
+    // Received bytes lost because the RX ringbuffer was full
+    uint32_t rxDropped;
+    // Most bytes held in the RX and TX ringbuffers
+    uint32_t rxHighWater;
+    uint32_t txHighWater;
+    // UARTE IRQ handler runs, and their length in CPU cycles
+    uint32_t irqCount;
+    uint32_t irqCyclesMin;
+    uint32_t irqCyclesMax;
+    uint64_t irqCycles;
+  };
+
   class NRF52Serial2 : public Serial
   {
     volatile bool is_tx_in_progress_;
+    volatile bool is_tx_burst_;
+    volatile bool is_tx_direct_;
+
+    // sendDirect() buffers, each sent once the TX ringbuffer has been sent up to its mark.
+    // The one at txQueueTail_ is being sent, txPieceLength_ bytes at a time (at most one DMA transfer).
+    struct TxSegment
+    {
+      const uint8_t *data;
+      int length;
+      uint16_t mark;
+    };
+    TxSegment txQueue_[IMQOPEN_NRF52SERIAL2_TX_QUEUE_LENGTH];
+    volatile uint8_t txQueueHead_;
+    volatile uint8_t txQueueTail_;
+    volatile uint32_t txCompleted_;
+    uint16_t txPieceLength_;
+
+    // Gapless TX: the next piece is preloaded into TXD.PTR/MAXCNT at TXSTARTED, and a PPI channel
+    // in a group it disables itself with triggers STARTTX on ENDTX.
+    int txChainPpi_;
+    int txChainGroup_;
+    uint16_t txChainedLength_;
+    volatile bool is_tx_chained_;
+    volatile bool is_tx_piece_latched_;
+    volatile bool is_rx_running_;
     volatile int bytesProcessed;
-    uint8_t dmaBuffer[CONFIG_SERIAL_DMA_BUFFER_SIZE];
+
+    // RX DMA buffers, rxDmaCount_ consecutive blocks of rxDmaSize_ bytes, of which rxDmaLength_ are used per transfer.
+    // rxDmaArmed_ is the index of the buffer EasyDMA will continue into on ENDRX.
+    uint8_t *rxDmaPool_;
+    uint16_t rxDmaSize_;
+    uint8_t rxDmaCount_;
+    volatile uint8_t rxDmaArmed_;
+    uint16_t rxDmaLength_;
+
+    // Direct RX: EasyDMA writes into free regions of the codal Serial ringbuffer instead of the RX DMA buffers.
+    bool is_rx_direct_;
+
+    // The memory EasyDMA is filling (active) and will continue into on ENDRX (armed):
+    // an RX DMA buffer, a region of the codal Serial ringbuffer, or the first RX DMA buffer as a sink when it is full.
+    uint8_t *volatile rxActiveData_;
+    volatile uint16_t rxActiveLength_;
+    uint8_t *volatile rxArmedData_;
+    volatile uint16_t rxArmedLength_;
+
+    // Coalesced RX: a TIMER in counter mode counts RXDRDY events through PPI.
+    // rxCountBase_ is the counter value at the start of the active RX DMA buffer.
+    NRF_TIMER_Type *rxCounter_;
+    int rxCounterPpi_;
+    volatile uint32_t rxCountBase_;
+    uint32_t rxPollCount_;
+    uint16_t rxThreshold_;
+    uint32_t rxIdleTimeoutUs_;
+
+    // Idle line detection: a TIMER cleared and started through PPI on every RXDRDY, which stops on COMPARE0.
+    NRFLowLevelTimer *rxIdleTimer_;
+    int rxIdlePpi_;
+    uint16_t rxIdleBits_;
+    volatile bool is_rx_idle_pending_;
+
+    // Timestamped RX: a free-running 1 MHz TIMER captures the first RXDRDY after the line went idle into CC[0],
+    // through a PPI channel in a group that disables itself and is enabled again by the idle timer, and the
+    // idle timeout into CC[1]. rxChunks_ holds the chunks in the RX ringbuffer, oldest first, and is only
+    // allocated while timestamps are enabled.
+    NRF_TIMER_Type *rxStampTimer_;
+    int rxStampPpi_[2];
+    int rxStampGroup_;
+    uint32_t rxStampOffset_;
+    NRF52Serial2RxChunk *rxChunks_;
+    volatile uint8_t rxChunkTail_;
+    volatile uint8_t rxChunkCount_;
+    volatile bool is_rx_chunk_pending_;
+    volatile uint32_t rxChunkTime_;
+    volatile uint32_t rxIdleTime_;
+
+    // Flow control: CTS is handled by the UARTE, RTS is driven by software from the RX ringbuffer level.
+    Pin *rts_;
+    Pin *cts_;
+    uint16_t rtsHighWater_;
+    volatile bool is_rts_deasserted_;
+
+    // RS-485: PPI channels drive the DE (and /RE) pins from TXSTARTED and TXSTOPPED, optionally delayed by a TIMER.
+    Pin *rs485De_;
+    Pin *rs485Re_;
+    NRF_TIMER_Type *rs485Timer_;
+    int rs485Ppi_[4];
+
+    // Sizes of the RX and TX ringbuffers, which replace the 8-bit codal Serial rxBuffSize and txBuffSize.
+    // With an arena, RX is at its start and TX at its end, otherwise both are allocated on the heap.
+    uint16_t rxRingSize_;
+    uint16_t txRingSize_;
+    uint8_t *arena_;
+    uint32_t arenaSize_;
+    // Position of the RX ringbuffer head a reading fiber waits for, or -1
+    volatile int rxHeadMatch_;
+    // A writing fiber waits for room in the TX ringbuffer
+    volatile bool is_tx_room_waited_;
+
+    // Receives the data instead of the codal Serial ringbuffer when set
+    Serial2Framer *framer_;
+
+    // Baud rate produced by the BAUDRATE register, which may differ slightly from the requested one.
+    uint32_t actualBaudrate_;
+    // Last requested baud rate that was accepted, restored into the codal Serial baudrate when one is rejected.
+    uint32_t acceptedBaudrate_;
+
+#if IMQOPEN_NRF52SERIAL2_STATS
+    NRF52Serial2Stats stats_;
+#endif
+
+    // Positions in rxBuff of the received lineDelimiters_ characters, oldest first.
+    // Bytes from the tail up to lineScanned_ have been looked at, the rest once the index has room again.
+    ManagedString lineDelimiters_;
+    uint16_t lineIndex_[IMQOPEN_NRF52SERIAL2_LINE_INDEX_LENGTH];
+    volatile uint8_t lineIndexTail_;
+    volatile uint8_t lineIndexCount_;
+    volatile uint16_t lineScanned_;
+    uint8_t *lineBuff_;
+    uint16_t lineBuffSize_;
+    volatile bool is_line_waited_;
+
+    // Aho-Corasick automaton over the tokens, fed as bytes enter rxBuff.
+    // tokenEnd_ holds the position in rxBuff after the latest match of each token, or -1.
+    // Both are allocated together by the first addToken() and freed by clearTokens().
+    NRF52Serial2TokenState *tokenStates_;
+    uint8_t tokenStateCount_;
+    uint8_t tokenCount_;
+    volatile uint8_t tokenState_;
+    volatile int32_t *tokenEnd_;
+
+    // Rate limited events, see setEventInterval(). eventPending_ accumulates what the IRQ handler
+    // would have raised them with, eventCount_ holds what the latest raised ones stood for.
+    uint32_t eventIntervalUs_;
+    volatile uint32_t eventPending_[IMQOPEN_NRF52SERIAL2_RATE_LIMITED_EVENTS];
+    volatile uint32_t eventCount_[IMQOPEN_NRF52SERIAL2_RATE_LIMITED_EVENTS];
 
     NRF_UARTE_Type *p_uarte_;
     static void _irqHandler(void *self);
@@ -52,10 +376,37 @@ namespace imqopen
      * Update DMA RX buffer pointer.
      *
      * UARTE generates an RXSTARTED event once the DMA buffer geometry has been read.
-     * This function implements a DMA enabled double buffer within the codal Serial ringbuffer.
+     * This function arms the next buffer of the RX DMA buffer set, so EasyDMA moves on to a different
+     * buffer at ENDRX and bytes not yet copied into the codal Serial ringbuffer are not overwritten.
      **/
     void updateRxBufferAfterRXSTARTED();
 
+    /**
+     * Returns the RX DMA buffer with the given index.
+     **/
+    uint8_t *rxDmaBuffer(int index);
+
+    /**
+     * Selects and hands to EasyDMA the memory to receive into after the active transfer.
+     *
+     * In direct RX mode this is the free, contiguous region of the codal Serial ringbuffer following the
+     * active one. If there is none, an RX_FULL event is raised and bytes are received into a sink and dropped.
+     *
+     * @param first true when reception is about to be started, and there is no active transfer.
+     **/
+    void armNextRxBuffer(bool first);
+
+    /**
+     * Starts reception into the first RX DMA buffer, allocating the buffer set if needed.
+     * Only re-enables the RX interrupts if the receiver is already running.
+     **/
+    int startRx();
+
+    /**
+     * Stops the receiver and flushes the bytes it has received into the codal Serial ringbuffer.
+     **/
+    void stopRx();
+
     /**
      * DMA version of Serial::dataReceviced()
      *
@@ -66,8 +417,195 @@ namespace imqopen
      **/
     void dataReceivedDMA();
 
+    /**
+     * Block version of Serial::dataReceived()
+     *
+     * Stores the bytes in the codal Serial ringbuffer, raising a DELIM_MATCH event for each delimiter
+     * found in the block, and a single RX_FULL and DATA_RECEIVED event for the whole block.
+     **/
+    void dataReceivedBlock(const uint8_t *data, int len);
+
+    /**
+     * Processes the bytes counted by the RX counter that have not been processed yet (coalesced RX).
+     **/
+    void updateRxBufferFromCounter();
+
+    /**
+     * Periodic check for an idle line in coalesced RX mode.
+     *
+     * If the counter has not moved since the previous poll and bytes are pending,
+     * the UARTE IRQ is pended so that its handler flushes them.
+     **/
+    void onRxPoll(Event);
+
+    /**
+     * Raises a rate limited event standing for count bytes or errors,
+     * or adds them to the pending ones if the events are deferred.
+     **/
+    void raiseEvent(int index, uint32_t count);
+
+    /**
+     * Raises each rate limited event pending since the previous dispatch, once.
+     **/
+    void dispatchEvents();
+    void onEventDispatch(Event);
+
+    /**
+     * Sets the idle timer compare value from the idle timeout in bit-times and the given baud rate.
+     **/
+    void updateIdleTimeout(uint32_t baudrate);
+
+    /**
+     * Handles the COMPARE0 interrupt of the idle timers of all NRF52Serial2 instances.
+     **/
+    static void _idleTimerIrq(uint16_t channels);
+
+    /**
+     * Pends an IMQOPEN_NRF52SERIAL2_EVT_IDLE event, raised by the UARTE IRQ handler,
+     * if this instance's idle timer has expired.
+     **/
+    void idleTimerIrq();
+
+    /**
+     * Starts a new chunk at the head of the RX ringbuffer if the line has been idle, in timestamped RX mode.
+     * Called by the IRQ handler before received bytes are stored.
+     **/
+    void startRxChunk();
+
+    /**
+     * Starts a DMA transfer of the largest contiguous span of the codal Serial TX ringbuffer.
+     *
+     * The span starts at txBuffTail and ends at txBuffHead or at the end of the ringbuffer,
+     * whichever comes first. Does nothing if a transfer is already in progress or the ringbuffer is empty.
+     * Must be called with the UARTE interrupt masked (from the IRQ handler or with IRQs disabled).
+     **/
+    void startTxBurst();
+
+    /**
+     * Releases the bytes of a completed TX burst from the codal Serial TX ringbuffer.
+     *
+     * @param txBytes the number of bytes the UARTE reported as transmitted (TXD.AMOUNT)
+     **/
+    void updateTxBufferAfterENDTX(int txBytes);
+
+    /**
+     * Advances the sendDirect() buffer being sent, raising IMQOPEN_NRF52SERIAL2_EVT_TX_COMPLETE once done.
+     *
+     * @param txBytes the number of bytes the UARTE reported as transmitted (TXD.AMOUNT)
+     **/
+    void updateTxDirectAfterENDTX(int txBytes);
+
+    /**
+     * Finds the piece to send after the sendDirect() piece in flight: the rest of its buffer,
+     * or the next queued buffer if no ringbuffer data has to go out before it.
+     *
+     * @return the length of the piece, or 0 if there is none.
+     **/
+    int nextTxPiece(const uint8_t **data);
+
+    /**
+     * Preloads the next piece and arms the ENDTX->STARTTX PPI channel. Called once the piece in flight has started.
+     **/
+    void armTxChain();
+
+
+    /**
+     * Returns true while there is data in the TX ringbuffer, a pending sendDirect() transfer,
+     * or a transfer in progress.
+     **/
+    bool isTxBusy();
+
+    /**
+     * Waits until the transmitter is idle, yielding to other fibers when called from fiber context.
+     * Spins when interrupts are disabled, in an interrupt handler, or before the scheduler is running.
+     *
+     * @param mode SYNC_SLEEP to yield while waiting, SYNC_SPINWAIT to always spin.
+     *
+     * @param pending true to also wait for the TX ringbuffer and the sendDirect() queue to drain,
+     *                false to only wait for the transfer in progress.
+     **/
+    void waitForTxIdle(SerialMode mode, bool pending = true);
+
     void errorDetected(uint32_t src);
 
+    /**
+     * Writes the UARTE CONFIG register, enabling hardware flow control if a CTS pin is set.
+     **/
+    void configure();
+
+    /**
+     * Deasserts RTS when the RX ringbuffer has reached the high-water mark,
+     * and asserts it again once it has been drained to half of it.
+     **/
+    void updateRts();
+
+    /**
+     * Adds the line delimiters received since the last call to the line index, while it has room.
+     * Starts over if the RX ringbuffer has been reallocated. Must be called with interrupts disabled.
+     **/
+    void indexLines();
+
+    /**
+     * Updates the line index and RTS once bytes have been read from the RX ringbuffer.
+     *
+     * @param from the tail of the ringbuffer before the read.
+     **/
+    void rxConsumed(uint16_t from);
+
+    /**
+     * Returns the child of a token matcher state reached with a byte, or 0 if there is none.
+     **/
+    int tokenChild(int state, uint8_t c);
+
+    /**
+     * Computes the fail links and match masks of the token matcher states, breadth first.
+     **/
+    void linkTokenStates();
+
+    /**
+     * Feeds a byte stored in rxBuff to the token matcher,
+     * raising IMQOPEN_NRF52SERIAL2_EVT_TOKEN + index for each token it completes.
+     *
+     * @param end the position in rxBuff after the byte.
+     **/
+    void matchTokens(uint8_t c, uint16_t end);
+
+    /**
+     * Forgets the matches and the partial match in progress, once the RX ringbuffer is emptied or reallocated.
+     **/
+    void resetTokenMatches();
+
+    /**
+     * (Re)allocates the RX ringbuffer and starts reception.
+     *
+     * @param size the new size of the ringbuffer, or 0 to keep it.
+     **/
+    int initialiseRx(int size = 0);
+
+    /**
+     * Waits until the RX ringbuffer holds length bytes, or is full.
+     **/
+    void waitForRx(int length, SerialMode mode);
+
+    /**
+     * Moves up to length bytes from the RX ringbuffer to buffer.
+     *
+     * @return the number of bytes moved.
+     **/
+    int takeBytes(uint8_t *buffer, int length);
+
+    /**
+     * Removes length bytes from the RX ringbuffer, plus skip bytes that are not returned.
+     **/
+    ManagedString takeString(int length, int skip);
+
+    /**
+     * (Re)allocates the TX ringbuffer, once the data it holds has been sent.
+     *
+     * @param size the new size of the ringbuffer, or 0 to keep it.
+     **/
+    int initialiseTx(int size = 0);
+
   protected:
     virtual int enableInterrupt(SerialInterruptType t) override;
     virtual int disableInterrupt(SerialInterruptType t) override;
@@ -84,6 +622,400 @@ namespace imqopen
      **/
     NRF52Serial2(Pin &tx, Pin &rx, uint16_t id = IMQOPEN_NRF52SERIAL2_DEFAULT_DEVICE_ID, NRF_UARTE_Type *device = NULL);
 
+    /**
+     * Creates an instance on a free UARTE.
+     *
+     * Unlike the constructor, which panics, this returns NULL when all UARTEs are in use.
+     * The nRF52833 has two, one of which is used by uBit.serial.
+     *
+     * @param id the device ID of the instance, e.g. one of 50 to 79 which codal leaves to extensions.
+     *
+     * @return the new instance, or NULL.
+     **/
+    static NRF52Serial2 *create(Pin &tx, Pin &rx, uint16_t id);
+
+    /**
+     * Redirects the port to the given pins, without flow control.
+     **/
+    virtual int redirect(Pin &tx, Pin &rx) override;
+
+    /**
+     * Redirects the port to the given pins, with RTS/CTS hardware flow control.
+     *
+     * Transmission is paused by the UARTE while CTS is high. RTS is driven high when the
+     * RX ringbuffer reaches the high-water mark (see setFlowControlThreshold()),
+     * and low again once read() has drained it to half of that.
+     *
+     * @param rts the pin to drive RTS on, or NULL.
+     *
+     * @param cts the pin to read CTS from, or NULL.
+     *
+     * @return DEVICE_OK.
+     **/
+    int redirect(Pin &tx, Pin &rx, Pin *rts, Pin *cts);
+
+    /**
+     * Sets the number of bytes in the RX ringbuffer at which RTS is deasserted.
+     *
+     * @param highWater 1 to the RX ringbuffer size minus one, or 0 for the default, which leaves room
+     *                  for the two armed RX DMA buffers plus IMQOPEN_NRF52SERIAL2_RTS_HEADROOM bytes,
+     *                  or half the ringbuffer when it is smaller than twice that.
+     *
+     * @return DEVICE_OK or DEVICE_INVALID_PARAMETER.
+     **/
+    int setFlowControlThreshold(int highWater);
+
+    /**
+     * Returns the baud rate actually produced by the UARTE for the last requested one.
+     **/
+    uint32_t getBaudrate();
+
+    /**
+     * Measures the baud rate of the incoming 0x55 sync byte and configures the port for it.
+     *
+     * 0x55 has an edge at each of its ten bit boundaries. The edges are timestamped by a
+     * GPIOTE event on the RX pin capturing the timer through PPI, and polled by the calling fiber, which
+     * yields between frames and once an edge is more than IMQOPEN_NRF52SERIAL2_AUTOBAUD_SPIN_US late.
+     * A break preceding the sync byte (as in LIN) is skipped. Received bytes are discarded.
+     *
+     * @param timer a TIMER that is not used by anything else while autoBaud() runs.
+     *
+     * @param timeoutMs how long to wait for the sync byte, at most 60000.
+     *
+     * @return the detected baud rate, DEVICE_NO_DATA if no sync byte was received in time,
+     *         DEVICE_INVALID_PARAMETER, DEVICE_BUSY if the timer or IMQOPEN_NRF52SERIAL2_AUTOBAUD_GPIOTE_CHANNEL
+     *         is already in use, or DEVICE_NO_RESOURCES.
+     **/
+    int autoBaud(NRF_TIMER_Type *timer, uint32_t timeoutMs);
+
+    // The codal Serial ringbuffer functions, hidden to support rings of up to 65535 bytes and
+    // to reassert RTS once the RX ringbuffer has been drained. The codal Serial versions must not be used.
+    // getc() and redirect() are overridden for the same reason; eventOn(), setBaud() and printf()
+    // do not touch the ringbuffers and are inherited as they are.
+    int sendChar(char c, SerialMode mode = DEVICE_DEFAULT_SERIAL_MODE);
+    int send(ManagedString s, SerialMode mode = DEVICE_DEFAULT_SERIAL_MODE);
+    int send(uint8_t *buffer, int bufferLen, SerialMode mode = DEVICE_DEFAULT_SERIAL_MODE);
+    int read(SerialMode mode = DEVICE_DEFAULT_SERIAL_MODE);
+    ManagedString read(int size, SerialMode mode = DEVICE_DEFAULT_SERIAL_MODE);
+    int read(uint8_t *buffer, int bufferLen, SerialMode mode = DEVICE_DEFAULT_SERIAL_MODE);
+    int clearRxBuffer();
+    int eventAfter(int len, SerialMode mode = ASYNC);
+    int isReadable();
+    int isWriteable();
+
+    /**
+     * Gives access to the received bytes at the tail of the RX ringbuffer, up to its head or its end,
+     * without copying them. Starts reception if needed.
+     *
+     * @param data set to the first byte. It remains valid until consumeRx() is called or a fiber reads.
+     *
+     * @return the number of contiguous bytes, which is less than rxBufferedSize() when the data wraps
+     *         around the end of the ringbuffer, or DEVICE_SERIAL_IN_USE if a fiber is reading.
+     **/
+    int peekRxSpan(const uint8_t **data);
+
+    /**
+     * Removes bytes returned by peekRxSpan() from the RX ringbuffer.
+     **/
+    void consumeRx(int length);
+
+    int rxBufferedSize();
+    int txBufferedSize();
+    int getRxBufferSize();
+    int getTxBufferSize();
+
+    /**
+     * Resizes the RX ringbuffer, dropping the data it holds.
+     *
+     * @param size 2 to 65535 bytes. With an arena, RX and TX together must fit in it.
+     *
+     * @return DEVICE_OK, DEVICE_INVALID_PARAMETER, DEVICE_SERIAL_IN_USE or DEVICE_NO_RESOURCES.
+     **/
+    int setRxBufferSize(uint16_t size);
+
+    /**
+     * Resizes the TX ringbuffer once the data it holds has been sent.
+     *
+     * @param size 2 to 65535 bytes. With an arena, RX and TX together must fit in it.
+     *
+     * @return DEVICE_OK, DEVICE_INVALID_PARAMETER, DEVICE_SERIAL_IN_USE or DEVICE_NO_RESOURCES.
+     **/
+    int setTxBufferSize(uint16_t size);
+
+    /**
+     * Places the RX and TX ringbuffers in the given memory instead of the heap, so that resizing them
+     * never allocates. RX starts at the beginning of the arena and TX ends at its end;
+     * they are given half of it each, which setRxBufferSize() and setTxBufferSize() can then change.
+     *
+     * Must be called before anything is sent or received.
+     *
+     * @param arena memory that remains valid as long as the port exists.
+     *
+     * @param size the size of the arena, at least 4 bytes.
+     *
+     * @return DEVICE_OK, DEVICE_INVALID_PARAMETER, or DEVICE_BUSY if the ringbuffers are in use already.
+     **/
+    int setBufferArena(uint8_t *arena, uint32_t size);
+
+    /**
+     * Reads up to the first of the given delimiters, which is consumed but not returned.
+     *
+     * Unlike codal Serial::readUntil(), the ringbuffer is not scanned again on every call: the positions
+     * of the delimiters are recorded as bytes are received, so the cost only depends on the length of the line.
+     *
+     * @param delimeters the characters ending a line. They become the line delimiters, see setLineDelimiters().
+     *
+     * @param mode ASYNC to return an empty string if there is no complete line,
+     *             SYNC_SLEEP or SYNC_SPINWAIT to wait for one.
+     **/
+    ManagedString readUntil(ManagedString delimeters, SerialMode mode = DEVICE_DEFAULT_SERIAL_MODE);
+
+    /**
+     * Sets the characters ending a line for readUntil(), peekLineLength() and availableLines().
+     * The data already received is indexed again if they change. Starts reception if needed.
+     **/
+    void setLineDelimiters(ManagedString delimeters);
+
+    /**
+     * Returns the length of the next complete line in the RX ringbuffer, without its delimiter,
+     * or DEVICE_NO_DATA if there is none.
+     **/
+    int peekLineLength();
+
+    /**
+     * Returns the number of complete lines in the RX ringbuffer,
+     * counting at most IMQOPEN_NRF52SERIAL2_LINE_INDEX_LENGTH of them.
+     **/
+    int availableLines();
+
+    /**
+     * Adds a token to look for in the received data, such as "OK\r\n" or "+IPD,".
+     * Every time it is received IMQOPEN_NRF52SERIAL2_EVT_TOKEN + index is raised, and tokenOffset() tells where.
+     * Tokens may overlap or contain each other. Starts reception if needed.
+     * The first call allocates the matcher tables, about 800 bytes with the default limits.
+     *
+     * @return the index of the token, the existing one if it has already been added,
+     *         DEVICE_INVALID_PARAMETER if it is empty, or DEVICE_NO_RESOURCES once IMQOPEN_NRF52SERIAL2_TOKEN_COUNT
+     *         tokens or IMQOPEN_NRF52SERIAL2_TOKEN_STATES states are used.
+     **/
+    int addToken(ManagedString token);
+
+    /**
+     * Removes all the tokens and frees the matcher tables. Their indices are given out again by addToken().
+     **/
+    void clearTokens();
+
+    /**
+     * Returns the number of bytes from the tail of the RX ringbuffer up to and including the latest match
+     * of a token, or DEVICE_NO_DATA if it has not been received or has already been read.
+     **/
+    int tokenOffset(int index);
+
+    /**
+     * Sends a buffer without copying it into the TX ringbuffer.
+     *
+     * EasyDMA reads straight from the given memory, which must therefore be in RAM (see nrfx_is_in_ram())
+     * and remain valid until IMQOPEN_NRF52SERIAL2_EVT_TX_COMPLETE is raised. Data in flash has to go through send().
+     * Data previously queued with send() is transmitted first.
+     *
+     * @param buffer the data to send
+     *
+     * @param bufferLen the number of bytes to send
+     *
+     * Up to IMQOPEN_NRF52SERIAL2_TX_QUEUE_LENGTH - 1 buffers can be queued. Consecutive buffers are sent
+     * back to back without idle bits, as the next one is started by PPI rather than by the IRQ handler.
+     *
+     * @param mode ASYNC to return as soon as the transfer is queued,
+     *             SYNC_SLEEP or SYNC_SPINWAIT to wait until it has completed.
+     *
+     * @return the number of bytes queued, DEVICE_BUSY if mode is ASYNC and the queue is full,
+     *         or DEVICE_INVALID_PARAMETER, also if the buffer is not in RAM.
+     **/
+    int sendDirect(const uint8_t *buffer, int bufferLen, SerialMode mode = DEVICE_DEFAULT_SERIAL_MODE);
+
+    /**
+     * Waits until at most maxPending sendDirect() buffers are queued.
+     *
+     * @param mode SYNC_SLEEP to yield to other fibers while waiting, SYNC_SPINWAIT to spin.
+     *
+     * @param maxPending 0 to wait until all of them have been sent.
+     **/
+    void waitForTxDirect(SerialMode mode, int maxPending = 0);
+
+    /**
+     * Returns true while a sendDirect() transfer is pending.
+     **/
+    bool isTxDirectPending();
+
+    /**
+     * Returns the number of queued sendDirect() buffers, including the one being sent.
+     **/
+    int txQueueLength();
+
+    /**
+     * Returns the number of sendDirect() buffers sent so far, wrapping around.
+     * A buffer may be reused once this has passed the count at which it was queued.
+     **/
+    uint32_t getTxDirectCompleted();
+
+    /**
+     * Hands received data to a framer instead of the codal Serial ringbuffer.
+     *
+     * @param framer the framer, or NULL to store received data in the ringbuffer again.
+     *
+     * @return DEVICE_OK, or DEVICE_NOT_SUPPORTED in direct RX mode, where EasyDMA writes into the ringbuffer.
+     **/
+    int setFramer(Serial2Framer *framer);
+
+    /**
+     * Enables or disables direct reception into the codal Serial ringbuffer.
+     *
+     * In direct mode EasyDMA writes straight into free, contiguous regions of the ringbuffer,
+     * and the IRQ handler only advances rxBuffHead, so received bytes are never copied by the driver.
+     * The length of each region is limited to that of an RX DMA transfer.
+     *
+     * @param direct true for direct reception, false to receive through the RX DMA buffers.
+     *
+     * @return DEVICE_OK or DEVICE_NO_RESOURCES.
+     **/
+    int setRxDirect(bool direct);
+
+    /**
+     * Sets the number and size of the RX DMA buffers.
+     *
+     * EasyDMA fills the buffers in turn. The UARTE only holds the buffer being filled and the next one,
+     * which the IRQ handler arms at RXSTARTED, and ENDRX_STARTRX reuses that same pointer if the handler
+     * has not run since. So the IRQ handler may be held off for at most one buffer, size byte times,
+     * whatever the count, e.g. 2.5 ms with 256 byte buffers at 1 Mbaud. Only the size buys latency headroom.
+     *
+     * If the receiver is running it is restarted, and bytes still in the UARTE RX FIFO may be lost.
+     *
+     * @param count the number of buffers, 1 to IMQOPEN_NRF52SERIAL2_RX_DMA_MAX_COUNT
+     *
+     * @param size the size of each buffer in bytes, 1 to IMQOPEN_NRF52SERIAL2_DMA_MAX_LENGTH
+     *
+     * @return DEVICE_OK, DEVICE_INVALID_PARAMETER or DEVICE_NO_RESOURCES.
+     **/
+    int setRxDmaBuffers(int count, int size);
+
+    /**
+     * Enables or disables coalesced reception.
+     *
+     * Instead of raising an interrupt for every byte, RXDRDY events are counted by a TIMER in counter mode
+     * through PPI. Received bytes are moved into the codal Serial ringbuffer in blocks, with a single
+     * DATA_RECEIVED event per block: when threshold bytes have been received (ENDRX), or when the line
+     * has been idle for idleTimeoutUs. Delimiters registered with eventOn() are still matched.
+     *
+     * @param counter the TIMER to count bytes with, which must not be used by anything else,
+     *                or NULL to go back to one interrupt per byte.
+     *
+     * @param threshold the number of bytes per block, at most the RX DMA buffer size, or 0 for the RX DMA buffer size.
+     *
+     * @param idleTimeoutUs the time after which pending bytes are flushed if no more data is received, or 0 to never flush.
+     *
+     * @return DEVICE_OK, DEVICE_INVALID_PARAMETER, or DEVICE_NO_RESOURCES if no PPI channel is available.
+     **/
+    int setRxCoalescing(NRF_TIMER_Type *counter, int threshold = 0, uint32_t idleTimeoutUs = 1000);
+
+    /**
+     * Rate limits the DATA_RECEIVED, ERROR_OVERRUN, ERROR_FRAMING and ERROR_BREAK events.
+     *
+     * The IRQ handler only counts them, and a periodic system timer event raises each of them at most once
+     * per interval, so that a noisy line cannot flood the message bus. Other events are not affected.
+     *
+     * @param intervalUs the dispatch period, or 0 to raise the events from the IRQ handler as they happen.
+     *
+     * @return DEVICE_OK, or DEVICE_NOT_SUPPORTED if there is no event bus.
+     **/
+    int setEventInterval(uint32_t intervalUs);
+
+    /**
+     * Returns the number of bytes received, or errors detected, the latest event of the given value stands for.
+     *
+     * @param value IMQOPEN_NRF52SERIAL2_EVT_DATA_RECEIVED, or one of the IMQOPEN_NRF52SERIAL2_EVT_ERROR_* values.
+     *
+     * @return the count, or 0 if no such event has been raised.
+     **/
+    uint32_t getEventCount(uint16_t value);
+
+    /**
+     * Enables or disables idle line detection.
+     *
+     * A TIMER is restarted through PPI on every received byte. When the line has been silent for
+     * bitTimes bit-times, pending bytes are flushed into the codal Serial ringbuffer and an
+     * IMQOPEN_NRF52SERIAL2_EVT_IDLE event is raised. The timeout follows the baud rate.
+     *
+     * @param timer the TIMER to use, which must not be used by anything else, or NULL to disable.
+     *
+     * @param bitTimes the length of the silence in bit-times, e.g. 35 for the 3.5 characters of Modbus RTU, or 0 to disable.
+     *
+     * @return DEVICE_OK, DEVICE_INVALID_PARAMETER, or DEVICE_NO_RESOURCES if no PPI channel is available.
+     **/
+    int setIdleTimeout(NRFLowLevelTimer *timer, int bitTimes);
+
+    /**
+     * Enables or disables RS-485 half-duplex mode.
+     *
+     * The driver enable pin of the transceiver is set through GPIOTE and PPI when the UARTE starts transmitting,
+     * and cleared when the transmitter stops after the stop bit of the last byte, without CPU involvement.
+     * Consecutive transfers keep it set. The receiver enable pin, if any, follows it, which disables an
+     * active-low /RE during transmission so that the port does not receive its own echo.
+     *
+     * @param de the driver enable pin, active high, or NULL to disable RS-485 mode and release the pins.
+     *
+     * @param re the receiver enable pin (/RE), or NULL if it is tied to DE or always enabled.
+     *
+     * @param guardTimer a TIMER used to keep DE set for guardUs after the transmitter has stopped,
+     *                   which must not be used by anything else. Only needed if guardUs is not 0.
+     *
+     * @param guardUs the time DE stays set after the last stop bit, in microseconds.
+     *
+     * @return DEVICE_OK, DEVICE_INVALID_PARAMETER, DEVICE_BUSY if another instance uses RS-485 mode or the
+     *         GPIOTE channels or the guard timer are already in use, or DEVICE_NO_RESOURCES if no PPI channel is available.
+     **/
+    int setRs485(Pin *de, Pin *re = NULL, NRF_TIMER_Type *guardTimer = NULL, uint32_t guardUs = 0);
+
+    /**
+     * Enables or disables timestamped reception. Requires idle line detection, see setIdleTimeout().
+     *
+     * Received data is split into chunks at idle lines. A free-running TIMER is captured through PPI when
+     * the first byte of each chunk is received and when the line goes idle, so the timestamps do not depend
+     * on interrupt or fiber latency. They are in microseconds, on the same time base as system_timer_current_time_us().
+     * The RX ringbuffer is cleared when enabling.
+     *
+     * @param timer the TIMER to use, which must not be used by anything else, or NULL to disable.
+     *
+     * @return DEVICE_OK, DEVICE_NOT_SUPPORTED without idle line detection, DEVICE_BUSY if the TIMER is in use,
+     *         or DEVICE_NO_RESOURCES if no PPI channel or group is available.
+     **/
+    int setRxTimestamps(NRF_TIMER_Type *timer);
+
+    /**
+     * Returns the number of bytes of the oldest chunk in the RX ringbuffer, or DEVICE_NO_DATA if there is none.
+     *
+     * @param timestamp if not NULL, set to the arrival time of the first byte of the chunk.
+     **/
+    int rxChunkLength(uint32_t *timestamp = NULL);
+
+    /**
+     * Reads the oldest chunk, or the start of it, from the RX ringbuffer without waiting.
+     *
+     * @param timestamp set to the arrival time of the first byte of the chunk.
+     *
+     * @return the number of bytes read, or DEVICE_NO_DATA if there is no chunk.
+     **/
+    int readTimestamped(uint8_t *buffer, int bufferLen, uint32_t *timestamp);
+
+    /**
+     * Returns the arrival time of the first byte of the latest chunk, or 0 if none has been received.
+     **/
+    uint32_t lastRxTimestamp();
+
+    /**
+     * Returns the time at which the line was last detected idle, a few bit-times after the last byte, or 0.
+     **/
+    uint32_t lastRxIdleTimestamp();
+
     virtual int putc(char) override;
     virtual int getc() override;
     virtual int setBaudrate(uint32_t baudrate) override;
@@ -93,9 +1025,31 @@ namespace imqopen
      */
     virtual int setSleep(bool doSleep) override;
 
+    /**
+     * Waits until everything written so far has been sent.
+     *
+     * @param mode ASYNC to return DEVICE_BUSY instead of waiting if data is still being sent,
+     *             SYNC_SLEEP to yield to other fibers while waiting, SYNC_SPINWAIT to spin.
+     *
+     * @return DEVICE_OK once the transmitter is idle, or DEVICE_BUSY.
+     **/
+    int flush(SerialMode mode = DEVICE_DEFAULT_SERIAL_MODE);
+
     bool isEnabled();
     int setEnabled(bool enabled);
 
+    /**
+     * Copies the driver statistics.
+     *
+     * @return DEVICE_OK, or DEVICE_NOT_SUPPORTED if IMQOPEN_NRF52SERIAL2_STATS is 0.
+     **/
+    int getStats(NRF52Serial2Stats &stats);
+
+    /**
+     * Zeroes the driver statistics.
+     **/
+    void resetStats();
+
     ~NRF52Serial2();
   };
 }
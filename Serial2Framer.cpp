@@ -0,0 +1,424 @@
+#include "./Serial2Framer.h"
+
+using namespace codal;
+
+#define SLIP_END 0xC0
+#define SLIP_ESC 0xDB
+#define SLIP_ESC_END 0xDC
+#define SLIP_ESC_ESC 0xDD
+
+// Payload plus CRC, the largest decoded frame
+#define FRAME_SLOT_SIZE (IMQOPEN_SERIAL2FRAMER_MAX_LENGTH + IMQOPEN_SERIAL2FRAMER_CRC_LENGTH)
+
+static const uint16_t crc16Table[256] = {
+    0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+    0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF,
+    0x1231, 0x0210, 0x3273, 0x2252, 0x52B5, 0x4294, 0x72F7, 0x62D6,
+    0x9339, 0x8318, 0xB37B, 0xA35A, 0xD3BD, 0xC39C, 0xF3FF, 0xE3DE,
+    0x2462, 0x3443, 0x0420, 0x1401, 0x64E6, 0x74C7, 0x44A4, 0x5485,
+    0xA56A, 0xB54B, 0x8528, 0x9509, 0xE5EE, 0xF5CF, 0xC5AC, 0xD58D,
+    0x3653, 0x2672, 0x1611, 0x0630, 0x76D7, 0x66F6, 0x5695, 0x46B4,
+    0xB75B, 0xA77A, 0x9719, 0x8738, 0xF7DF, 0xE7FE, 0xD79D, 0xC7BC,
+    0x48C4, 0x58E5, 0x6886, 0x78A7, 0x0840, 0x1861, 0x2802, 0x3823,
+    0xC9CC, 0xD9ED, 0xE98E, 0xF9AF, 0x8948, 0x9969, 0xA90A, 0xB92B,
+    0x5AF5, 0x4AD4, 0x7AB7, 0x6A96, 0x1A71, 0x0A50, 0x3A33, 0x2A12,
+    0xDBFD, 0xCBDC, 0xFBBF, 0xEB9E, 0x9B79, 0x8B58, 0xBB3B, 0xAB1A,
+    0x6CA6, 0x7C87, 0x4CE4, 0x5CC5, 0x2C22, 0x3C03, 0x0C60, 0x1C41,
+    0xEDAE, 0xFD8F, 0xCDEC, 0xDDCD, 0xAD2A, 0xBD0B, 0x8D68, 0x9D49,
+    0x7E97, 0x6EB6, 0x5ED5, 0x4EF4, 0x3E13, 0x2E32, 0x1E51, 0x0E70,
+    0xFF9F, 0xEFBE, 0xDFDD, 0xCFFC, 0xBF1B, 0xAF3A, 0x9F59, 0x8F78,
+    0x9188, 0x81A9, 0xB1CA, 0xA1EB, 0xD10C, 0xC12D, 0xF14E, 0xE16F,
+    0x1080, 0x00A1, 0x30C2, 0x20E3, 0x5004, 0x4025, 0x7046, 0x6067,
+    0x83B9, 0x9398, 0xA3FB, 0xB3DA, 0xC33D, 0xD31C, 0xE37F, 0xF35E,
+    0x02B1, 0x1290, 0x22F3, 0x32D2, 0x4235, 0x5214, 0x6277, 0x7256,
+    0xB5EA, 0xA5CB, 0x95A8, 0x8589, 0xF56E, 0xE54F, 0xD52C, 0xC50D,
+    0x34E2, 0x24C3, 0x14A0, 0x0481, 0x7466, 0x6447, 0x5424, 0x4405,
+    0xA7DB, 0xB7FA, 0x8799, 0x97B8, 0xE75F, 0xF77E, 0xC71D, 0xD73C,
+    0x26D3, 0x36F2, 0x0691, 0x16B0, 0x6657, 0x7676, 0x4615, 0x5634,
+    0xD94C, 0xC96D, 0xF90E, 0xE92F, 0x99C8, 0x89E9, 0xB98A, 0xA9AB,
+    0x5844, 0x4865, 0x7806, 0x6827, 0x18C0, 0x08E1, 0x3882, 0x28A3,
+    0xCB7D, 0xDB5C, 0xEB3F, 0xFB1E, 0x8BF9, 0x9BD8, 0xABBB, 0xBB9A,
+    0x4A75, 0x5A54, 0x6A37, 0x7A16, 0x0AF1, 0x1AD0, 0x2AB3, 0x3A92,
+    0xFD2E, 0xED0F, 0xDD6C, 0xCD4D, 0xBDAA, 0xAD8B, 0x9DE8, 0x8DC9,
+    0x7C26, 0x6C07, 0x5C64, 0x4C45, 0x3CA2, 0x2C83, 0x1CE0, 0x0CC1,
+    0xEF1F, 0xFF3E, 0xCF5D, 0xDF7C, 0xAF9B, 0xBFBA, 0x8FD9, 0x9FF8,
+    0x6E17, 0x7E36, 0x4E55, 0x5E74, 0x2E93, 0x3EB2, 0x0ED1, 0x1EF0,
+};
+
+namespace imqopen
+{
+
+    Serial2Framer::Serial2Framer(NRF52Serial2 &serial, Serial2FramingMode mode, bool crc, const Serial2PacketFormat *format)
+        : serial_(serial), mode_(mode), crc_(crc), rxFrames_(NULL), rxHead_(0), rxTail_(0),
+          rxLength_(0), rxCode_(0), rxBlock_(0), rxEscape_(false), rxDiscard_(false), rxExpected_(0), txFrame_(NULL)
+    {
+        format_ = Serial2PacketFormat();
+        if (format != NULL)
+            format_ = *format;
+        resetPacket();
+
+        // COBS adds a code byte per 254 bytes, SLIP may escape every byte. Both add a delimiter. Packets are sent as is.
+        if (mode == SERIAL2_FRAMING_COBS)
+            txFrameSize_ = FRAME_SLOT_SIZE + FRAME_SLOT_SIZE / 254 + 2;
+        else if (mode == SERIAL2_FRAMING_SLIP)
+            txFrameSize_ = 2 * FRAME_SLOT_SIZE + 2;
+        else
+            txFrameSize_ = FRAME_SLOT_SIZE;
+
+        rxFrames_ = (uint8_t *)malloc(IMQOPEN_SERIAL2FRAMER_RX_SLOTS * FRAME_SLOT_SIZE);
+        txFrame_ = (uint8_t *)malloc(txFrameSize_);
+    }
+
+    Serial2Framer::~Serial2Framer()
+    {
+        free(rxFrames_);
+        free(txFrame_);
+    }
+
+    bool Serial2Framer::isValid()
+    {
+        if (rxFrames_ == NULL || txFrame_ == NULL || format_.syncLength > IMQOPEN_SERIAL2FRAMER_SYNC_MAX_LENGTH)
+            return false;
+
+        if (mode_ == SERIAL2_FRAMING_FIXED)
+            return format_.size > 0 && format_.size <= IMQOPEN_SERIAL2FRAMER_MAX_LENGTH && format_.syncLength < format_.size;
+
+        if (mode_ == SERIAL2_FRAMING_LENGTH)
+            return (format_.lengthWidth == 1 || format_.lengthWidth == 2) && format_.lengthOffset >= format_.syncLength &&
+                   format_.lengthOffset + format_.lengthWidth <= IMQOPEN_SERIAL2FRAMER_MAX_LENGTH;
+
+        return true;
+    }
+
+    uint16_t Serial2Framer::crc16(const uint8_t *data, int len, uint16_t crc)
+    {
+        for (int i = 0; i < len; i++)
+            crc = (crc << 8) ^ crc16Table[(crc >> 8) ^ data[i]];
+
+        return crc;
+    }
+
+    void Serial2Framer::append(uint8_t c)
+    {
+        if (rxDiscard_)
+            return;
+
+        if (rxLength_ == FRAME_SLOT_SIZE)
+        {
+            // Too long, drop the rest of the frame.
+            rxDiscard_ = true;
+            return;
+        }
+
+        rxFrames_[rxHead_ * FRAME_SLOT_SIZE + rxLength_++] = c;
+    }
+
+    void Serial2Framer::endFrame(bool valid)
+    {
+        int len = rxLength_;
+        bool discard = rxDiscard_;
+
+        rxLength_ = 0;
+        rxCode_ = 0;
+        rxBlock_ = 0;
+        rxEscape_ = false;
+        rxDiscard_ = false;
+
+        // Back-to-back delimiters, e.g. the leading SLIP END.
+        if (len == 0 && !discard)
+            return;
+
+        uint8_t *frame = rxFrames_ + rxHead_ * FRAME_SLOT_SIZE;
+
+        if (crc_)
+        {
+            // The CRC over payload and big-endian CRC is zero for a frame without errors.
+            valid = valid && len >= IMQOPEN_SERIAL2FRAMER_CRC_LENGTH && crc16(frame, len) == 0;
+            len -= IMQOPEN_SERIAL2FRAMER_CRC_LENGTH;
+        }
+
+        uint8_t next = (rxHead_ + 1) % IMQOPEN_SERIAL2FRAMER_RX_SLOTS;
+
+        if (!valid || discard || next == rxTail_)
+        {
+            Event(serial_.id, IMQOPEN_NRF52SERIAL2_EVT_FRAME_ERROR);
+            return;
+        }
+
+        rxFrameLength_[rxHead_] = len;
+        rxHead_ = next;
+
+        Event(serial_.id, IMQOPEN_NRF52SERIAL2_EVT_FRAME);
+    }
+
+    void Serial2Framer::resetPacket()
+    {
+        rxLength_ = 0;
+        rxDiscard_ = false;
+        rxExpected_ = mode_ == SERIAL2_FRAMING_FIXED ? format_.size : 0;
+    }
+
+    int Serial2Framer::matchSync(int matchedLength, uint8_t c)
+    {
+        // The matched bytes are the start of the header, so try its shorter prefixes as the new start.
+        for (int start = 0; start <= matchedLength; start++)
+        {
+            int length = matchedLength - start;
+            if (format_.sync[length] == c && memcmp(format_.sync + start, format_.sync, length) == 0)
+                return length + 1;
+        }
+
+        return 0;
+    }
+
+    void Serial2Framer::receivePacket(uint8_t c)
+    {
+        // Look for the sync header, which is part of the packet.
+        if (rxLength_ < format_.syncLength)
+        {
+            rxLength_ = matchSync(rxLength_, c);
+            if (rxLength_ > 0)
+                rxFrames_[rxHead_ * FRAME_SLOT_SIZE + rxLength_ - 1] = c;
+            return;
+        }
+
+        uint8_t *packet = rxFrames_ + rxHead_ * FRAME_SLOT_SIZE;
+        packet[rxLength_++] = c;
+
+        if (rxExpected_ == 0 && rxLength_ == format_.lengthOffset + format_.lengthWidth)
+        {
+            const uint8_t *field = packet + format_.lengthOffset;
+            int value = field[0];
+            if (format_.lengthWidth == 2)
+                value = format_.bigEndian ? (field[0] << 8) | field[1] : (field[1] << 8) | field[0];
+
+            if (rxLength_ + value > IMQOPEN_SERIAL2FRAMER_MAX_LENGTH)
+            {
+                // The next packet may start among the bytes after the sync header that matched.
+                // They are fewer than the length field needs, so only the header can be found again.
+                int received = rxLength_;
+                resetPacket();
+                for (int i = 1; i < received; i++)
+                {
+                    uint8_t b = packet[i];
+                    if (rxLength_ < format_.syncLength)
+                    {
+                        rxLength_ = matchSync(rxLength_, b);
+                        if (rxLength_ > 0)
+                            packet[rxLength_ - 1] = b;
+                    }
+                    else
+                    {
+                        packet[rxLength_++] = b;
+                    }
+                }
+
+                Event(serial_.id, IMQOPEN_NRF52SERIAL2_EVT_FRAME_ERROR);
+                return;
+            }
+
+            rxExpected_ = rxLength_ + value;
+        }
+
+        if (rxExpected_ > 0 && rxLength_ == rxExpected_ + (crc_ ? IMQOPEN_SERIAL2FRAMER_CRC_LENGTH : 0))
+        {
+            endFrame(true);
+            resetPacket();
+        }
+    }
+
+    void Serial2Framer::idle()
+    {
+        if ((mode_ == SERIAL2_FRAMING_FIXED || mode_ == SERIAL2_FRAMING_LENGTH) && rxLength_ > 0)
+        {
+            resetPacket();
+            Event(serial_.id, IMQOPEN_NRF52SERIAL2_EVT_FRAME_ERROR);
+        }
+    }
+
+    void Serial2Framer::receive(const uint8_t *data, int len)
+    {
+        for (int i = 0; i < len; i++)
+        {
+            uint8_t c = data[i];
+
+            if (mode_ == SERIAL2_FRAMING_FIXED || mode_ == SERIAL2_FRAMING_LENGTH)
+            {
+                receivePacket(c);
+            }
+            else if (mode_ == SERIAL2_FRAMING_COBS)
+            {
+                if (c == 0)
+                {
+                    // Complete if the last block has been received in full.
+                    endFrame(rxCode_ != 0 && rxBlock_ == 0);
+                }
+                else if (rxBlock_ > 0)
+                {
+                    append(c);
+                    rxBlock_--;
+                }
+                else
+                {
+                    // Code byte: every block but the last and those of 254 bytes ends with an implicit zero.
+                    if (rxCode_ != 0 && rxCode_ != 0xFF)
+                        append(0);
+
+                    rxCode_ = c;
+                    rxBlock_ = c - 1;
+                }
+            }
+            else
+            {
+                if (c == SLIP_END)
+                {
+                    endFrame(!rxEscape_);
+                }
+                else if (rxEscape_)
+                {
+                    rxEscape_ = false;
+                    if (c == SLIP_ESC_END)
+                        append(SLIP_END);
+                    else if (c == SLIP_ESC_ESC)
+                        append(SLIP_ESC);
+                    else
+                        rxDiscard_ = true;
+                }
+                else if (c == SLIP_ESC)
+                {
+                    rxEscape_ = true;
+                }
+                else
+                {
+                    append(c);
+                }
+            }
+        }
+    }
+
+    int Serial2Framer::frameLength()
+    {
+        if (rxTail_ == rxHead_)
+            return DEVICE_NO_DATA;
+
+        return rxFrameLength_[rxTail_];
+    }
+
+    int Serial2Framer::readFrame(uint8_t *buffer, int bufferLen)
+    {
+        int len = frameLength();
+        if (len < 0)
+            return len;
+
+        // The IRQ handler does not touch queued slots, so no need to mask it while copying.
+        memcpy(buffer, rxFrames_ + rxTail_ * FRAME_SLOT_SIZE, len < bufferLen ? len : bufferLen);
+        rxTail_ = (rxTail_ + 1) % IMQOPEN_SERIAL2FRAMER_RX_SLOTS;
+
+        return len;
+    }
+
+    int Serial2Framer::encodeCobs(const uint8_t *data, int len, uint8_t *out, int n, int &code)
+    {
+        for (int i = 0; i < len; i++)
+        {
+            if (data[i] == 0)
+            {
+                out[code] = n - code;
+                code = n++;
+                continue;
+            }
+
+            out[n++] = data[i];
+
+            if (n - code == 0xFF)
+            {
+                out[code] = 0xFF;
+                code = n++;
+            }
+        }
+
+        return n;
+    }
+
+    int Serial2Framer::endCobs(uint8_t *out, int n, int code)
+    {
+        out[code] = n - code;
+        out[n++] = 0;
+
+        return n;
+    }
+
+    int Serial2Framer::encodeSlip(const uint8_t *data, int len, uint8_t *out)
+    {
+        int n = 0;
+
+        for (int i = 0; i < len; i++)
+        {
+            if (data[i] == SLIP_END)
+            {
+                out[n++] = SLIP_ESC;
+                out[n++] = SLIP_ESC_END;
+            }
+            else if (data[i] == SLIP_ESC)
+            {
+                out[n++] = SLIP_ESC;
+                out[n++] = SLIP_ESC_ESC;
+            }
+            else
+            {
+                out[n++] = data[i];
+            }
+        }
+
+        return n;
+    }
+
+    int Serial2Framer::writeFrame(const uint8_t *data, int len, SerialMode mode)
+    {
+        if ((data == NULL && len > 0) || len < 0 || len > IMQOPEN_SERIAL2FRAMER_MAX_LENGTH || !isValid())
+            return DEVICE_INVALID_PARAMETER;
+
+        // txFrame_ is free once the previous frame has been sent.
+        // There is no yield between here and sendDirect(), so no other fiber can take it.
+        if (mode == ASYNC && serial_.isTxDirectPending())
+            return DEVICE_BUSY;
+
+        serial_.waitForTxDirect(mode);
+
+        uint8_t crc[IMQOPEN_SERIAL2FRAMER_CRC_LENGTH];
+        int crcLen = 0;
+        if (crc_)
+        {
+            uint16_t value = crc16(data, len);
+            crc[0] = value >> 8;
+            crc[1] = value & 0xFF;
+            crcLen = IMQOPEN_SERIAL2FRAMER_CRC_LENGTH;
+        }
+
+        int n;
+        if (mode_ == SERIAL2_FRAMING_FIXED || mode_ == SERIAL2_FRAMING_LENGTH)
+        {
+            memcpy(txFrame_, data, len);
+            memcpy(txFrame_ + len, crc, crcLen);
+            n = len + crcLen;
+        }
+        else if (mode_ == SERIAL2_FRAMING_COBS)
+        {
+            // The CRC bytes join the last block of the payload.
+            int code = 0;
+            n = encodeCobs(data, len, txFrame_, 1, code);
+            n = encodeCobs(crc, crcLen, txFrame_, n, code);
+            n = endCobs(txFrame_, n, code);
+        }
+        else
+        {
+            n = 0;
+            txFrame_[n++] = SLIP_END;
+            n += encodeSlip(data, len, txFrame_ + n);
+            n += encodeSlip(crc, crcLen, txFrame_ + n);
+            txFrame_[n++] = SLIP_END;
+        }
+
+        return serial_.sendDirect(txFrame_, n, ASYNC);
+    }
+}
@@ -0,0 +1,187 @@
+#ifndef IMQOPEN_SERIAL2FRAMER_H
+#define IMQOPEN_SERIAL2FRAMER_H
+
+#include "NRF52Serial2.h"
+
+// Largest frame payload, excluding the CRC
+#ifndef IMQOPEN_SERIAL2FRAMER_MAX_LENGTH
+#define IMQOPEN_SERIAL2FRAMER_MAX_LENGTH 256
+#endif
+
+// Number of received frames that can be queued, plus the one being received
+#ifndef IMQOPEN_SERIAL2FRAMER_RX_SLOTS
+#define IMQOPEN_SERIAL2FRAMER_RX_SLOTS 4
+#endif
+
+#define IMQOPEN_SERIAL2FRAMER_CRC_LENGTH 2
+
+// Largest sync header of packets
+#define IMQOPEN_SERIAL2FRAMER_SYNC_MAX_LENGTH 4
+
+namespace imqopen
+{
+
+  using namespace codal;
+
+  enum Serial2FramingMode
+  {
+    SERIAL2_FRAMING_COBS = 1,
+    SERIAL2_FRAMING_SLIP = 2,
+    SERIAL2_FRAMING_FIXED = 3,
+    SERIAL2_FRAMING_LENGTH = 4,
+  };
+
+  /**
+   * Layout of the packets received in SERIAL2_FRAMING_FIXED and SERIAL2_FRAMING_LENGTH modes.
+   * Packets are queued whole, sync header and length field included, without their CRC.
+   **/
+  struct Serial2PacketFormat
+  {
+    // SERIAL2_FRAMING_FIXED: length of every packet, excluding the CRC.
+    uint16_t size;
+    // SERIAL2_FRAMING_LENGTH: position of the length field in the packet, and its width of 1 or 2 bytes.
+    // The field holds the number of bytes following it, excluding the CRC.
+    uint16_t lengthOffset;
+    uint8_t lengthWidth;
+    bool bigEndian;
+    // Bytes every packet starts with, to find the start of the next packet after an error.
+    uint8_t sync[IMQOPEN_SERIAL2FRAMER_SYNC_MAX_LENGTH];
+    uint8_t syncLength;
+  };
+
+  /**
+   * COBS or SLIP framing, or fixed-length or length-prefixed packets, on top of NRF52Serial2.
+   *
+   * Received bytes are decoded in the UARTE IRQ handler, without going through the codal Serial ringbuffer.
+   * Each complete frame with a valid CRC-16/CCITT-FALSE (sent big-endian after the payload) is queued,
+   * and an IMQOPEN_NRF52SERIAL2_EVT_FRAME event is raised. Frames with a wrong CRC, frames that are too long
+   * and frames that do not fit in the queue are dropped with an IMQOPEN_NRF52SERIAL2_EVT_FRAME_ERROR event.
+   *
+   * Packets have no delimiter. After an error the framer looks for the next sync header, if any,
+   * and drops a partial packet when the line goes idle (see NRF52Serial2::setIdleTimeout()).
+   **/
+  class Serial2Framer
+  {
+    NRF52Serial2 &serial_;
+    Serial2FramingMode mode_;
+    bool crc_;
+    Serial2PacketFormat format_;
+
+    // Frame slots of IMQOPEN_SERIAL2FRAMER_MAX_LENGTH + CRC bytes. Queued frames are tail to head - 1,
+    // the frame being decoded is written to slot head.
+    uint8_t *rxFrames_;
+    uint16_t rxFrameLength_[IMQOPEN_SERIAL2FRAMER_RX_SLOTS];
+    volatile uint8_t rxHead_;
+    volatile uint8_t rxTail_;
+
+    // Decoder state
+    uint16_t rxLength_;
+    uint8_t rxCode_;
+    uint8_t rxBlock_;
+    bool rxEscape_;
+    bool rxDiscard_;
+    // Length of the packet being received excluding the CRC, 0 until its length field has been received
+    uint16_t rxExpected_;
+
+    uint8_t *txFrame_;
+    uint16_t txFrameSize_;
+
+    /**
+     * Appends a decoded byte to the frame being received.
+     **/
+    void append(uint8_t c);
+
+    /**
+     * Completes the frame being received, queueing it if valid.
+     **/
+    void endFrame(bool valid);
+
+    /**
+     * Adds a received byte to the packet being received.
+     **/
+    void receivePacket(uint8_t c);
+
+    /**
+     * Returns the number of sync header bytes matched once c follows the matchedLength ones already matched.
+     **/
+    int matchSync(int matchedLength, uint8_t c);
+
+    /**
+     * Starts looking for the next packet.
+     **/
+    void resetPacket();
+
+    /**
+     * COBS-encodes data into out from position n on. out[code] is the code byte of the open block,
+     * so that data encoded in several calls joins up. Returns the new position; endCobs() closes the frame.
+     **/
+    int encodeCobs(const uint8_t *data, int len, uint8_t *out, int n, int &code);
+    int endCobs(uint8_t *out, int n, int code);
+    int encodeSlip(const uint8_t *data, int len, uint8_t *out);
+
+  public:
+    /**
+     * Constructor
+     *
+     * @param serial the port to frame. Received data no longer goes to its codal Serial ringbuffer.
+     *
+     * @param mode SERIAL2_FRAMING_COBS, SERIAL2_FRAMING_SLIP, SERIAL2_FRAMING_FIXED or SERIAL2_FRAMING_LENGTH.
+     *
+     * @param crc true to append and check a CRC-16 on every frame.
+     *
+     * @param format the layout of packets, required in SERIAL2_FRAMING_FIXED and SERIAL2_FRAMING_LENGTH modes.
+     **/
+    Serial2Framer(NRF52Serial2 &serial, Serial2FramingMode mode, bool crc = true, const Serial2PacketFormat *format = NULL);
+
+    /**
+     * Returns true if the frame buffers could be allocated and the packet format, if any, is usable.
+     **/
+    bool isValid();
+
+    /**
+     * Decodes received bytes. Called by the UARTE IRQ handler.
+     **/
+    void receive(const uint8_t *data, int len);
+
+    /**
+     * Drops a partially received packet. Called by the UARTE IRQ handler when the line goes idle.
+     **/
+    void idle();
+
+    /**
+     * Returns the payload length of the oldest queued frame, or DEVICE_NO_DATA if there is none.
+     **/
+    int frameLength();
+
+    /**
+     * Removes the oldest queued frame from the queue.
+     *
+     * @param buffer where to copy the payload. It is truncated to bufferLen bytes.
+     *
+     * @return the payload length, or DEVICE_NO_DATA if no frame is queued.
+     **/
+    int readFrame(uint8_t *buffer, int bufferLen);
+
+    /**
+     * Encodes a frame and hands it to the UARTE without going through the codal Serial TX ringbuffer.
+     * Packets are sent as they are, followed by their CRC.
+     *
+     * @param data the payload, up to IMQOPEN_SERIAL2FRAMER_MAX_LENGTH bytes.
+     *
+     * @param mode ASYNC to return DEVICE_BUSY if the previous frame is still being sent,
+     *             SYNC_SLEEP or SYNC_SPINWAIT to wait for it. The call returns once the frame is queued.
+     *
+     * @return the encoded length, DEVICE_BUSY or DEVICE_INVALID_PARAMETER.
+     **/
+    int writeFrame(const uint8_t *data, int len, SerialMode mode = DEVICE_DEFAULT_SERIAL_MODE);
+
+    /**
+     * Table-driven CRC-16/CCITT-FALSE (polynomial 0x1021, initial value 0xFFFF).
+     **/
+    static uint16_t crc16(const uint8_t *data, int len, uint16_t crc = 0xFFFF);
+
+    ~Serial2Framer();
+  };
+}
+
+#endif // IMQOPEN_SERIAL2FRAMER_H
@@ -34,6 +34,49 @@
     SERIAL2_EVT_ERROR_FRAMING = 12,
     //% blockIdentity="control.eventValueId"
     SERIAL2_EVT_ERROR_BREAK = 13,
+    //% blockIdentity="control.eventValueId"
+    SERIAL2_EVT_TX_COMPLETE = 20,
+    //% blockIdentity="control.eventValueId"
+    SERIAL2_EVT_IDLE = 21,
+    //% blockIdentity="control.eventValueId"
+    SERIAL2_EVT_FRAME = 22,
+    //% blockIdentity="control.eventValueId"
+    SERIAL2_EVT_FRAME_ERROR = 23,
+    //% blockIdentity="control.eventValueId"
+    SERIAL2_EVT_TX_IDLE = 24,
+    //% blockIdentity="control.eventValueId"
+    SERIAL2_EVT_TOKEN = 32,
+    }
+
+
+    declare const enum Serial2Stat
+    {
+    RxBytes = 0,
+    TxBytes = 1,
+    RxDmaTransfers = 2,
+    TxDmaTransfers = 3,
+    RxLateFlushes = 4,
+    OverrunErrors = 5,
+    FramingErrors = 6,
+    BreakErrors = 7,
+    RxHighWater = 8,
+    TxHighWater = 9,
+    IrqCount = 10,
+    IrqCyclesMin = 11,
+    IrqCyclesAvg = 12,
+    IrqCyclesMax = 13,
+    RxDropped = 14,
+    }
+
+
+    declare const enum Serial2Framing
+    {
+    //% block="none"
+    None = 0,
+    //% block="COBS"
+    COBS = 1,
+    //% block="SLIP"
+    SLIP = 2,
     }
 declare namespace serial2 {
 }
@@ -0,0 +1,327 @@
+// Benchmarks of NRF52Serial2 on the simulated nRF52833, the host counterpart of test.ts.
+//
+// UARTE1 is looped back to itself like P13 wired to P14. For each baud rate, RX DMA buffer
+// configuration, RX mode and disturbance profile, 4096 bytes are sent with sendDirect() while
+// the RX ringbuffer is read every millisecond. Then COBS frames with a CRC go through Serial2Framer.
+// The exit status is 1 when data is lost or corrupted without disturbances, or when the UARTE model
+// saw the driver misuse it.
+
+#include <stdio.h>
+#include "NRF52Serial2.h"
+#include "Serial2Framer.h"
+#include "CodalFiber.h"
+#include "EventModel.h"
+#include "peripherals.h"
+#include "target.h"
+
+using namespace codal;
+using namespace imqopen;
+
+#define BENCH_LENGTH 4096
+#define BENCH_CHUNK 64
+#define BENCH_RX_BUFFER 128
+#define BENCH_TIMEOUT_US 5000000
+
+#define BENCH_FRAMES 64
+#define BENCH_FRAME_MAX 200
+#define BENCH_FRAME_TIMEOUT_US 2000000
+
+// micro:bit P13 and P14
+#define BENCH_TX_PIN 17
+#define BENCH_RX_PIN 1
+
+namespace
+{
+    struct Profile
+    {
+        const char *name;
+        sim::Faults faults;
+        bool strict; // nothing may be lost
+    };
+
+    // busy: other interrupts delay the UARTE one by up to 20 us, one in fifty by up to 300 us like a
+    // BLE connection event. noisy: one byte in a thousand is hit by noise on the line.
+    const Profile profiles[] = {
+        {"nominal", {0, 0, 0, 0}, true},
+        {"busy", {(uint32_t)sim::us(20), 20, (uint32_t)sim::us(300), 0}, false},
+        {"noisy", {(uint32_t)sim::us(2), 0, 0, 1000}, false},
+    };
+
+    const sim::Faults noFaults = {0, 0, 0, 0};
+
+    struct DmaConfig
+    {
+        int count;
+        int size;
+    };
+
+    const uint32_t bauds[] = {115200, 460800, 1000000};
+    const DmaConfig dmaConfigs[] = {{2, 32}, {4, 128}};
+
+    int failures;
+    uint32_t frameErrors;
+
+    void fail(const char *what)
+    {
+        printf("  FAIL: %s\n", what);
+        failures++;
+    }
+
+    void drain(NRF52Serial2 &serial)
+    {
+        uint8_t buffer[BENCH_RX_BUFFER];
+
+        while (serial.read(buffer, sizeof(buffer), ASYNC) > 0)
+        {
+        }
+    }
+
+    // Bytes still on their way must not count for the next configuration.
+    void settle(NRF52Serial2 &serial)
+    {
+        sim::setFaults(noFaults, 1);
+        serial.flush(SYNC_SLEEP);
+        fiber_sleep(10);
+        drain(serial);
+    }
+
+    uint32_t seed(uint32_t baud, int a, int b, int c)
+    {
+        return baud * 2654435761u + a * 40503 + b * 977 + c * 31 + 1;
+    }
+
+    void stream(NRF52Serial2 &serial, uint8_t *chunk, uint32_t baud, const DmaConfig &dma, bool coalesced, int profile)
+    {
+        sim::Uarte *uarte = sim::uarte(1);
+        const Profile &p = profiles[profile];
+
+        serial.setBaud(baud);
+        serial.setRxBufferSize(BENCH_RX_BUFFER);
+        serial.setRxDmaBuffers(dma.count, dma.size);
+        serial.setRxCoalescing(coalesced ? NRF_TIMER4 : NULL, 0, 1000);
+        drain(serial);
+
+        sim::setFaults(p.faults, seed(baud, dma.size, coalesced, profile));
+        serial.resetStats();
+        uarte->resetCounters();
+        sim::wireCounters() = sim::WireCounters();
+        sim::resetIrqCounts();
+
+        uint8_t rx[BENCH_RX_BUFFER];
+        int sent = 0;
+        int received = 0;
+        int sequenceErrors = 0;
+        int expected = 0;
+        NRF52Serial2Stats stats = NRF52Serial2Stats();
+        sim::cycles_t start = sim::now();
+        sim::cycles_t deadline = start + sim::us(BENCH_TIMEOUT_US);
+
+        // Bytes dropped with a full RX ringbuffer are not waited for.
+        while (received + (int)stats.rxDropped < BENCH_LENGTH && sim::now() < deadline)
+        {
+            // The writer of test.ts, which keeps the sendDirect() queue full
+            while (sent < BENCH_LENGTH && serial.sendDirect(chunk, BENCH_CHUNK, ASYNC) > 0)
+                sent += BENCH_CHUNK;
+
+            int n = serial.read(rx, sizeof(rx), ASYNC);
+            for (int i = 0; i < n; i++)
+            {
+                if (rx[i] != expected)
+                    sequenceErrors++;
+                expected = (rx[i] + 1) % BENCH_CHUNK;
+            }
+            if (n > 0)
+                received += n;
+
+            fiber_sleep(1);
+            serial.getStats(stats);
+        }
+
+        sim::cycles_t elapsed = sim::now() - start;
+        serial.getStats(stats);
+        uint32_t polls = sim::irqCount(TIMER1_IRQn);
+        sim::UarteCounters model = uarte->counters;
+        sim::WireCounters wire = sim::wireCounters();
+
+        settle(serial);
+
+        char dmaHeadroom[24];
+        if (model.rxDmaHeadroom == ~(sim::cycles_t)0)
+            snprintf(dmaHeadroom, sizeof(dmaHeadroom), "-");
+        else
+            snprintf(dmaHeadroom, sizeof(dmaHeadroom), "%llu", (unsigned long long)(model.rxDmaHeadroom / sim::us(1)));
+
+        printf("%7lu %dx%-3d %-9s %-7s %7llu %6lu %5lu %4ld %6s %5lu %4lu %5d %4lu %4d %5lu/%-3lu %4lu\n",
+               (unsigned long)baud, dma.count, dma.size, coalesced ? "coalesced" : "irq", p.name,
+               (unsigned long long)((uint64_t)received * sim::CPU_HZ / (elapsed > 0 ? elapsed : 1)),
+               (unsigned long)((uint64_t)stats.irqCount * 1024 / (received + stats.txBytes > 0 ? received + stats.txBytes : 1)),
+               (unsigned long)polls, (long)BENCH_RX_BUFFER - (long)stats.rxHighWater, dmaHeadroom,
+               (unsigned long)model.rearmMisses, (unsigned long)model.rxOverruns, BENCH_LENGTH - received, (unsigned long)stats.rxDropped, sequenceErrors,
+               (unsigned long)stats.framingErrors, (unsigned long)wire.framing, (unsigned long)wire.corrupted);
+
+        if (model.dmaFaults > 0)
+            fail("EasyDMA pointed outside RAM");
+        if (model.txBusyStarts > 0)
+            fail("STARTTX triggered during a transfer");
+        if (received + (int)stats.rxDropped != BENCH_LENGTH && p.faults.lineErrorPpm == 0)
+            fail("bytes lost without the driver noticing");
+        if (p.strict && (model.rearmMisses > 0 || model.rxOverruns > 0 || (stats.rxDropped == 0 && sequenceErrors > 0)))
+            fail("data lost or corrupted without disturbances");
+    }
+
+    int frameLength(int k)
+    {
+        return 2 + (k * 37) % (BENCH_FRAME_MAX - 1);
+    }
+
+    uint8_t frameByte(int k, int i)
+    {
+        if (i < 2)
+            return i == 0 ? k >> 8 : k & 0xFF;
+        return (k * 7 + i * 13) & 0xFF;
+    }
+
+    void onFrameError(Event)
+    {
+        frameErrors++;
+    }
+
+    void frames(NRF52Serial2 &serial, uint32_t baud, int profile)
+    {
+        const Profile &p = profiles[profile];
+
+        serial.setBaud(baud);
+        serial.setRxCoalescing(NULL);
+        drain(serial);
+
+        Serial2Framer framer(serial, SERIAL2_FRAMING_COBS, true);
+        serial.setFramer(&framer);
+
+        sim::setFaults(p.faults, seed(baud, 0, 0, profile) + 7);
+        sim::wireCounters() = sim::WireCounters();
+        frameErrors = 0;
+
+        uint8_t tx[BENCH_FRAME_MAX];
+        uint8_t rx[IMQOPEN_SERIAL2FRAMER_MAX_LENGTH];
+        int sent = 0;
+        int good = 0;
+        int bad = 0;
+        int payload = 0;
+        sim::cycles_t start = sim::now();
+        sim::cycles_t deadline = start + sim::us(BENCH_FRAME_TIMEOUT_US);
+
+        while (good + bad < BENCH_FRAMES && sim::now() < deadline)
+        {
+            if (sent < BENCH_FRAMES)
+            {
+                int len = frameLength(sent);
+                for (int i = 0; i < len; i++)
+                    tx[i] = frameByte(sent, i);
+                if (framer.writeFrame(tx, len, ASYNC) > 0)
+                    sent++;
+            }
+            else if (!serial.isTxDirectPending())
+            {
+                // The last frame is out; give it the time to arrive.
+                if (deadline > sim::now() + sim::us(20000))
+                    deadline = sim::now() + sim::us(20000);
+            }
+
+            int len;
+            while ((len = framer.readFrame(rx, sizeof(rx))) >= 0)
+            {
+                int k = len >= 2 ? (rx[0] << 8) | rx[1] : -1;
+                bool valid = k >= 0 && k < BENCH_FRAMES && len == frameLength(k);
+                for (int i = 0; valid && i < len; i++)
+                    valid = rx[i] == frameByte(k, i);
+
+                if (valid)
+                {
+                    good++;
+                    payload += len;
+                }
+                else
+                {
+                    bad++;
+                }
+            }
+
+            fiber_sleep(1);
+        }
+
+        sim::cycles_t elapsed = sim::now() - start;
+        sim::WireCounters wire = sim::wireCounters();
+
+        serial.setFramer(NULL);
+        settle(serial);
+
+        printf("%7lu %-7s %6d %5d %5d %7d %7lu %6llu %5lu/%-3lu\n", (unsigned long)baud, p.name, sent, good, bad,
+               sent - good - bad, (unsigned long)frameErrors,
+               (unsigned long long)((uint64_t)payload * sim::CPU_HZ / (elapsed > 0 ? elapsed : 1)),
+               (unsigned long)wire.corrupted, (unsigned long)wire.framing);
+
+        if (bad > 0)
+            fail("a corrupted frame passed the CRC");
+        if (p.strict && good != BENCH_FRAMES)
+            fail("frames lost without disturbances");
+    }
+
+    int program()
+    {
+        Pin tx(113, BENCH_TX_PIN);
+        Pin rx(114, BENCH_RX_PIN);
+        NRF52Serial2 serial(tx, rx);
+
+        sim::loopback(sim::uarte(1));
+
+        // EasyDMA can not read flash, so sendDirect() must turn such a buffer down.
+        static const uint8_t flash[4] = {1, 2, 3, 4};
+        if (serial.sendDirect(flash, sizeof(flash), ASYNC) != DEVICE_INVALID_PARAMETER)
+            fail("sendDirect() took a buffer outside RAM");
+
+        uint8_t *chunk = (uint8_t *)sim::ramAlloc(BENCH_CHUNK);
+        for (int i = 0; i < BENCH_CHUNK; i++)
+            chunk[i] = i;
+
+        printf("Streams of %d bytes, read every ms into a %d byte ring. ISR/KB counts UARTE interrupts per KB\n"
+               "sent and received, polls the system timer interrupts for the idle timeout of the driver.\n"
+               "ring is the least free space in the RX ringbuffer, dma_us the least time left in the running\n"
+               "RX DMA buffer when the next one was armed. rearm and ovr count RX transfers restarted on a\n"
+               "stale RXD.PTR and bytes lost by the UARTE; lost, drop and seq the bytes missing, those dropped\n"
+               "with a full ringbuffer and the breaks in the received sequence. frm is the framing errors\n"
+               "reported by the driver over those injected, flips the bytes silently corrupted.\n\n",
+               BENCH_LENGTH, BENCH_RX_BUFFER);
+        printf("   baud dma   rx        profile bytes/s ISR/KB polls ring dma_us rearm  ovr  lost drop  seq   frm     flips\n");
+
+        for (uint32_t baud : bauds)
+            for (const DmaConfig &dma : dmaConfigs)
+                for (int coalesced = 0; coalesced < 2; coalesced++)
+                    for (int profile = 0; profile < 3; profile++)
+                        stream(serial, chunk, baud, dma, coalesced, profile);
+
+        printf("\n%d COBS frames of 2 to %d bytes with a CRC, through Serial2Framer. bad counts frames that passed\n"
+               "the CRC with the wrong content, dropped those discarded, errors the frame error events.\n\n",
+               BENCH_FRAMES, BENCH_FRAME_MAX);
+        printf("   baud profile   sent  good   bad dropped  errors bytes/s flips/frm\n");
+
+        EventModel::defaultEventBus->listen(serial.id, IMQOPEN_NRF52SERIAL2_EVT_FRAME_ERROR, onFrameError);
+        for (uint32_t baud : bauds)
+            for (int profile = 0; profile < 3; profile += 2)
+                frames(serial, baud, profile);
+        EventModel::defaultEventBus->ignore(serial.id, IMQOPEN_NRF52SERIAL2_EVT_FRAME_ERROR, onFrameError);
+
+        sim::ramFree(chunk);
+
+        printf("\n%s\n", failures > 0 ? "FAILED" : "OK");
+        return failures > 0 ? 1 : 0;
+    }
+}
+
+int main()
+{
+    sim::init();
+    sim::initPeripherals();
+    target_init();
+
+    return sim::runProgram(program);
+}
@@ -0,0 +1,753 @@
+// The parts of codal-core and codal-nrf52 the driver runs on, on top of the simulator.
+
+#include <stdio.h>
+#include "CodalConfig.h"
+#include "CodalFiber.h"
+#include "EventModel.h"
+#include "ManagedString.h"
+#include "NRFLowLevelTimer.h"
+#include "Pin.h"
+#include "Serial.h"
+#include "Timer.h"
+#include "peripheral_alloc.h"
+#include "sim.h"
+#include "target.h"
+
+// Time a waiting fiber may sleep before the simulation is declared hung
+#define HOST_FIBER_HANG_US 10000000
+
+// Cycles schedule() takes when the fiber has nothing to wait for
+#define HOST_SCHEDULE_CYCLES 200
+
+// StringData::refCount of strings that are never freed, as in codal-core
+#define HOST_STRING_STATIC 0xFFFF
+
+void *device_malloc(size_t size)
+{
+    return sim::ramAlloc(size);
+}
+
+void device_free(void *p)
+{
+    sim::ramFree(p);
+}
+
+void target_panic(int statusCode)
+{
+    fprintf(stderr, "panic %d at %.3f ms\n", statusCode, sim::now() / (sim::CPU_HZ / 1000.0));
+    exit(2);
+}
+
+void target_disable_irq()
+{
+    sim::irqMask();
+}
+
+void target_enable_irq()
+{
+    sim::irqUnmask();
+    sim::cpu(1);
+}
+
+int8_t target_get_irq_disabled()
+{
+    return sim::irqMasked() ? 1 : 0;
+}
+
+void target_wait_us(uint32_t us)
+{
+    sim::cycles_t end = sim::now() + sim::us(us);
+    while (sim::now() < end)
+        sim::cpu(64);
+}
+
+void target_wait(uint32_t milliseconds)
+{
+    target_wait_us(milliseconds * 1000);
+}
+
+namespace codal
+{
+    namespace
+    {
+        struct Waiter
+        {
+            bool waiting;
+            bool woken;
+            uint16_t id;
+            uint16_t value;
+        };
+
+        Waiter fiber_ = {false, false, 0, 0};
+
+        struct TimerEvent
+        {
+            sim::cycles_t period; // 0 for a single event
+            sim::cycles_t next;
+            uint16_t id;
+            uint16_t value;
+        };
+
+        std::vector<TimerEvent> timerEvents_;
+        uint32_t timerGen_;
+
+        EventModel messageBus_;
+
+        StringData emptyData_ = {HOST_STRING_STATIC, 0};
+
+        void armSystemTimer()
+        {
+            uint32_t gen = ++timerGen_;
+
+            if (timerEvents_.empty())
+                return;
+
+            sim::cycles_t next = timerEvents_[0].next;
+            for (size_t i = 1; i < timerEvents_.size(); i++)
+                if (timerEvents_[i].next < next)
+                    next = timerEvents_[i].next;
+
+            // The compare event of the system timer raises its interrupt, which then fires the events.
+            sim::at(next, [gen]() {
+                if (gen == timerGen_)
+                    NVIC_SetPendingIRQ(TIMER1_IRQn);
+            });
+        }
+
+        void systemTimerIrq(void *)
+        {
+            std::vector<TimerEvent> due;
+            sim::cycles_t now = sim::now();
+
+            for (size_t i = 0; i < timerEvents_.size();)
+            {
+                TimerEvent &e = timerEvents_[i];
+                if (e.next > now)
+                {
+                    i++;
+                    continue;
+                }
+
+                due.push_back(e);
+                if (e.period > 0)
+                {
+                    while (e.next <= now)
+                        e.next += e.period;
+                    i++;
+                }
+                else
+                {
+                    timerEvents_.erase(timerEvents_.begin() + i);
+                }
+            }
+            armSystemTimer();
+
+            for (TimerEvent &e : due)
+                Event(e.id, e.value);
+        }
+
+        int addTimerEvent(CODAL_TIMESTAMP period, uint16_t id, uint16_t value, bool repeat)
+        {
+            if (period == 0)
+                return DEVICE_INVALID_PARAMETER;
+
+            TimerEvent e = {repeat ? sim::us(period) : 0, sim::now() + sim::us(period), id, value};
+            timerEvents_.push_back(e);
+            armSystemTimer();
+            return DEVICE_OK;
+        }
+
+        bool matches(uint16_t id, uint16_t value, const Event &evt)
+        {
+            return (id == DEVICE_ID_ANY || id == evt.source) && (value == DEVICE_EVT_ANY || value == evt.value);
+        }
+    }
+
+    EventModel *EventModel::defaultEventBus = &messageBus_;
+
+    void StringData::init()
+    {
+        // codal-core keeps the count shifted left with the low bit set.
+        refCount = 3;
+    }
+
+    void StringData::incr()
+    {
+        if (refCount != HOST_STRING_STATIC)
+            refCount += 2;
+    }
+
+    void StringData::decr()
+    {
+        if (refCount == HOST_STRING_STATIC)
+            return;
+        refCount -= 2;
+        if (refCount == 1)
+            free(this);
+    }
+
+    void ManagedString::initEmpty()
+    {
+        ptr = &emptyData_;
+    }
+
+    void ManagedString::initString(const char *str, int16_t len)
+    {
+        ptr = (StringData *)malloc(sizeof(StringData) + len + 1);
+        if (ptr == NULL)
+            target_panic(DEVICE_NO_RESOURCES);
+        ptr->init();
+        ptr->len = len;
+        memcpy(ptr->data, str, len);
+        ptr->data[len] = 0;
+    }
+
+    ManagedString::ManagedString(StringData *p)
+    {
+        if (p == NULL)
+        {
+            initEmpty();
+            return;
+        }
+        ptr = p;
+        ptr->incr();
+    }
+
+    ManagedString::ManagedString()
+    {
+        initEmpty();
+    }
+
+    ManagedString::ManagedString(const char *str)
+    {
+        if (str == NULL || *str == 0)
+            initEmpty();
+        else
+            initString(str, strlen(str));
+    }
+
+    ManagedString::ManagedString(const char *str, const int16_t length)
+    {
+        if (str == NULL || length <= 0)
+            initEmpty();
+        else
+            initString(str, length);
+    }
+
+    ManagedString::ManagedString(const ManagedString &s)
+    {
+        ptr = s.ptr;
+        ptr->incr();
+    }
+
+    ManagedString::~ManagedString()
+    {
+        ptr->decr();
+    }
+
+    ManagedString &ManagedString::operator=(const ManagedString &s)
+    {
+        if (ptr != s.ptr)
+        {
+            ptr->decr();
+            ptr = s.ptr;
+            ptr->incr();
+        }
+        return *this;
+    }
+
+    bool ManagedString::operator==(const ManagedString &s)
+    {
+        return ptr->len == s.ptr->len && memcmp(ptr->data, s.ptr->data, ptr->len) == 0;
+    }
+
+    ManagedString ManagedString::operator+(const ManagedString &s)
+    {
+        if (s.ptr->len == 0)
+            return *this;
+        if (ptr->len == 0)
+            return s;
+
+        StringData *data = (StringData *)malloc(sizeof(StringData) + ptr->len + s.ptr->len + 1);
+        if (data == NULL)
+            target_panic(DEVICE_NO_RESOURCES);
+        data->init();
+        data->len = ptr->len + s.ptr->len;
+        memcpy(data->data, ptr->data, ptr->len);
+        memcpy(data->data + ptr->len, s.ptr->data, s.ptr->len + 1);
+
+        ManagedString result(data);
+        data->decr();
+        return result;
+    }
+
+    char ManagedString::charAt(int16_t index) const
+    {
+        return index >= 0 && index < ptr->len ? ptr->data[index] : 0;
+    }
+
+    Event::Event(uint16_t source, uint16_t value, EventLaunchMode mode) : source(source), value(value)
+    {
+        timestamp = system_timer_current_time_us();
+        if (mode == CREATE_AND_FIRE)
+            fire();
+    }
+
+    Event::Event() : source(0), value(0)
+    {
+        timestamp = system_timer_current_time_us();
+    }
+
+    void Event::fire()
+    {
+        if (EventModel::defaultEventBus != NULL)
+            EventModel::defaultEventBus->send(*this);
+    }
+
+    int EventModel::add(uint16_t id, uint16_t value, void *object, std::function<void(Event)> handler, uint16_t flags)
+    {
+        for (Listener &l : listeners)
+            if (l.id == id && l.value == value && l.object == object)
+                return DEVICE_NOT_SUPPORTED;
+
+        Listener l = {id, value, flags, object, handler};
+        listeners.push_back(l);
+        return DEVICE_OK;
+    }
+
+    int EventModel::remove(uint16_t id, uint16_t value, void *object)
+    {
+        for (size_t i = 0; i < listeners.size(); i++)
+        {
+            Listener &l = listeners[i];
+            if (l.id == id && l.value == value && l.object == object)
+            {
+                listeners.erase(listeners.begin() + i);
+                return DEVICE_OK;
+            }
+        }
+        return DEVICE_INVALID_PARAMETER;
+    }
+
+    int EventModel::send(Event evt)
+    {
+        // The scheduler listens to every event, to wake the fibers waiting for it.
+        if (fiber_.waiting && matches(fiber_.id, fiber_.value, evt))
+            fiber_.woken = true;
+
+        std::vector<Listener> current = listeners;
+        for (Listener &l : current)
+        {
+            if (!matches(l.id, l.value, evt))
+                continue;
+
+            if ((l.flags & MESSAGE_BUS_LISTENER_IMMEDIATE) == MESSAGE_BUS_LISTENER_IMMEDIATE)
+                l.handler(evt);
+            else
+                queue.push_back(std::make_pair(l, evt));
+        }
+        return DEVICE_OK;
+    }
+
+    void EventModel::runQueue()
+    {
+        while (!queue.empty())
+        {
+            std::pair<Listener, Event> item = queue.front();
+            queue.erase(queue.begin());
+            item.first.handler(item.second);
+        }
+    }
+
+    int fiber_scheduler_running()
+    {
+        return 1;
+    }
+
+    int fiber_wake_on_event(uint16_t id, uint16_t value)
+    {
+        fiber_.waiting = true;
+        fiber_.woken = false;
+        fiber_.id = id;
+        fiber_.value = value;
+        return DEVICE_OK;
+    }
+
+    void schedule()
+    {
+        messageBus_.runQueue();
+
+        if (!fiber_.waiting)
+        {
+            sim::cpu(HOST_SCHEDULE_CYCLES);
+            return;
+        }
+
+        if (!sim::waitUntil([]() { return fiber_.woken; }, sim::now() + sim::us(HOST_FIBER_HANG_US)))
+        {
+            fprintf(stderr, "hang: the fiber waited %d s for event %d/%d at %.3f ms\n", HOST_FIBER_HANG_US / 1000000,
+                    fiber_.id, fiber_.value, sim::now() / (sim::CPU_HZ / 1000.0));
+            exit(2);
+        }
+        fiber_.waiting = false;
+        messageBus_.runQueue();
+    }
+
+    void fiber_wait_for_event(uint16_t id, uint16_t value)
+    {
+        fiber_wake_on_event(id, value);
+        schedule();
+    }
+
+    void fiber_sleep(unsigned long t)
+    {
+        messageBus_.runQueue();
+        sim::waitUntil([]() { return false; }, sim::now() + sim::us((uint64_t)t * 1000));
+        messageBus_.runQueue();
+    }
+
+    CODAL_TIMESTAMP system_timer_current_time_us()
+    {
+        return sim::now() / (sim::CPU_HZ / 1000000);
+    }
+
+    CODAL_TIMESTAMP system_timer_current_time()
+    {
+        return system_timer_current_time_us() / 1000;
+    }
+
+    int system_timer_event_every_us(CODAL_TIMESTAMP period, uint16_t id, uint16_t value)
+    {
+        return addTimerEvent(period, id, value, true);
+    }
+
+    int system_timer_event_after_us(CODAL_TIMESTAMP period, uint16_t id, uint16_t value)
+    {
+        return addTimerEvent(period, id, value, false);
+    }
+
+    int system_timer_cancel_event(uint16_t id, uint16_t value)
+    {
+        for (size_t i = 0; i < timerEvents_.size(); i++)
+        {
+            if (timerEvents_[i].id == id && timerEvents_[i].value == value)
+            {
+                timerEvents_.erase(timerEvents_.begin() + i);
+                armSystemTimer();
+                return DEVICE_OK;
+            }
+        }
+        return DEVICE_INVALID_PARAMETER;
+    }
+
+    Serial::Serial(Pin &tx, Pin &rx, uint8_t rxBufferSize, uint8_t txBufferSize, uint16_t id)
+        : tx(&tx), rx(&rx), rxBuffHeadMatch(-1), rxBuff(NULL), rxBuffSize(rxBufferSize), rxBuffHead(0), rxBuffTail(0),
+          txBuff(NULL), txBuffSize(txBufferSize), txBuffHead(0), txBuffTail(0), baudrate(CODAL_SERIAL_DEFAULT_BAUD_RATE)
+    {
+        this->id = id;
+        this->status = 0;
+    }
+
+    Serial::~Serial()
+    {
+    }
+
+    int Serial::setBaud(int baudrate)
+    {
+        if (baudrate < 0)
+            return DEVICE_INVALID_PARAMETER;
+
+        this->baudrate = baudrate;
+        return setBaudrate(baudrate);
+    }
+
+    int Serial::redirect(Pin &tx, Pin &rx)
+    {
+        if (txInUse() || rxInUse())
+            return DEVICE_SERIAL_IN_USE;
+
+        lockTx();
+        lockRx();
+
+        disableInterrupt(TxInterrupt);
+        disableInterrupt(RxInterrupt);
+        configurePins(tx, rx);
+        enableInterrupt(RxInterrupt);
+        enableInterrupt(TxInterrupt);
+
+        this->setBaud(this->baudrate);
+
+        unlockRx();
+        unlockTx();
+
+        return DEVICE_OK;
+    }
+
+    int Serial::rxInUse()
+    {
+        return status & CODAL_SERIAL_STATUS_RX_IN_USE;
+    }
+
+    int Serial::txInUse()
+    {
+        return status & CODAL_SERIAL_STATUS_TX_IN_USE;
+    }
+
+    void Serial::lockRx()
+    {
+        status |= CODAL_SERIAL_STATUS_RX_IN_USE;
+    }
+
+    void Serial::lockTx()
+    {
+        status |= CODAL_SERIAL_STATUS_TX_IN_USE;
+    }
+
+    void Serial::unlockRx()
+    {
+        status &= ~CODAL_SERIAL_STATUS_RX_IN_USE;
+    }
+
+    void Serial::unlockTx()
+    {
+        status &= ~CODAL_SERIAL_STATUS_TX_IN_USE;
+    }
+
+    namespace
+    {
+        NRF_GPIO_Type *port(int name)
+        {
+            return (name >> 5) ? NRF_P1 : NRF_P0;
+        }
+    }
+
+    int Pin::setPull(PullMode pull)
+    {
+        this->pull = pull;
+        return DEVICE_OK;
+    }
+
+    int Pin::setDigitalValue(int value)
+    {
+        NRF_GPIO_Type *p = port(name);
+        uint32_t mask = 1UL << (name & 31);
+
+        p->DIR = p->DIR | mask;
+        p->OUT = value ? (p->OUT | mask) : (p->OUT & ~mask);
+        return DEVICE_OK;
+    }
+
+    int Pin::getDigitalValue()
+    {
+        NRF_GPIO_Type *p = port(name);
+        uint32_t mask = 1UL << (name & 31);
+
+        // Nothing else is wired to the pins, an output reads back its own level.
+        return ((p->DIR & mask) ? p->OUT & mask : p->IN & mask) ? 1 : 0;
+    }
+
+    namespace
+    {
+        void lowLevelTimerIrq(void *arg)
+        {
+            ((NRFLowLevelTimer *)arg)->irq();
+        }
+    }
+
+    NRFLowLevelTimer::NRFLowLevelTimer(NRF_TIMER_Type *timer, IRQn_Type irqn) : irqn(irqn), timer(timer)
+    {
+        sim::irqAttach(irqn, lowLevelTimerIrq, this);
+        disable();
+        setClockSpeed(1000);
+        setMode(TimerModeTimer);
+        setBitMode(BitMode32);
+        timer->INTENCLR = 0xFFFFFFFF;
+    }
+
+    void NRFLowLevelTimer::irq()
+    {
+        uint16_t channels = 0;
+
+        for (int i = 0; i < 4; i++)
+        {
+            if (timer->EVENTS_COMPARE[i])
+            {
+                channels |= 1 << i;
+                timer->EVENTS_COMPARE[i] = 0;
+            }
+        }
+
+        if (timer_pointer != NULL)
+            timer_pointer(channels);
+    }
+
+    int NRFLowLevelTimer::enable()
+    {
+        enableIRQ();
+        timer->TASKS_START = 1;
+        return DEVICE_OK;
+    }
+
+    int NRFLowLevelTimer::enableIRQ()
+    {
+        NVIC_EnableIRQ(irqn);
+        return DEVICE_OK;
+    }
+
+    int NRFLowLevelTimer::disable()
+    {
+        disableIRQ();
+        timer->TASKS_STOP = 1;
+        return DEVICE_OK;
+    }
+
+    int NRFLowLevelTimer::disableIRQ()
+    {
+        NVIC_DisableIRQ(irqn);
+        return DEVICE_OK;
+    }
+
+    int NRFLowLevelTimer::reset()
+    {
+        timer->TASKS_CLEAR = 1;
+        return DEVICE_OK;
+    }
+
+    int NRFLowLevelTimer::setMode(TimerMode t)
+    {
+        timer->MODE = t == TimerModeCounter ? TIMER_MODE_MODE_Counter : TIMER_MODE_MODE_Timer;
+        return DEVICE_OK;
+    }
+
+    int NRFLowLevelTimer::setCompare(uint8_t channel, uint32_t value)
+    {
+        if (channel > 3)
+            return DEVICE_INVALID_PARAMETER;
+
+        timer->CC[channel] = value;
+        timer->INTENSET = TIMER_INTENSET_COMPARE0_Msk << channel;
+        return DEVICE_OK;
+    }
+
+    int NRFLowLevelTimer::offsetCompare(uint8_t channel, uint32_t value)
+    {
+        return setCompare(channel, captureCounter() + value);
+    }
+
+    int NRFLowLevelTimer::clearCompare(uint8_t channel)
+    {
+        if (channel > 3)
+            return DEVICE_INVALID_PARAMETER;
+
+        timer->INTENCLR = TIMER_INTENSET_COMPARE0_Msk << channel;
+        return DEVICE_OK;
+    }
+
+    uint32_t NRFLowLevelTimer::captureCounter()
+    {
+        // Channel 3 is kept for captures, as in codal-nrf52.
+        timer->TASKS_CAPTURE[3] = 1;
+        return timer->CC[3];
+    }
+
+    int NRFLowLevelTimer::setClockSpeed(uint32_t speedKHz)
+    {
+        uint32_t prescaler = 0;
+
+        while (prescaler < 9 && (16000UL >> prescaler) > speedKHz)
+            prescaler++;
+        if ((16000UL >> prescaler) != speedKHz)
+            return DEVICE_INVALID_PARAMETER;
+
+        timer->PRESCALER = prescaler;
+        return DEVICE_OK;
+    }
+
+    int NRFLowLevelTimer::setBitMode(TimerBitMode t)
+    {
+        static const uint32_t modes[] = {TIMER_BITMODE_BITMODE_08Bit, TIMER_BITMODE_BITMODE_16Bit,
+                                         TIMER_BITMODE_BITMODE_24Bit, TIMER_BITMODE_BITMODE_32Bit};
+
+        timer->BITMODE = modes[t];
+        return DEVICE_OK;
+    }
+}
+
+namespace
+{
+    struct AllocatedPeripheral
+    {
+        uintptr_t device;
+        IRQn_Type irqn;
+        bool used;
+    };
+
+    // UARTE0 is held by uBit.serial on a micro:bit, so NRF52Serial2 gets UARTE1.
+    AllocatedPeripheral uartes_[] = {
+        {NRF_UARTE0_BASE, UARTE0_UART0_IRQn, true},
+        {NRF_UARTE1_BASE, UARTE1_IRQn, false},
+    };
+
+    AllocatedPeripheral *findPeripheral(void *device)
+    {
+        for (AllocatedPeripheral &p : uartes_)
+            if (p.device == (uintptr_t)device)
+                return &p;
+        return NULL;
+    }
+}
+
+void *allocate_peripheral(int mode)
+{
+    if (mode != PERI_MODE_UARTE)
+        return NULL;
+
+    for (AllocatedPeripheral &p : uartes_)
+    {
+        if (!p.used)
+        {
+            p.used = true;
+            return (void *)p.device;
+        }
+    }
+    return NULL;
+}
+
+void *allocate_peripheral(void *device)
+{
+    AllocatedPeripheral *p = findPeripheral(device);
+    if (p == NULL || p->used)
+        return NULL;
+
+    p->used = true;
+    return device;
+}
+
+void set_alloc_peri_irq(void *device, void (*fn)(void *), void *userdata)
+{
+    AllocatedPeripheral *p = findPeripheral(device);
+    if (p != NULL)
+        sim::irqAttach(p->irqn, fn, userdata);
+}
+
+IRQn_Type get_alloc_peri_irqn(void *device)
+{
+    AllocatedPeripheral *p = findPeripheral(device);
+    return p != NULL ? p->irqn : (IRQn_Type)-1;
+}
+
+void free_alloc_peri(void *device)
+{
+    AllocatedPeripheral *p = findPeripheral(device);
+    if (p != NULL)
+    {
+        p->used = false;
+        sim::irqAttach(p->irqn, NULL, NULL);
+    }
+}
+
+void target_init()
+{
+    sim::irqAttach(TIMER1_IRQn, codal::systemTimerIrq, NULL);
+    NVIC_EnableIRQ(TIMER1_IRQn);
+}
@@ -0,0 +1,21 @@
+#ifndef IMQOPEN_HOST_DEVICE_RAM_H
+#define IMQOPEN_HOST_DEVICE_RAM_H
+
+// Included ahead of the device code: the driver, the framer and the codal layer allocate
+// in the simulated RAM, like they do on the device, so that EasyDMA reaches their buffers.
+
+#include <stdlib.h>
+#include <string.h>
+#include <deque>
+#include <functional>
+#include <new>
+#include <utility>
+#include <vector>
+
+void *device_malloc(size_t size);
+void device_free(void *p);
+
+#define malloc device_malloc
+#define free device_free
+
+#endif // IMQOPEN_HOST_DEVICE_RAM_H
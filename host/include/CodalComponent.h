@@ -0,0 +1,40 @@
+#ifndef CODAL_COMPONENT_H
+#define CODAL_COMPONENT_H
+
+#include "CodalConfig.h"
+#include "Event.h"
+#include "ManagedString.h"
+
+namespace codal
+{
+    class CodalComponent
+    {
+    public:
+        uint16_t id;
+        uint16_t status;
+
+        CodalComponent() : id(0), status(0)
+        {
+        }
+
+        CodalComponent(uint16_t id, uint16_t status) : id(id), status(status)
+        {
+        }
+
+        virtual int setSleep(bool doSleep)
+        {
+            (void)doSleep;
+            return DEVICE_OK;
+        }
+
+        virtual ~CodalComponent()
+        {
+        }
+    };
+
+    class PinPeripheral
+    {
+    };
+}
+
+#endif
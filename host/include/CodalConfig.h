@@ -0,0 +1,36 @@
+#ifndef CODAL_CONFIG_H
+#define CODAL_CONFIG_H
+
+// The codal configuration and error codes the driver uses, with their codal-core values.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdlib.h>
+#include "nrf.h"
+
+#define DEVICE_OK 0
+#define DEVICE_INVALID_PARAMETER -1001
+#define DEVICE_NOT_SUPPORTED -1002
+#define DEVICE_CALIBRATION_IN_PROGRESS -1003
+#define DEVICE_NO_DATA -1004
+#define DEVICE_NO_RESOURCES -1005
+#define DEVICE_BUSY -1006
+#define DEVICE_CANCELLED -1007
+#define DEVICE_SERIAL_IN_USE -1011
+#define DEVICE_INVALID_STATE -1020
+#define DEVICE_HARDWARE_CONFIGURATION_ERROR 52
+
+#define DEVICE_ID_ANY 0
+#define DEVICE_EVT_ANY 0
+#define DEVICE_ID_NOTIFY 1023
+
+typedef uint64_t CODAL_TIMESTAMP;
+
+void target_panic(int statusCode);
+void target_disable_irq();
+void target_enable_irq();
+void target_wait(uint32_t milliseconds);
+void target_wait_us(uint32_t us);
+
+#endif
@@ -0,0 +1,6 @@
+#ifndef CODAL_DMESG_H
+#define CODAL_DMESG_H
+
+#define DMESG(...) ((void)0)
+
+#endif
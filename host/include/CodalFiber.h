@@ -0,0 +1,19 @@
+#ifndef CODAL_FIBER_H
+#define CODAL_FIBER_H
+
+#include "CodalConfig.h"
+#include "Event.h"
+
+// The host runs a single fiber: the program itself. schedule() lets the simulated
+// time run until an event it waits for is raised, see sim.cpp.
+
+namespace codal
+{
+    int fiber_scheduler_running();
+    void schedule();
+    void fiber_sleep(unsigned long t);
+    void fiber_wait_for_event(uint16_t id, uint16_t value);
+    int fiber_wake_on_event(uint16_t id, uint16_t value);
+}
+
+#endif
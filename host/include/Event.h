@@ -0,0 +1,28 @@
+#ifndef CODAL_EVENT_H
+#define CODAL_EVENT_H
+
+#include "CodalConfig.h"
+
+namespace codal
+{
+    enum EventLaunchMode
+    {
+        CREATE_ONLY,
+        CREATE_AND_FIRE
+    };
+
+    class Event
+    {
+    public:
+        uint16_t source;
+        uint16_t value;
+        CODAL_TIMESTAMP timestamp;
+
+        Event(uint16_t source, uint16_t value, EventLaunchMode mode = CREATE_AND_FIRE);
+        Event();
+
+        void fire();
+    };
+}
+
+#endif
@@ -0,0 +1,69 @@
+#ifndef EVENT_MODEL_H
+#define EVENT_MODEL_H
+
+#include <functional>
+#include <vector>
+#include "CodalConfig.h"
+#include "Event.h"
+
+#define MESSAGE_BUS_LISTENER_REENTRANT 0x0001
+#define MESSAGE_BUS_LISTENER_QUEUE_IF_BUSY 0x0002
+#define MESSAGE_BUS_LISTENER_DROP_IF_BUSY 0x0004
+#define MESSAGE_BUS_LISTENER_NONBLOCKING 0x0008
+#define MESSAGE_BUS_LISTENER_IMMEDIATE (MESSAGE_BUS_LISTENER_NONBLOCKING | MESSAGE_BUS_LISTENER_REENTRANT)
+
+namespace codal
+{
+    /**
+     * The message bus. Immediate listeners run where the event is raised, the
+     * others are queued and run by the fiber when it next sleeps or yields.
+     **/
+    class EventModel
+    {
+        struct Listener
+        {
+            uint16_t id;
+            uint16_t value;
+            uint16_t flags;
+            void *object;
+            std::function<void(Event)> handler;
+        };
+
+        std::vector<Listener> listeners;
+        std::vector<std::pair<Listener, Event>> queue;
+
+        int add(uint16_t id, uint16_t value, void *object, std::function<void(Event)> handler, uint16_t flags);
+        int remove(uint16_t id, uint16_t value, void *object);
+
+    public:
+        static EventModel *defaultEventBus;
+
+        int send(Event evt);
+        void runQueue();
+
+        int listen(uint16_t id, uint16_t value, void (*handler)(Event), uint16_t flags = MESSAGE_BUS_LISTENER_QUEUE_IF_BUSY)
+        {
+            return add(id, value, (void *)handler, handler, flags);
+        }
+
+        int ignore(uint16_t id, uint16_t value, void (*handler)(Event))
+        {
+            return remove(id, value, (void *)handler);
+        }
+
+        template <typename T>
+        int listen(uint16_t id, uint16_t value, T *object, void (T::*handler)(Event), uint16_t flags = MESSAGE_BUS_LISTENER_QUEUE_IF_BUSY)
+        {
+            return add(id, value, object, [object, handler](Event e) { (object->*handler)(e); }, flags);
+        }
+
+        template <typename T>
+        int ignore(uint16_t id, uint16_t value, T *object, void (T::*handler)(Event))
+        {
+            (void)handler;
+            return remove(id, value, object);
+        }
+    };
+}
+
+#endif
@@ -0,0 +1,56 @@
+#ifndef MANAGED_STRING_H
+#define MANAGED_STRING_H
+
+#include "CodalConfig.h"
+
+namespace codal
+{
+    /**
+     * Reference counted string storage, laid out as in codal-core.
+     **/
+    struct StringData
+    {
+        uint16_t refCount;
+        uint16_t len;
+        char data[0];
+
+        void init();
+        void incr();
+        void decr();
+    };
+
+    /**
+     * An immutable reference counted string, allocated with malloc() like codal-core does.
+     **/
+    class ManagedString
+    {
+        StringData *ptr;
+
+        void initEmpty();
+        void initString(const char *str, int16_t len);
+
+    public:
+        ManagedString(StringData *ptr);
+        ManagedString();
+        ManagedString(const char *str);
+        ManagedString(const char *str, const int16_t length);
+        ManagedString(const ManagedString &s);
+        ~ManagedString();
+
+        ManagedString &operator=(const ManagedString &s);
+        bool operator==(const ManagedString &s);
+        ManagedString operator+(const ManagedString &s);
+
+        char charAt(int16_t index) const;
+        const char *toCharArray() const
+        {
+            return ptr->data;
+        }
+        int16_t length() const
+        {
+            return ptr->len;
+        }
+    };
+}
+
+#endif
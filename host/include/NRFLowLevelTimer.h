@@ -0,0 +1,85 @@
+#ifndef NRF_LOW_LEVEL_TIMER_H
+#define NRF_LOW_LEVEL_TIMER_H
+
+#include "CodalConfig.h"
+
+namespace codal
+{
+    enum TimerMode
+    {
+        TimerModeTimer = 0,
+        TimerModeCounter,
+        TimerModeAlternateFunction
+    };
+
+    enum TimerBitMode
+    {
+        BitMode8 = 0,
+        BitMode16,
+        BitMode24,
+        BitMode32
+    };
+
+    class LowLevelTimer
+    {
+    public:
+        void (*timer_pointer)(uint16_t channel_bitmsk);
+
+        LowLevelTimer() : timer_pointer(NULL)
+        {
+        }
+
+        virtual int setIRQ(void (*timer_pointer)(uint16_t channel_bitmsk))
+        {
+            this->timer_pointer = timer_pointer;
+            return DEVICE_OK;
+        }
+
+        virtual int enable() = 0;
+        virtual int enableIRQ() = 0;
+        virtual int disable() = 0;
+        virtual int disableIRQ() = 0;
+        virtual int reset() = 0;
+        virtual int setMode(TimerMode t) = 0;
+        virtual int setCompare(uint8_t channel, uint32_t value) = 0;
+        virtual int offsetCompare(uint8_t channel, uint32_t value) = 0;
+        virtual int clearCompare(uint8_t channel) = 0;
+        virtual uint32_t captureCounter() = 0;
+        virtual int setClockSpeed(uint32_t speedKHz) = 0;
+        virtual int setBitMode(TimerBitMode t) = 0;
+
+        virtual ~LowLevelTimer()
+        {
+        }
+    };
+
+    /**
+     * codal-nrf52's timer driver, on top of the simulated TIMER registers.
+     **/
+    class NRFLowLevelTimer : public LowLevelTimer
+    {
+        IRQn_Type irqn;
+
+    public:
+        NRF_TIMER_Type *timer;
+
+        NRFLowLevelTimer(NRF_TIMER_Type *timer, IRQn_Type irqn);
+
+        virtual int enable() override;
+        virtual int enableIRQ() override;
+        virtual int disable() override;
+        virtual int disableIRQ() override;
+        virtual int reset() override;
+        virtual int setMode(TimerMode t) override;
+        virtual int setCompare(uint8_t channel, uint32_t value) override;
+        virtual int offsetCompare(uint8_t channel, uint32_t value) override;
+        virtual int clearCompare(uint8_t channel) override;
+        virtual uint32_t captureCounter() override;
+        virtual int setClockSpeed(uint32_t speedKHz) override;
+        virtual int setBitMode(TimerBitMode t) override;
+
+        void irq();
+    };
+}
+
+#endif
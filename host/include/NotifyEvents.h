@@ -0,0 +1,6 @@
+#ifndef NOTIFY_EVENTS_H
+#define NOTIFY_EVENTS_H
+
+#define CODAL_SERIAL_EVT_TX_EMPTY 2
+
+#endif
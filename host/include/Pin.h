@@ -0,0 +1,35 @@
+#ifndef CODAL_PIN_H
+#define CODAL_PIN_H
+
+#include "CodalConfig.h"
+
+namespace codal
+{
+    enum PullMode
+    {
+        None = 0,
+        Down,
+        Up
+    };
+
+    /**
+     * A GPIO pin. Its level is the OUT bit of its port, or what the wire model drives on IN.
+     **/
+    class Pin
+    {
+    public:
+        int name;
+        uint16_t id;
+        PullMode pull;
+
+        Pin(int id, int name) : name(name), id(id), pull(None)
+        {
+        }
+
+        int setPull(PullMode pull);
+        int setDigitalValue(int value);
+        int getDigitalValue();
+    };
+}
+
+#endif
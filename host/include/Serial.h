@@ -0,0 +1,96 @@
+#ifndef CODAL_SERIAL_H
+#define CODAL_SERIAL_H
+
+#include "CodalConfig.h"
+#include "CodalComponent.h"
+#include "ManagedString.h"
+#include "Pin.h"
+
+#define CODAL_SERIAL_DEFAULT_BAUD_RATE 115200
+#define CODAL_SERIAL_DEFAULT_BUFFER_SIZE 20
+
+#define CODAL_SERIAL_EVT_DELIM_MATCH 1
+#define CODAL_SERIAL_EVT_HEAD_MATCH 2
+#define CODAL_SERIAL_EVT_RX_FULL 3
+#define CODAL_SERIAL_EVT_DATA_RECEIVED 4
+
+#define CODAL_SERIAL_RX_IN_USE 1
+#define CODAL_SERIAL_TX_IN_USE 2
+#define CODAL_SERIAL_RX_BUFF_INIT 4
+#define CODAL_SERIAL_TX_BUFF_INIT 8
+
+#define CODAL_SERIAL_STATUS_RX_IN_USE 0x01
+#define CODAL_SERIAL_STATUS_TX_IN_USE 0x02
+#define CODAL_SERIAL_STATUS_RX_BUFF_INIT 0x04
+#define CODAL_SERIAL_STATUS_TX_BUFF_INIT 0x08
+#define CODAL_SERIAL_STATUS_DEEPSLEEP 0x10
+
+#define DEVICE_DEFAULT_SERIAL_MODE SYNC_SLEEP
+
+namespace codal
+{
+    enum SerialMode
+    {
+        ASYNC,
+        SYNC_SPINWAIT,
+        SYNC_SLEEP
+    };
+
+    enum SerialInterruptType
+    {
+        RxInterrupt = 0,
+        TxInterrupt
+    };
+
+    /**
+     * The codal-core Serial base class, with the members and methods NRF52Serial2 builds on.
+     **/
+    class Serial : public PinPeripheral, public CodalComponent
+    {
+    protected:
+        Pin *tx;
+        Pin *rx;
+
+        ManagedString delimeters;
+
+        int rxBuffHeadMatch;
+
+        uint8_t *rxBuff;
+        uint8_t rxBuffSize;
+        volatile uint16_t rxBuffHead;
+        uint16_t rxBuffTail;
+
+        uint8_t *txBuff;
+        uint8_t txBuffSize;
+        uint16_t txBuffHead;
+        volatile uint16_t txBuffTail;
+
+        uint32_t baudrate;
+
+        virtual int enableInterrupt(SerialInterruptType t) = 0;
+        virtual int disableInterrupt(SerialInterruptType t) = 0;
+        virtual int setBaudrate(uint32_t baudrate) = 0;
+        virtual int configurePins(Pin &tx, Pin &rx) = 0;
+
+    public:
+        virtual int putc(char c) = 0;
+        virtual int getc() = 0;
+
+        Serial(Pin &tx, Pin &rx, uint8_t rxBufferSize = CODAL_SERIAL_DEFAULT_BUFFER_SIZE,
+               uint8_t txBufferSize = CODAL_SERIAL_DEFAULT_BUFFER_SIZE, uint16_t id = 0);
+
+        int setBaud(int baudrate);
+        virtual int redirect(Pin &tx, Pin &rx);
+
+        int rxInUse();
+        int txInUse();
+        void lockRx();
+        void lockTx();
+        void unlockRx();
+        void unlockTx();
+
+        virtual ~Serial();
+    };
+}
+
+#endif
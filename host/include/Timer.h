@@ -0,0 +1,15 @@
+#ifndef CODAL_TIMER_H
+#define CODAL_TIMER_H
+
+#include "CodalConfig.h"
+
+namespace codal
+{
+    CODAL_TIMESTAMP system_timer_current_time();
+    CODAL_TIMESTAMP system_timer_current_time_us();
+    int system_timer_event_every_us(CODAL_TIMESTAMP period, uint16_t id, uint16_t value);
+    int system_timer_event_after_us(CODAL_TIMESTAMP period, uint16_t id, uint16_t value);
+    int system_timer_cancel_event(uint16_t id, uint16_t value);
+}
+
+#endif
@@ -0,0 +1,251 @@
+#ifndef IMQOPEN_HOST_NRF_UARTE_H
+#define IMQOPEN_HOST_NRF_UARTE_H
+
+// The subset of the nrfx UARTE HAL used by the driver, with the same register accesses.
+
+#include "nrf.h"
+
+typedef enum
+{
+    NRF_UARTE_TASK_STARTRX = offsetof(NRF_UARTE_Type, TASKS_STARTRX),
+    NRF_UARTE_TASK_STOPRX = offsetof(NRF_UARTE_Type, TASKS_STOPRX),
+    NRF_UARTE_TASK_STARTTX = offsetof(NRF_UARTE_Type, TASKS_STARTTX),
+    NRF_UARTE_TASK_STOPTX = offsetof(NRF_UARTE_Type, TASKS_STOPTX),
+    NRF_UARTE_TASK_FLUSHRX = offsetof(NRF_UARTE_Type, TASKS_FLUSHRX),
+} nrf_uarte_task_t;
+
+typedef enum
+{
+    NRF_UARTE_EVENT_CTS = offsetof(NRF_UARTE_Type, EVENTS_CTS),
+    NRF_UARTE_EVENT_NCTS = offsetof(NRF_UARTE_Type, EVENTS_NCTS),
+    NRF_UARTE_EVENT_RXDRDY = offsetof(NRF_UARTE_Type, EVENTS_RXDRDY),
+    NRF_UARTE_EVENT_ENDRX = offsetof(NRF_UARTE_Type, EVENTS_ENDRX),
+    NRF_UARTE_EVENT_TXDRDY = offsetof(NRF_UARTE_Type, EVENTS_TXDRDY),
+    NRF_UARTE_EVENT_ENDTX = offsetof(NRF_UARTE_Type, EVENTS_ENDTX),
+    NRF_UARTE_EVENT_ERROR = offsetof(NRF_UARTE_Type, EVENTS_ERROR),
+    NRF_UARTE_EVENT_RXTO = offsetof(NRF_UARTE_Type, EVENTS_RXTO),
+    NRF_UARTE_EVENT_RXSTARTED = offsetof(NRF_UARTE_Type, EVENTS_RXSTARTED),
+    NRF_UARTE_EVENT_TXSTARTED = offsetof(NRF_UARTE_Type, EVENTS_TXSTARTED),
+    NRF_UARTE_EVENT_TXSTOPPED = offsetof(NRF_UARTE_Type, EVENTS_TXSTOPPED),
+} nrf_uarte_event_t;
+
+typedef enum
+{
+    NRF_UARTE_SHORT_ENDRX_STARTRX = 1UL << 5,
+    NRF_UARTE_SHORT_ENDRX_STOPRX = 1UL << 6,
+} nrf_uarte_short_t;
+
+// Bit n of INTEN enables the event at offset 0x100 + 4 * n
+typedef enum
+{
+    NRF_UARTE_INT_CTS_MASK = 1UL << 0,
+    NRF_UARTE_INT_NCTS_MASK = 1UL << 1,
+    NRF_UARTE_INT_RXDRDY_MASK = 1UL << 2,
+    NRF_UARTE_INT_ENDRX_MASK = 1UL << 4,
+    NRF_UARTE_INT_TXDRDY_MASK = 1UL << 7,
+    NRF_UARTE_INT_ENDTX_MASK = 1UL << 8,
+    NRF_UARTE_INT_ERROR_MASK = 1UL << 9,
+    NRF_UARTE_INT_RXTO_MASK = 1UL << 17,
+    NRF_UARTE_INT_RXSTARTED_MASK = 1UL << 19,
+    NRF_UARTE_INT_TXSTARTED_MASK = 1UL << 20,
+    NRF_UARTE_INT_TXSTOPPED_MASK = 1UL << 22,
+} nrf_uarte_int_mask_t;
+
+typedef enum
+{
+    NRF_UARTE_BAUDRATE_1200 = 0x0004F000,
+    NRF_UARTE_BAUDRATE_2400 = 0x0009D000,
+    NRF_UARTE_BAUDRATE_4800 = 0x0013B000,
+    NRF_UARTE_BAUDRATE_9600 = 0x00275000,
+    NRF_UARTE_BAUDRATE_14400 = 0x003AF000,
+    NRF_UARTE_BAUDRATE_19200 = 0x004EA000,
+    NRF_UARTE_BAUDRATE_28800 = 0x0075C000,
+    NRF_UARTE_BAUDRATE_31250 = 0x00800000,
+    NRF_UARTE_BAUDRATE_38400 = 0x009D0000,
+    NRF_UARTE_BAUDRATE_56000 = 0x00E50000,
+    NRF_UARTE_BAUDRATE_57600 = 0x00EB0000,
+    NRF_UARTE_BAUDRATE_76800 = 0x013A9000,
+    NRF_UARTE_BAUDRATE_115200 = 0x01D60000,
+    NRF_UARTE_BAUDRATE_230400 = 0x03B00000,
+    NRF_UARTE_BAUDRATE_250000 = 0x04000000,
+    NRF_UARTE_BAUDRATE_460800 = 0x07400000,
+    NRF_UARTE_BAUDRATE_921600 = 0x0F000000,
+    NRF_UARTE_BAUDRATE_1000000 = 0x10000000,
+} nrf_uarte_baudrate_t;
+
+typedef enum
+{
+    NRF_UARTE_ERROR_OVERRUN_MASK = 1UL << 0,
+    NRF_UARTE_ERROR_PARITY_MASK = 1UL << 1,
+    NRF_UARTE_ERROR_FRAMING_MASK = 1UL << 2,
+    NRF_UARTE_ERROR_BREAK_MASK = 1UL << 3,
+} nrf_uarte_error_mask_t;
+
+typedef enum
+{
+    NRF_UARTE_PARITY_EXCLUDED = 0,
+    NRF_UARTE_PARITY_INCLUDED = UARTE_CONFIG_PARITY_Msk,
+} nrf_uarte_parity_t;
+
+typedef enum
+{
+    NRF_UARTE_HWFC_DISABLED = 0,
+    NRF_UARTE_HWFC_ENABLED = UARTE_CONFIG_HWFC_Msk,
+} nrf_uarte_hwfc_t;
+
+typedef enum
+{
+    NRF_UARTE_STOP_ONE = 0,
+    NRF_UARTE_STOP_TWO = UARTE_CONFIG_STOP_Msk,
+} nrf_uarte_stop_t;
+
+typedef enum
+{
+    NRF_UARTE_PARITYTYPE_EVEN = 0,
+    NRF_UARTE_PARITYTYPE_ODD = UARTE_CONFIG_PARITYTYPE_Msk,
+} nrf_uarte_paritytype_t;
+
+typedef struct
+{
+    nrf_uarte_hwfc_t hwfc;
+    nrf_uarte_parity_t parity;
+    nrf_uarte_stop_t stop;
+    nrf_uarte_paritytype_t paritytype;
+} nrf_uarte_config_t;
+
+#define NRF_UARTE_PSEL_DISCONNECTED 0xFFFFFFFF
+
+static inline volatile NrfRegister *nrf_uarte_register(NRF_UARTE_Type const *p_reg, uint32_t offset)
+{
+    return (volatile NrfRegister *)((uint8_t *)p_reg + offset);
+}
+
+static inline void nrf_uarte_event_clear(NRF_UARTE_Type *p_reg, nrf_uarte_event_t event)
+{
+    *nrf_uarte_register(p_reg, event) = 0;
+}
+
+static inline bool nrf_uarte_event_check(NRF_UARTE_Type const *p_reg, nrf_uarte_event_t event)
+{
+    return (bool)*nrf_uarte_register(p_reg, event);
+}
+
+// PPI endpoints are 32-bit bus addresses, which the peripherals have on the host as well.
+static inline uint32_t nrf_uarte_event_address_get(NRF_UARTE_Type const *p_reg, nrf_uarte_event_t event)
+{
+    return (uint32_t)((uintptr_t)p_reg + event);
+}
+
+static inline uint32_t nrf_uarte_task_address_get(NRF_UARTE_Type const *p_reg, nrf_uarte_task_t task)
+{
+    return (uint32_t)((uintptr_t)p_reg + task);
+}
+
+static inline void nrf_uarte_task_trigger(NRF_UARTE_Type *p_reg, nrf_uarte_task_t task)
+{
+    *nrf_uarte_register(p_reg, task) = 1;
+}
+
+static inline void nrf_uarte_shorts_enable(NRF_UARTE_Type *p_reg, uint32_t mask)
+{
+    p_reg->SHORTS |= mask;
+}
+
+static inline void nrf_uarte_shorts_disable(NRF_UARTE_Type *p_reg, uint32_t mask)
+{
+    p_reg->SHORTS &= ~mask;
+}
+
+static inline void nrf_uarte_int_enable(NRF_UARTE_Type *p_reg, uint32_t mask)
+{
+    p_reg->INTENSET = mask;
+}
+
+static inline void nrf_uarte_int_disable(NRF_UARTE_Type *p_reg, uint32_t mask)
+{
+    p_reg->INTENCLR = mask;
+}
+
+static inline bool nrf_uarte_int_enable_check(NRF_UARTE_Type const *p_reg, uint32_t mask)
+{
+    return p_reg->INTENSET & mask;
+}
+
+static inline uint32_t nrf_uarte_errorsrc_get_and_clear(NRF_UARTE_Type *p_reg)
+{
+    uint32_t errors = p_reg->ERRORSRC;
+    p_reg->ERRORSRC = errors;
+    return errors;
+}
+
+static inline void nrf_uarte_enable(NRF_UARTE_Type *p_reg)
+{
+    p_reg->ENABLE = UARTE_ENABLE_ENABLE_Enabled;
+}
+
+static inline void nrf_uarte_disable(NRF_UARTE_Type *p_reg)
+{
+    p_reg->ENABLE = 0;
+}
+
+static inline void nrf_uarte_txrx_pins_set(NRF_UARTE_Type *p_reg, uint32_t pseltxd, uint32_t pselrxd)
+{
+    p_reg->PSEL.TXD = pseltxd;
+    p_reg->PSEL.RXD = pselrxd;
+}
+
+static inline void nrf_uarte_txrx_pins_disconnect(NRF_UARTE_Type *p_reg)
+{
+    nrf_uarte_txrx_pins_set(p_reg, NRF_UARTE_PSEL_DISCONNECTED, NRF_UARTE_PSEL_DISCONNECTED);
+}
+
+static inline void nrf_uarte_hwfc_pins_set(NRF_UARTE_Type *p_reg, uint32_t pselrts, uint32_t pselcts)
+{
+    p_reg->PSEL.RTS = pselrts;
+    p_reg->PSEL.CTS = pselcts;
+}
+
+static inline void nrf_uarte_hwfc_pins_disconnect(NRF_UARTE_Type *p_reg)
+{
+    nrf_uarte_hwfc_pins_set(p_reg, NRF_UARTE_PSEL_DISCONNECTED, NRF_UARTE_PSEL_DISCONNECTED);
+}
+
+static inline void nrf_uarte_configure(NRF_UARTE_Type *p_reg, nrf_uarte_config_t const *p_cfg)
+{
+    p_reg->CONFIG = (uint32_t)p_cfg->parity | (uint32_t)p_cfg->hwfc | (uint32_t)p_cfg->stop | (uint32_t)p_cfg->paritytype;
+}
+
+static inline void nrf_uarte_baudrate_set(NRF_UARTE_Type *p_reg, uint32_t baudrate)
+{
+    p_reg->BAUDRATE = baudrate;
+}
+
+static inline void nrf_uarte_tx_buffer_set(NRF_UARTE_Type *p_reg, uint8_t const *p_buffer, size_t length)
+{
+    p_reg->TXD.PTR = (uint32_t)(uintptr_t)p_buffer;
+    p_reg->TXD.MAXCNT = length;
+}
+
+static inline uint32_t nrf_uarte_tx_amount_get(NRF_UARTE_Type const *p_reg)
+{
+    return p_reg->TXD.AMOUNT;
+}
+
+static inline void nrf_uarte_rx_buffer_set(NRF_UARTE_Type *p_reg, uint8_t *p_buffer, size_t length)
+{
+    p_reg->RXD.PTR = (uint32_t)(uintptr_t)p_buffer;
+    p_reg->RXD.MAXCNT = length;
+}
+
+static inline uint32_t nrf_uarte_rx_amount_get(NRF_UARTE_Type const *p_reg)
+{
+    return p_reg->RXD.AMOUNT;
+}
+
+// EasyDMA only reaches RAM. The simulated RAM is mapped at 0x20000000 on the host too, see device_ram.h.
+static inline bool nrfx_is_in_ram(void const *p_object)
+{
+    return ((uintptr_t)p_object & ~(uintptr_t)0x1FFFFFFF) == 0x20000000;
+}
+
+#endif // IMQOPEN_HOST_NRF_UARTE_H
@@ -0,0 +1,285 @@
+#ifndef IMQOPEN_HOST_NRF_H
+#define IMQOPEN_HOST_NRF_H
+
+// nRF52833 peripherals as seen by the driver on the host. The register blocks have their
+// real layout and live at their real addresses, see sim.cpp, and every access goes through
+// the simulator, which applies its side effects and charges its bus cycles.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdlib.h>
+
+#define __I volatile const
+#define __O volatile
+#define __IM volatile const
+#define __OM volatile
+#define __IOM volatile
+
+/**
+ * A 32-bit peripheral register. Reads and writes are handed to the simulator.
+ **/
+struct NrfRegister
+{
+    uint32_t value;
+
+    operator uint32_t() const volatile;
+    void operator=(uint32_t v) volatile;
+
+    void operator|=(uint32_t v) volatile
+    {
+        *this = (uint32_t) * this | v;
+    }
+
+    void operator&=(uint32_t v) volatile
+    {
+        *this = (uint32_t) * this & v;
+    }
+};
+
+typedef enum
+{
+    UARTE0_UART0_IRQn = 2,
+    GPIOTE_IRQn = 6,
+    TIMER0_IRQn = 8,
+    TIMER1_IRQn = 9,
+    TIMER2_IRQn = 10,
+    TIMER3_IRQn = 26,
+    TIMER4_IRQn = 27,
+    UARTE1_IRQn = 40,
+} IRQn_Type;
+
+void NVIC_SetPriority(IRQn_Type IRQn, uint32_t priority);
+void NVIC_ClearPendingIRQ(IRQn_Type IRQn);
+void NVIC_SetPendingIRQ(IRQn_Type IRQn);
+void NVIC_EnableIRQ(IRQn_Type IRQn);
+void NVIC_DisableIRQ(IRQn_Type IRQn);
+uint32_t NVIC_GetEnableIRQ(IRQn_Type IRQn);
+uint32_t __get_IPSR(void);
+
+typedef struct
+{
+    __OM NrfRegister TASKS_STARTRX; // 0x000
+    __OM NrfRegister TASKS_STOPRX;
+    __OM NrfRegister TASKS_STARTTX;
+    __OM NrfRegister TASKS_STOPTX;
+    __IM uint32_t RESERVED0[7];
+    __OM NrfRegister TASKS_FLUSHRX; // 0x02C
+    __IM uint32_t RESERVED1[52];
+    __IOM NrfRegister EVENTS_CTS; // 0x100
+    __IOM NrfRegister EVENTS_NCTS;
+    __IOM NrfRegister EVENTS_RXDRDY;
+    __IM uint32_t RESERVED2;
+    __IOM NrfRegister EVENTS_ENDRX; // 0x110
+    __IM uint32_t RESERVED3[2];
+    __IOM NrfRegister EVENTS_TXDRDY; // 0x11C
+    __IOM NrfRegister EVENTS_ENDTX;
+    __IOM NrfRegister EVENTS_ERROR;
+    __IM uint32_t RESERVED4[7];
+    __IOM NrfRegister EVENTS_RXTO; // 0x144
+    __IM uint32_t RESERVED5;
+    __IOM NrfRegister EVENTS_RXSTARTED; // 0x14C
+    __IOM NrfRegister EVENTS_TXSTARTED;
+    __IM uint32_t RESERVED6;
+    __IOM NrfRegister EVENTS_TXSTOPPED; // 0x158
+    __IM uint32_t RESERVED7[41];
+    __IOM NrfRegister SHORTS; // 0x200
+    __IM uint32_t RESERVED8[63];
+    __IOM NrfRegister INTEN; // 0x300
+    __IOM NrfRegister INTENSET;
+    __IOM NrfRegister INTENCLR;
+    __IM uint32_t RESERVED9[93];
+    __IOM NrfRegister ERRORSRC; // 0x480
+    __IM uint32_t RESERVED10[31];
+    __IOM NrfRegister ENABLE; // 0x500
+    __IM uint32_t RESERVED11;
+    struct
+    {
+        __IOM NrfRegister RTS; // 0x508
+        __IOM NrfRegister TXD;
+        __IOM NrfRegister CTS;
+        __IOM NrfRegister RXD;
+    } PSEL;
+    __IM uint32_t RESERVED12[3];
+    __IOM NrfRegister BAUDRATE; // 0x524
+    __IM uint32_t RESERVED13[3];
+    struct
+    {
+        __IOM NrfRegister PTR; // 0x534
+        __IOM NrfRegister MAXCNT;
+        __IM NrfRegister AMOUNT;
+    } RXD;
+    __IM uint32_t RESERVED14;
+    struct
+    {
+        __IOM NrfRegister PTR; // 0x544
+        __IOM NrfRegister MAXCNT;
+        __IM NrfRegister AMOUNT;
+    } TXD;
+    __IM uint32_t RESERVED15[7];
+    __IOM NrfRegister CONFIG; // 0x56C
+} NRF_UARTE_Type;
+
+typedef struct
+{
+    __OM NrfRegister TASKS_START; // 0x000
+    __OM NrfRegister TASKS_STOP;
+    __OM NrfRegister TASKS_COUNT;
+    __OM NrfRegister TASKS_CLEAR;
+    __OM NrfRegister TASKS_SHUTDOWN;
+    __IM uint32_t RESERVED0[11];
+    __OM NrfRegister TASKS_CAPTURE[6]; // 0x040
+    __IM uint32_t RESERVED1[58];
+    __IOM NrfRegister EVENTS_COMPARE[6]; // 0x140
+    __IM uint32_t RESERVED2[42];
+    __IOM NrfRegister SHORTS; // 0x200
+    __IM uint32_t RESERVED3[64];
+    __IOM NrfRegister INTENSET; // 0x304
+    __IOM NrfRegister INTENCLR;
+    __IM uint32_t RESERVED4[126];
+    __IOM NrfRegister MODE; // 0x504
+    __IOM NrfRegister BITMODE;
+    __IM uint32_t RESERVED5;
+    __IOM NrfRegister PRESCALER; // 0x510
+    __IM uint32_t RESERVED6[11];
+    __IOM NrfRegister CC[6]; // 0x540
+} NRF_TIMER_Type;
+
+typedef struct
+{
+    __OM NrfRegister EN;
+    __OM NrfRegister DIS;
+} PPI_TASKS_CHG_Type;
+
+typedef struct
+{
+    __IOM NrfRegister EEP;
+    __IOM NrfRegister TEP;
+} PPI_CH_Type;
+
+typedef struct
+{
+    __IOM NrfRegister TEP;
+} PPI_FORK_Type;
+
+typedef struct
+{
+    PPI_TASKS_CHG_Type TASKS_CHG[6]; // 0x000
+    __IM uint32_t RESERVED0[308];
+    __IOM NrfRegister CHEN; // 0x500
+    __IOM NrfRegister CHENSET;
+    __IOM NrfRegister CHENCLR;
+    __IM uint32_t RESERVED1;
+    PPI_CH_Type CH[20]; // 0x510
+    __IM uint32_t RESERVED2[148];
+    __IOM NrfRegister CHG[6]; // 0x800
+    __IM uint32_t RESERVED3[62];
+    PPI_FORK_Type FORK[32]; // 0x910
+} NRF_PPI_Type;
+
+typedef struct
+{
+    __OM NrfRegister TASKS_OUT[8]; // 0x000
+    __IM uint32_t RESERVED0[4];
+    __OM NrfRegister TASKS_SET[8]; // 0x030
+    __IM uint32_t RESERVED1[4];
+    __OM NrfRegister TASKS_CLR[8]; // 0x060
+    __IM uint32_t RESERVED2[32];
+    __IOM NrfRegister EVENTS_IN[8]; // 0x100
+    __IM uint32_t RESERVED3[23];
+    __IOM NrfRegister EVENTS_PORT; // 0x17C
+    __IM uint32_t RESERVED4[97];
+    __IOM NrfRegister INTENSET; // 0x304
+    __IOM NrfRegister INTENCLR;
+    __IM uint32_t RESERVED5[129];
+    __IOM NrfRegister CONFIG[8]; // 0x510
+} NRF_GPIOTE_Type;
+
+typedef struct
+{
+    __IM uint32_t RESERVED0[321];
+    __IOM NrfRegister OUT; // 0x504
+    __IOM NrfRegister OUTSET;
+    __IOM NrfRegister OUTCLR;
+    __IM NrfRegister IN;
+    __IOM NrfRegister DIR;
+} NRF_GPIO_Type;
+
+typedef struct
+{
+    __IOM NrfRegister CTRL; // 0x000
+    __IOM NrfRegister CYCCNT;
+} DWT_Type;
+
+typedef struct
+{
+    __IOM NrfRegister DHCSR; // 0x000
+    __OM NrfRegister DCRSR;
+    __IOM NrfRegister DCRDR;
+    __IOM NrfRegister DEMCR;
+} CoreDebug_Type;
+
+#define NRF_UARTE0_BASE 0x40002000UL
+#define NRF_GPIOTE_BASE 0x40006000UL
+#define NRF_TIMER0_BASE 0x40008000UL
+#define NRF_TIMER1_BASE 0x40009000UL
+#define NRF_TIMER2_BASE 0x4000A000UL
+#define NRF_TIMER3_BASE 0x4001A000UL
+#define NRF_TIMER4_BASE 0x4001B000UL
+#define NRF_PPI_BASE 0x4001F000UL
+#define NRF_UARTE1_BASE 0x40028000UL
+#define NRF_P0_BASE 0x50000000UL
+#define NRF_P1_BASE 0x50000300UL
+#define DWT_BASE 0xE0001000UL
+#define CoreDebug_BASE 0xE000EDF0UL
+
+#define NRF_UARTE0 ((NRF_UARTE_Type *)NRF_UARTE0_BASE)
+#define NRF_UARTE1 ((NRF_UARTE_Type *)NRF_UARTE1_BASE)
+#define NRF_GPIOTE ((NRF_GPIOTE_Type *)NRF_GPIOTE_BASE)
+#define NRF_TIMER0 ((NRF_TIMER_Type *)NRF_TIMER0_BASE)
+#define NRF_TIMER1 ((NRF_TIMER_Type *)NRF_TIMER1_BASE)
+#define NRF_TIMER2 ((NRF_TIMER_Type *)NRF_TIMER2_BASE)
+#define NRF_TIMER3 ((NRF_TIMER_Type *)NRF_TIMER3_BASE)
+#define NRF_TIMER4 ((NRF_TIMER_Type *)NRF_TIMER4_BASE)
+#define NRF_PPI ((NRF_PPI_Type *)NRF_PPI_BASE)
+#define NRF_P0 ((NRF_GPIO_Type *)NRF_P0_BASE)
+#define NRF_P1 ((NRF_GPIO_Type *)NRF_P1_BASE)
+#define DWT ((DWT_Type *)DWT_BASE)
+#define CoreDebug ((CoreDebug_Type *)CoreDebug_BASE)
+
+#define DWT_CTRL_CYCCNTENA_Msk (1UL << 0)
+#define CoreDebug_DEMCR_TRCENA_Msk (1UL << 24)
+
+#define TIMER_SHORTS_COMPARE0_CLEAR_Msk (1UL << 0)
+#define TIMER_SHORTS_COMPARE0_STOP_Msk (1UL << 8)
+#define TIMER_MODE_MODE_Timer 0
+#define TIMER_MODE_MODE_Counter 1
+#define TIMER_MODE_MODE_LowPowerCounter 2
+#define TIMER_BITMODE_BITMODE_16Bit 0
+#define TIMER_BITMODE_BITMODE_08Bit 1
+#define TIMER_BITMODE_BITMODE_24Bit 2
+#define TIMER_BITMODE_BITMODE_32Bit 3
+#define TIMER_INTENSET_COMPARE0_Msk (1UL << 16)
+
+#define GPIOTE_CONFIG_MODE_Pos 0
+#define GPIOTE_CONFIG_MODE_Msk (3UL << GPIOTE_CONFIG_MODE_Pos)
+#define GPIOTE_CONFIG_MODE_Disabled 0
+#define GPIOTE_CONFIG_MODE_Event 1
+#define GPIOTE_CONFIG_MODE_Task 3
+#define GPIOTE_CONFIG_PSEL_Pos 8
+#define GPIOTE_CONFIG_PORT_Pos 13
+#define GPIOTE_CONFIG_POLARITY_Pos 16
+#define GPIOTE_CONFIG_POLARITY_LoToHi 1
+#define GPIOTE_CONFIG_POLARITY_HiToLo 2
+#define GPIOTE_CONFIG_POLARITY_Toggle 3
+#define GPIOTE_CONFIG_OUTINIT_Pos 20
+#define GPIOTE_CONFIG_OUTINIT_Low 0
+#define GPIOTE_CONFIG_OUTINIT_High 1
+
+#define UARTE_ENABLE_ENABLE_Enabled 8
+#define UARTE_CONFIG_HWFC_Msk (1UL << 0)
+#define UARTE_CONFIG_PARITY_Msk (7UL << 1)
+#define UARTE_CONFIG_STOP_Msk (1UL << 4)
+#define UARTE_CONFIG_PARITYTYPE_Msk (1UL << 8)
+
+#endif // IMQOPEN_HOST_NRF_H
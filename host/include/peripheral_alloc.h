@@ -0,0 +1,18 @@
+#ifndef PERIPHERAL_ALLOC_H
+#define PERIPHERAL_ALLOC_H
+
+#include "nrf.h"
+
+#define PERI_MODE_SPIM 1
+#define PERI_MODE_SPIS 2
+#define PERI_MODE_TWIM 4
+#define PERI_MODE_TWIS 8
+#define PERI_MODE_UARTE 16
+
+void *allocate_peripheral(int mode);
+void *allocate_peripheral(void *device);
+void set_alloc_peri_irq(void *device, void (*fn)(void *), void *userdata);
+IRQn_Type get_alloc_peri_irqn(void *device);
+void free_alloc_peri(void *device);
+
+#endif
@@ -0,0 +1,670 @@
+#include "peripherals.h"
+
+#define UARTE_REG(member) offsetof(NRF_UARTE_Type, member)
+#define TIMER_REG(member) offsetof(NRF_TIMER_Type, member)
+#define PPI_REG(member) offsetof(NRF_PPI_Type, member)
+#define TIMER_CC(n) (TIMER_REG(CC[0]) + 4 * (n))
+#define TIMER_COMPARE(n) (TIMER_REG(EVENTS_COMPARE[0]) + 4 * (n))
+#define PPI_EEP(ch) (PPI_REG(CH[0].EEP) + 8 * (ch))
+#define PPI_TEP(ch) (PPI_REG(CH[0].TEP) + 8 * (ch))
+#define PPI_FORK(ch) (PPI_REG(FORK[0].TEP) + 4 * (ch))
+
+// Offset of INTEN, which the TIMER only exposes through INTENSET and INTENCLR
+#define TIMER_INTEN 0x300
+
+// Time from STOPRX to RXTO when no byte is on its way
+#define SIM_UARTE_RXTO_US 2
+
+namespace sim
+{
+    namespace
+    {
+        Uarte *uartes_[2];
+        Timer *timers_[5];
+        Ppi *ppi_;
+        WireCounters wire_;
+
+        uint8_t *ram(uint32_t address)
+        {
+            return (uint8_t *)(uintptr_t)address;
+        }
+    }
+
+    Uarte::Uarte(uintptr_t base, IRQn_Type irqn)
+        : Peripheral(base, 0x1000), irqn_(irqn), rxRunning_(false), rxActive_(false), rxLatched_(false), rxPtrWritten_(false),
+          rxPtr_(0), rxMax_(0), rxCount_(0), rxGen_(0), txActive_(false), txStopping_(false), txPtr_(0), txMax_(0),
+          txCount_(0), txGen_(0)
+    {
+        resetCounters();
+    }
+
+    cycles_t Uarte::byteCycles()
+    {
+        uint32_t config = reg(UARTE_REG(CONFIG)).value;
+        uint32_t baudrate = reg(UARTE_REG(BAUDRATE)).value;
+        uint64_t bits = 10 + ((config & UARTE_CONFIG_STOP_Msk) ? 1 : 0) + ((config & UARTE_CONFIG_PARITY_Msk) ? 1 : 0);
+
+        // The baud rate generator divides 16 MHz by 2^32 / BAUDRATE, four CPU cycles per tick.
+        if (baudrate < 0x1000)
+            baudrate = 0x1000;
+        return ((bits << 34) + baudrate / 2) / baudrate;
+    }
+
+    void Uarte::resetCounters()
+    {
+        counters.rxIgnored = 0;
+        counters.rxOverruns = 0;
+        counters.rearmMisses = 0;
+        counters.txBusyStarts = 0;
+        counters.dmaFaults = 0;
+        counters.rxDmaHeadroom = ~(cycles_t)0;
+    }
+
+    void Uarte::raise(nrf_uarte_event_t event)
+    {
+        reg(event).value = 1;
+        updateIrq();
+        eventRaised(base + event);
+    }
+
+    void Uarte::updateIrq()
+    {
+        uint32_t inten = reg(UARTE_REG(INTEN)).value;
+        bool level = false;
+
+        for (int n = 0; n < 32 && !level; n++)
+            level = (inten & (1UL << n)) && reg(0x100 + 4 * n).value;
+
+        irqLevel(irqn_, level);
+    }
+
+    void Uarte::receive(uint8_t c, bool framingError)
+    {
+        if (reg(UARTE_REG(ENABLE)).value != UARTE_ENABLE_ENABLE_Enabled || !rxRunning_)
+        {
+            counters.rxIgnored++;
+            return;
+        }
+
+        if (framingError)
+        {
+            reg(UARTE_REG(ERRORSRC)).value |= NRF_UARTE_ERROR_FRAMING_MASK;
+            raise(NRF_UARTE_EVENT_ERROR);
+        }
+
+        if (!rxActive_ && rxFifo_.size() >= SIM_UARTE_RX_FIFO)
+        {
+            counters.rxOverruns++;
+            reg(UARTE_REG(ERRORSRC)).value |= NRF_UARTE_ERROR_OVERRUN_MASK;
+            raise(NRF_UARTE_EVENT_ERROR);
+            return;
+        }
+
+        // RXDRDY tells the byte is in the FIFO, EasyDMA moves it to RAM right after.
+        raise(NRF_UARTE_EVENT_RXDRDY);
+        if (rxActive_)
+            storeRxByte(c);
+        else
+            rxFifo_.push_back(c);
+    }
+
+    void Uarte::storeRxByte(uint8_t c)
+    {
+        if (inRam(rxPtr_ + rxCount_, 1))
+            *ram(rxPtr_ + rxCount_) = c;
+        else
+            counters.dmaFaults++;
+
+        if (++rxCount_ >= rxMax_)
+            endRx();
+    }
+
+    void Uarte::startRx()
+    {
+        if (rxActive_)
+            return;
+
+        // Without a new RXD.PTR, the transfer overwrites the buffer that just ended.
+        if (rxLatched_ && !rxPtrWritten_)
+            counters.rearmMisses++;
+
+        rxPtr_ = reg(UARTE_REG(RXD.PTR)).value;
+        rxMax_ = reg(UARTE_REG(RXD.MAXCNT)).value & 0xFFFF;
+        rxCount_ = 0;
+        rxActive_ = true;
+        rxRunning_ = true;
+        rxLatched_ = true;
+        rxPtrWritten_ = false;
+        rxGen_++;
+
+        if (!inRam(rxPtr_, rxMax_))
+            counters.dmaFaults++;
+
+        raise(NRF_UARTE_EVENT_RXSTARTED);
+
+        if (rxMax_ == 0)
+        {
+            endRx();
+            return;
+        }
+
+        while (rxActive_ && !rxFifo_.empty())
+        {
+            uint8_t c = rxFifo_.front();
+            rxFifo_.pop_front();
+            storeRxByte(c);
+        }
+    }
+
+    void Uarte::endRx()
+    {
+        reg(UARTE_REG(RXD.AMOUNT)).value = rxCount_;
+        rxActive_ = false;
+        raise(NRF_UARTE_EVENT_ENDRX);
+
+        uint32_t shorts = reg(UARTE_REG(SHORTS)).value;
+        if (shorts & NRF_UARTE_SHORT_ENDRX_STOPRX)
+            stopRx();
+        else if (rxRunning_ && (shorts & NRF_UARTE_SHORT_ENDRX_STARTRX))
+            startRx();
+    }
+
+    void Uarte::stopRx()
+    {
+        if (!rxRunning_)
+            return;
+
+        rxRunning_ = false;
+        uint32_t gen = ++rxGen_;
+        at(now() + us(SIM_UARTE_RXTO_US), [this, gen]() {
+            if (gen != rxGen_)
+                return;
+            if (rxActive_)
+                endRx();
+            raise(NRF_UARTE_EVENT_RXTO);
+        });
+    }
+
+    void Uarte::flushRx()
+    {
+        if (rxActive_)
+            return;
+
+        rxPtr_ = reg(UARTE_REG(RXD.PTR)).value;
+        rxMax_ = reg(UARTE_REG(RXD.MAXCNT)).value & 0xFFFF;
+        rxCount_ = 0;
+        while (rxCount_ < rxMax_ && !rxFifo_.empty())
+        {
+            if (inRam(rxPtr_ + rxCount_, 1))
+                *ram(rxPtr_ + rxCount_) = rxFifo_.front();
+            else
+                counters.dmaFaults++;
+            rxFifo_.pop_front();
+            rxCount_++;
+        }
+        reg(UARTE_REG(RXD.AMOUNT)).value = rxCount_;
+        raise(NRF_UARTE_EVENT_ENDRX);
+    }
+
+    void Uarte::startTx()
+    {
+        if (txActive_)
+        {
+            counters.txBusyStarts++;
+            return;
+        }
+
+        txPtr_ = reg(UARTE_REG(TXD.PTR)).value;
+        txMax_ = reg(UARTE_REG(TXD.MAXCNT)).value & 0xFFFF;
+        txCount_ = 0;
+        txActive_ = true;
+
+        if (!inRam(txPtr_, txMax_))
+            counters.dmaFaults++;
+
+        raise(NRF_UARTE_EVENT_TXSTARTED);
+
+        if (txMax_ == 0)
+        {
+            txActive_ = false;
+            reg(UARTE_REG(TXD.AMOUNT)).value = 0;
+            raise(NRF_UARTE_EVENT_ENDTX);
+            return;
+        }
+
+        startTxByte();
+    }
+
+    void Uarte::startTxByte()
+    {
+        // EasyDMA reads each byte when the transmitter takes it.
+        uint8_t c = 0;
+        if (inRam(txPtr_ + txCount_, 1))
+            c = *ram(txPtr_ + txCount_);
+
+        uint32_t gen = txGen_;
+        at(now() + byteCycles(), [this, gen, c]() {
+            if (gen == txGen_)
+                endTxByte(c);
+        });
+    }
+
+    void Uarte::endTxByte(uint8_t c)
+    {
+        txCount_++;
+        if (txWire)
+            txWire(c);
+        raise(NRF_UARTE_EVENT_TXDRDY);
+
+        if (txCount_ < txMax_ && !txStopping_)
+        {
+            startTxByte();
+            return;
+        }
+
+        bool stopping = txStopping_;
+        txStopping_ = false;
+        txActive_ = false;
+        reg(UARTE_REG(TXD.AMOUNT)).value = txCount_;
+        raise(NRF_UARTE_EVENT_ENDTX);
+        if (stopping)
+            raise(NRF_UARTE_EVENT_TXSTOPPED);
+    }
+
+    void Uarte::stopTx()
+    {
+        // A byte being sent is finished first.
+        if (txActive_)
+            txStopping_ = true;
+        else
+            raise(NRF_UARTE_EVENT_TXSTOPPED);
+    }
+
+    void Uarte::disable()
+    {
+        rxGen_++;
+        txGen_++;
+        rxRunning_ = false;
+        rxActive_ = false;
+        rxLatched_ = false;
+        rxFifo_.clear();
+        txActive_ = false;
+        txStopping_ = false;
+    }
+
+    uint32_t Uarte::read(uint32_t offset)
+    {
+        if (offset == UARTE_REG(INTENSET) || offset == UARTE_REG(INTENCLR))
+            return reg(UARTE_REG(INTEN)).value;
+        return Peripheral::read(offset);
+    }
+
+    void Uarte::write(uint32_t offset, uint32_t value)
+    {
+        bool enabled = reg(UARTE_REG(ENABLE)).value == UARTE_ENABLE_ENABLE_Enabled;
+
+        if (offset < 0x100)
+        {
+            if (!value || !enabled)
+                return;
+
+            switch (offset)
+            {
+            case NRF_UARTE_TASK_STARTRX:
+                startRx();
+                break;
+            case NRF_UARTE_TASK_STOPRX:
+                stopRx();
+                break;
+            case NRF_UARTE_TASK_STARTTX:
+                startTx();
+                break;
+            case NRF_UARTE_TASK_STOPTX:
+                stopTx();
+                break;
+            case NRF_UARTE_TASK_FLUSHRX:
+                flushRx();
+                break;
+            }
+            return;
+        }
+
+        if (offset < 0x200)
+        {
+            reg(offset).value = value;
+            updateIrq();
+            return;
+        }
+
+        switch (offset)
+        {
+        case UARTE_REG(INTEN):
+            reg(UARTE_REG(INTEN)).value = value;
+            updateIrq();
+            break;
+        case UARTE_REG(INTENSET):
+            reg(UARTE_REG(INTEN)).value |= value;
+            updateIrq();
+            break;
+        case UARTE_REG(INTENCLR):
+            reg(UARTE_REG(INTEN)).value &= ~value;
+            updateIrq();
+            break;
+        case UARTE_REG(ERRORSRC):
+            reg(offset).value &= ~value;
+            break;
+        case UARTE_REG(RXD.AMOUNT):
+        case UARTE_REG(TXD.AMOUNT):
+            break;
+        case UARTE_REG(RXD.PTR):
+            reg(offset).value = value;
+            rxPtrWritten_ = true;
+            if (rxActive_)
+            {
+                cycles_t headroom = (rxMax_ - rxCount_) * byteCycles();
+                if (headroom < counters.rxDmaHeadroom)
+                    counters.rxDmaHeadroom = headroom;
+            }
+            break;
+        case UARTE_REG(ENABLE):
+            reg(offset).value = value;
+            if (value != UARTE_ENABLE_ENABLE_Enabled)
+                disable();
+            break;
+        default:
+            reg(offset).value = value;
+            break;
+        }
+    }
+
+    Timer::Timer(uintptr_t base, IRQn_Type irqn)
+        : Peripheral(base, 0x1000), irqn_(irqn), running_(false), counter_(0), base_(0), gen_(0)
+    {
+    }
+
+    uint32_t Timer::mask()
+    {
+        switch (reg(TIMER_REG(BITMODE)).value & 3)
+        {
+        case TIMER_BITMODE_BITMODE_08Bit:
+            return 0xFF;
+        case TIMER_BITMODE_BITMODE_24Bit:
+            return 0xFFFFFF;
+        case TIMER_BITMODE_BITMODE_32Bit:
+            return 0xFFFFFFFF;
+        default:
+            return 0xFFFF;
+        }
+    }
+
+    bool Timer::isTimer()
+    {
+        return (reg(TIMER_REG(MODE)).value & 3) == TIMER_MODE_MODE_Timer;
+    }
+
+    cycles_t Timer::tickCycles()
+    {
+        uint32_t prescaler = reg(TIMER_REG(PRESCALER)).value & 0xF;
+        return (cycles_t)4 << (prescaler > 9 ? 9 : prescaler);
+    }
+
+    void Timer::sync()
+    {
+        if (!running_ || !isTimer())
+            return;
+
+        cycles_t ticks = (now() - base_) / tickCycles();
+        counter_ = (uint32_t)(counter_ + ticks) & mask();
+        base_ += ticks * tickCycles();
+    }
+
+    void Timer::schedule()
+    {
+        uint32_t gen = ++gen_;
+
+        if (!running_ || !isTimer())
+            return;
+
+        for (int n = 0; n < 6; n++)
+        {
+            uint64_t ticks = (reg(TIMER_CC(n)).value - counter_) & mask();
+            if (ticks == 0)
+                ticks = (uint64_t)mask() + 1;
+
+            at(base_ + ticks * tickCycles(), [this, gen, n]() {
+                if (gen != gen_)
+                    return;
+                sync();
+                compare(n);
+                schedule();
+            });
+        }
+    }
+
+    void Timer::compare(int n)
+    {
+        reg(TIMER_COMPARE(n)).value = 1;
+        updateIrq();
+        eventRaised(base + TIMER_COMPARE(n));
+
+        uint32_t shorts = reg(TIMER_REG(SHORTS)).value;
+        if (shorts & (TIMER_SHORTS_COMPARE0_CLEAR_Msk << n))
+        {
+            counter_ = 0;
+            base_ = now();
+        }
+        if (shorts & (TIMER_SHORTS_COMPARE0_STOP_Msk << n))
+            running_ = false;
+    }
+
+    void Timer::updateIrq()
+    {
+        uint32_t inten = reg(TIMER_INTEN).value;
+        bool level = false;
+
+        for (int n = 0; n < 6 && !level; n++)
+            level = (inten & (TIMER_INTENSET_COMPARE0_Msk << n)) && reg(TIMER_COMPARE(n)).value;
+
+        irqLevel(irqn_, level);
+    }
+
+    uint32_t Timer::read(uint32_t offset)
+    {
+        if (offset == TIMER_REG(INTENSET) || offset == TIMER_REG(INTENCLR))
+            return reg(TIMER_INTEN).value;
+        return Peripheral::read(offset);
+    }
+
+    void Timer::write(uint32_t offset, uint32_t value)
+    {
+        if (offset < 0x100)
+        {
+            if (!value)
+                return;
+
+            sync();
+            if (offset == TIMER_REG(TASKS_START))
+            {
+                if (!running_)
+                    base_ = now();
+                running_ = true;
+            }
+            else if (offset == TIMER_REG(TASKS_STOP))
+            {
+                running_ = false;
+            }
+            else if (offset == TIMER_REG(TASKS_COUNT))
+            {
+                if (running_ && !isTimer())
+                {
+                    counter_ = (counter_ + 1) & mask();
+                    for (int n = 0; n < 6; n++)
+                        if (reg(TIMER_CC(n)).value == counter_)
+                            compare(n);
+                }
+            }
+            else if (offset == TIMER_REG(TASKS_CLEAR))
+            {
+                counter_ = 0;
+                base_ = now();
+            }
+            else if (offset == TIMER_REG(TASKS_SHUTDOWN))
+            {
+                running_ = false;
+                counter_ = 0;
+            }
+            else if (offset >= TIMER_REG(TASKS_CAPTURE[0]) && offset <= TIMER_REG(TASKS_CAPTURE[5]))
+            {
+                reg(TIMER_REG(CC[0]) + offset - TIMER_REG(TASKS_CAPTURE[0])).value = counter_;
+            }
+            schedule();
+            return;
+        }
+
+        if (offset < 0x200)
+        {
+            reg(offset).value = value;
+            updateIrq();
+            return;
+        }
+
+        switch (offset)
+        {
+        case TIMER_REG(INTENSET):
+            reg(TIMER_INTEN).value |= value;
+            updateIrq();
+            break;
+        case TIMER_REG(INTENCLR):
+            reg(TIMER_INTEN).value &= ~value;
+            updateIrq();
+            break;
+        default:
+            sync();
+            reg(offset).value = value;
+            schedule();
+            break;
+        }
+    }
+
+    Ppi::Ppi() : Peripheral(NRF_PPI_BASE, 0x1000)
+    {
+    }
+
+    void Ppi::event(uint32_t address)
+    {
+        uint32_t chen = reg(PPI_REG(CHEN)).value;
+        uint32_t tasks[40];
+        int count = 0;
+
+        // All channels see the event before any task runs, a group disabled by a fork included.
+        for (int ch = 0; ch < 20; ch++)
+        {
+            if (!(chen & (1UL << ch)) || reg(PPI_EEP(ch)).value != address)
+                continue;
+
+            uint32_t tep = reg(PPI_TEP(ch)).value;
+            uint32_t fork = reg(PPI_FORK(ch)).value;
+            if (tep != 0)
+                tasks[count++] = tep;
+            if (fork != 0)
+                tasks[count++] = fork;
+        }
+
+        for (int i = 0; i < count; i++)
+            poke(tasks[i], 1);
+    }
+
+    uint32_t Ppi::read(uint32_t offset)
+    {
+        if (offset == PPI_REG(CHENSET) || offset == PPI_REG(CHENCLR))
+            return reg(PPI_REG(CHEN)).value;
+        return Peripheral::read(offset);
+    }
+
+    void Ppi::write(uint32_t offset, uint32_t value)
+    {
+        if (offset < PPI_REG(TASKS_CHG[6]))
+        {
+            if (!value)
+                return;
+
+            uint32_t group = reg(PPI_REG(CHG[0]) + 4 * (offset / 8)).value;
+            if (offset % 8 == 0)
+                reg(PPI_REG(CHEN)).value |= group;
+            else
+                reg(PPI_REG(CHEN)).value &= ~group;
+            return;
+        }
+
+        switch (offset)
+        {
+        case PPI_REG(CHENSET):
+            reg(PPI_REG(CHEN)).value |= value;
+            break;
+        case PPI_REG(CHENCLR):
+            reg(PPI_REG(CHEN)).value &= ~value;
+            break;
+        default:
+            reg(offset).value = value;
+            break;
+        }
+    }
+
+    void eventRaised(uint32_t address)
+    {
+        if (ppi_ != NULL)
+            ppi_->event(address);
+    }
+
+    void initPeripherals()
+    {
+        uartes_[0] = new Uarte(NRF_UARTE0_BASE, UARTE0_UART0_IRQn);
+        uartes_[1] = new Uarte(NRF_UARTE1_BASE, UARTE1_IRQn);
+        timers_[0] = new Timer(NRF_TIMER0_BASE, TIMER0_IRQn);
+        timers_[1] = new Timer(NRF_TIMER1_BASE, TIMER1_IRQn);
+        timers_[2] = new Timer(NRF_TIMER2_BASE, TIMER2_IRQn);
+        timers_[3] = new Timer(NRF_TIMER3_BASE, TIMER3_IRQn);
+        timers_[4] = new Timer(NRF_TIMER4_BASE, TIMER4_IRQn);
+        ppi_ = new Ppi();
+    }
+
+    Uarte *uarte(int n)
+    {
+        return uartes_[n];
+    }
+
+    Timer *timer(int n)
+    {
+        return timers_[n];
+    }
+
+    void loopback(Uarte *uarte)
+    {
+        uarte->txWire = [uarte](uint8_t c) {
+            bool framingError = false;
+
+            if (faults().lineErrorPpm > 0 && random() % 1000000 < faults().lineErrorPpm)
+            {
+                // Noise on one of the eight data bits or on the stop bit
+                int bit = random() % 9;
+                if (bit < 8)
+                {
+                    c ^= 1 << bit;
+                    wire_.corrupted++;
+                }
+                else
+                {
+                    framingError = true;
+                    wire_.framing++;
+                }
+            }
+
+            uarte->receive(c, framingError);
+        };
+    }
+
+    WireCounters &wireCounters()
+    {
+        return wire_;
+    }
+}
@@ -0,0 +1,154 @@
+#ifndef IMQOPEN_HOST_PERIPHERALS_H
+#define IMQOPEN_HOST_PERIPHERALS_H
+
+// Models of the UARTE, TIMER and PPI peripherals, behind their registers.
+
+#include <deque>
+#include "sim.h"
+#include "hal/nrf_uarte.h"
+
+// Bytes the UARTE receiver holds while no RX DMA transfer is running
+#define SIM_UARTE_RX_FIFO 6
+
+namespace sim
+{
+    /**
+     * What the UARTE model saw the driver do wrong, or nearly so.
+     **/
+    struct UarteCounters
+    {
+        uint32_t rxIgnored;   // bytes arriving while the receiver was stopped
+        uint32_t rxOverruns;  // bytes lost with a full FIFO and no RX transfer running
+        uint32_t rearmMisses; // RX transfers restarted by the ENDRX_STARTRX short without a new RXD.PTR
+        uint32_t txBusyStarts;
+        uint32_t dmaFaults;     // transfers pointing outside RAM
+        cycles_t rxDmaHeadroom; // least time left in the running RX transfer when RXD.PTR was written
+    };
+
+    /**
+     * UARTE with EasyDMA. RXD.PTR and TXD.PTR are latched when a transfer starts, which raises
+     * RXSTARTED or TXSTARTED; bytes are moved to and from RAM one at a time at the line rate, each
+     * received byte raising RXDRDY, and a full transfer raises ENDRX or ENDTX with its AMOUNT.
+     * The ENDRX_STARTRX short latches the next RX transfer at once. Bytes arriving between two RX
+     * transfers wait in the FIFO; once it is full, they are lost with an overrun error.
+     **/
+    class Uarte : public Peripheral
+    {
+        IRQn_Type irqn_;
+
+        bool rxRunning_;
+        bool rxActive_;
+        bool rxLatched_;
+        bool rxPtrWritten_;
+        uint32_t rxPtr_;
+        uint32_t rxMax_;
+        uint32_t rxCount_;
+        uint32_t rxGen_;
+        std::deque<uint8_t> rxFifo_;
+
+        bool txActive_;
+        bool txStopping_;
+        uint32_t txPtr_;
+        uint32_t txMax_;
+        uint32_t txCount_;
+        uint32_t txGen_;
+
+        void raise(nrf_uarte_event_t event);
+        void updateIrq();
+
+        void startRx();
+        void storeRxByte(uint8_t c);
+        void endRx();
+        void stopRx();
+        void flushRx();
+
+        void startTx();
+        void startTxByte();
+        void endTxByte(uint8_t c);
+        void stopTx();
+
+        void disable();
+
+    public:
+        UarteCounters counters;
+
+        // Called with each byte once its stop bit is sent
+        std::function<void(uint8_t c)> txWire;
+
+        Uarte(uintptr_t base, IRQn_Type irqn);
+
+        // A byte whose stop bit just ended on the RX pin
+        void receive(uint8_t c, bool framingError);
+
+        cycles_t byteCycles();
+        void resetCounters();
+
+        virtual uint32_t read(uint32_t offset) override;
+        virtual void write(uint32_t offset, uint32_t value) override;
+    };
+
+    /**
+     * TIMER in timer, counter and low power counter mode, with its compare events and shorts.
+     **/
+    class Timer : public Peripheral
+    {
+        IRQn_Type irqn_;
+        bool running_;
+        uint32_t counter_;
+        cycles_t base_;
+        uint32_t gen_;
+
+        uint32_t mask();
+        bool isTimer();
+        cycles_t tickCycles();
+
+        void sync();
+        void schedule();
+        void compare(int n);
+        void updateIrq();
+
+    public:
+        Timer(uintptr_t base, IRQn_Type irqn);
+
+        IRQn_Type irqn()
+        {
+            return irqn_;
+        }
+
+        virtual uint32_t read(uint32_t offset) override;
+        virtual void write(uint32_t offset, uint32_t value) override;
+    };
+
+    /**
+     * Programmable peripheral interconnect: channels, groups and forks.
+     **/
+    class Ppi : public Peripheral
+    {
+    public:
+        Ppi();
+
+        void event(uint32_t address);
+
+        virtual uint32_t read(uint32_t offset) override;
+        virtual void write(uint32_t offset, uint32_t value) override;
+    };
+
+    /**
+     * Noise injected by loopback(), see Faults::lineErrorPpm.
+     **/
+    struct WireCounters
+    {
+        uint32_t corrupted; // bytes with a data bit flipped, which the UARTE can not notice
+        uint32_t framing;   // bytes with their stop bit flipped, received with a framing error
+    };
+
+    void initPeripherals();
+    Uarte *uarte(int n);
+    Timer *timer(int n);
+
+    // Connects the TX pin of a UARTE to its own RX pin.
+    void loopback(Uarte *uarte);
+    WireCounters &wireCounters();
+}
+
+#endif // IMQOPEN_HOST_PERIPHERALS_H
@@ -0,0 +1,491 @@
+#include "sim.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <queue>
+#include <vector>
+
+// Address ranges mapped at their nRF52833 addresses, so that the driver keeps its 32-bit pointers
+#define SIM_APB_BASE 0x40000000UL
+#define SIM_APB_SIZE 0x30000UL
+#define SIM_AHB_BASE 0x50000000UL
+#define SIM_AHB_SIZE 0x1000UL
+#define SIM_PPB_BASE 0xE0000000UL
+#define SIM_PPB_SIZE 0x10000UL
+
+// Data RAM: the heap, then the stack of the program
+#define SIM_RAM_BASE 0x20000000UL
+#define SIM_HEAP_SIZE 0x100000UL
+#define SIM_STACK_SIZE 0x100000UL
+
+// Cycles of a register access, an interrupt entry and an interrupt return
+#define SIM_ACCESS_CYCLES 4
+#define SIM_ISR_ENTRY_CYCLES 12
+#define SIM_ISR_EXIT_CYCLES 10
+
+// Virtual time after which the simulation is considered stuck in a spin loop
+#define SIM_TIME_LIMIT (600ULL * sim::CPU_HZ)
+
+#define SIM_IRQ_LINES 64
+
+namespace sim
+{
+    namespace
+    {
+        struct Action
+        {
+            cycles_t when;
+            uint64_t seq;
+            std::function<void()> run;
+
+            bool operator<(const Action &other) const
+            {
+                // std::priority_queue pops the largest, so the earliest and then the oldest is largest.
+                return when != other.when ? when > other.when : seq > other.seq;
+            }
+        };
+
+        struct Line
+        {
+            void (*handler)(void *);
+            void *arg;
+            bool enabled;
+            bool pending;
+            bool level;
+            cycles_t readyAt;
+            uint32_t count;
+        };
+
+        cycles_t now_ = 0;
+        uint64_t seq_ = 0;
+        std::priority_queue<Action> actions_;
+
+        Line lines_[SIM_IRQ_LINES];
+        int activeIrq_ = -1;
+        int maskDepth_ = 0;
+
+        Faults faults_ = {0, 0, 0, 0};
+        uint32_t random_ = 1;
+
+        std::vector<Peripheral *> &peripherals()
+        {
+            static std::vector<Peripheral *> list;
+            return list;
+        }
+
+        Peripheral *find(uintptr_t address)
+        {
+            for (Peripheral *p : peripherals())
+                if (address >= p->base && address < p->base + p->size)
+                    return p;
+            return NULL;
+        }
+
+        void map(uintptr_t base, size_t size)
+        {
+            void *p = mmap((void *)base, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+            if (p != (void *)base)
+            {
+                fprintf(stderr, "sim: can not map %#lx\n", (unsigned long)base);
+                exit(2);
+            }
+        }
+
+        cycles_t latency()
+        {
+            cycles_t cycles = 0;
+
+            if (faults_.irqJitter > 0)
+                cycles += random() % (faults_.irqJitter + 1);
+            if (faults_.stallPerMille > 0 && random() % 1000 < faults_.stallPerMille)
+                cycles += random() % (faults_.stallMax + 1);
+
+            return cycles;
+        }
+
+        void latch(Line &line)
+        {
+            if (line.pending)
+                return;
+
+            line.pending = true;
+            line.readyAt = now_ + latency();
+        }
+
+        bool canDispatch()
+        {
+            return activeIrq_ < 0 && maskDepth_ == 0;
+        }
+
+        int nextIrq(cycles_t *readyAt)
+        {
+            int best = -1;
+
+            for (int i = 0; i < SIM_IRQ_LINES; i++)
+            {
+                Line &line = lines_[i];
+                if (line.pending && line.enabled && line.handler != NULL && (best < 0 || line.readyAt < *readyAt))
+                {
+                    best = i;
+                    *readyAt = line.readyAt;
+                }
+            }
+
+            return best;
+        }
+
+        void dispatch()
+        {
+            while (canDispatch())
+            {
+                cycles_t readyAt = 0;
+                int irq = nextIrq(&readyAt);
+                if (irq < 0 || readyAt > now_)
+                    return;
+
+                Line &line = lines_[irq];
+                line.pending = false;
+                line.count++;
+                activeIrq_ = irq;
+                cpu(SIM_ISR_ENTRY_CYCLES);
+                line.handler(line.arg);
+                cpu(SIM_ISR_EXIT_CYCLES);
+                activeIrq_ = -1;
+
+                // The events still set keep the line asserted.
+                if (line.level)
+                    latch(line);
+            }
+        }
+
+        void advance(cycles_t target)
+        {
+            for (;;)
+            {
+                dispatch();
+                if (actions_.empty() || actions_.top().when > target)
+                    break;
+
+                Action action = actions_.top();
+                actions_.pop();
+                if (action.when > now_)
+                    now_ = action.when;
+                action.run();
+            }
+
+            if (target > now_)
+                now_ = target;
+            dispatch();
+        }
+
+        /**
+         * The DWT cycle counter and the debug registers.
+         **/
+        class Core : public Peripheral
+        {
+        public:
+            Core() : Peripheral(SIM_PPB_BASE, SIM_PPB_SIZE)
+            {
+            }
+
+            virtual uint32_t read(uint32_t offset) override
+            {
+                if (offset == DWT_BASE - SIM_PPB_BASE + offsetof(DWT_Type, CYCCNT))
+                    return (uint32_t)now_;
+                return Peripheral::read(offset);
+            }
+        };
+
+        struct Block
+        {
+            uint32_t size; // including this header
+            uint32_t free;
+        };
+
+        Block *heapEnd()
+        {
+            return (Block *)(SIM_RAM_BASE + SIM_HEAP_SIZE);
+        }
+
+        Block *nextBlock(Block *b)
+        {
+            return (Block *)((uint8_t *)b + b->size);
+        }
+
+        void *programThread(void *arg)
+        {
+            int (*program)() = (int (*)())arg;
+            return (void *)(intptr_t)program();
+        }
+    }
+
+    Peripheral::Peripheral(uintptr_t base, size_t size) : base(base), size(size)
+    {
+        peripherals().push_back(this);
+    }
+
+    uint32_t Peripheral::read(uint32_t offset)
+    {
+        return reg(offset).value;
+    }
+
+    void Peripheral::write(uint32_t offset, uint32_t value)
+    {
+        reg(offset).value = value;
+    }
+
+    void init()
+    {
+        map(SIM_APB_BASE, SIM_APB_SIZE);
+        map(SIM_AHB_BASE, SIM_AHB_SIZE);
+        map(SIM_PPB_BASE, SIM_PPB_SIZE);
+        map(SIM_RAM_BASE, SIM_HEAP_SIZE + SIM_STACK_SIZE);
+
+        Block *heap = (Block *)SIM_RAM_BASE;
+        heap->size = SIM_HEAP_SIZE;
+        heap->free = 1;
+
+        static Core core;
+    }
+
+    cycles_t now()
+    {
+        return now_;
+    }
+
+    void at(cycles_t when, std::function<void()> action)
+    {
+        Action a = {when < now_ ? now_ : when, seq_++, action};
+        actions_.push(a);
+    }
+
+    void cpu(uint32_t cycles)
+    {
+        if (now_ > SIM_TIME_LIMIT)
+        {
+            fprintf(stderr, "sim: still running after %llu s of simulated time, stuck in a spin loop?\n",
+                    (unsigned long long)(SIM_TIME_LIMIT / CPU_HZ));
+            exit(2);
+        }
+        advance(now_ + cycles);
+    }
+
+    bool waitUntil(std::function<bool()> done, cycles_t deadline)
+    {
+        while (!done())
+        {
+            if (now_ >= deadline)
+                return false;
+
+            cycles_t next = deadline;
+            if (!actions_.empty() && actions_.top().when < next)
+                next = actions_.top().when;
+
+            cycles_t readyAt = 0;
+            if (canDispatch() && nextIrq(&readyAt) >= 0 && readyAt < next)
+                next = readyAt;
+
+            advance(next > now_ ? next : now_ + 1);
+        }
+        return true;
+    }
+
+    void poke(uint32_t address, uint32_t value)
+    {
+        Peripheral *p = find(address);
+        if (p != NULL)
+            p->write(address - p->base, value);
+    }
+
+    void irqAttach(IRQn_Type irqn, void (*handler)(void *), void *arg)
+    {
+        lines_[irqn].handler = handler;
+        lines_[irqn].arg = arg;
+    }
+
+    void irqLevel(IRQn_Type irqn, bool level)
+    {
+        Line &line = lines_[irqn];
+        if (level && !line.level)
+            latch(line);
+        line.level = level;
+    }
+
+    bool inIsr()
+    {
+        return activeIrq_ >= 0;
+    }
+
+    void irqMask()
+    {
+        maskDepth_++;
+    }
+
+    void irqUnmask()
+    {
+        if (maskDepth_ > 0)
+            maskDepth_--;
+    }
+
+    bool irqMasked()
+    {
+        return maskDepth_ > 0;
+    }
+
+    uint32_t irqCount(IRQn_Type irqn)
+    {
+        return lines_[irqn].count;
+    }
+
+    void resetIrqCounts()
+    {
+        for (int i = 0; i < SIM_IRQ_LINES; i++)
+            lines_[i].count = 0;
+    }
+
+    void setFaults(const Faults &faults, uint32_t seed)
+    {
+        faults_ = faults;
+        random_ = seed != 0 ? seed : 1;
+    }
+
+    const Faults &faults()
+    {
+        return faults_;
+    }
+
+    uint32_t random()
+    {
+        // xorshift32, so that each run sees the same disturbances
+        random_ ^= random_ << 13;
+        random_ ^= random_ >> 17;
+        random_ ^= random_ << 5;
+        return random_;
+    }
+
+    void *ramAlloc(size_t size)
+    {
+        if (size == 0 || size > SIM_HEAP_SIZE)
+            return NULL;
+
+        uint32_t needed = (uint32_t)((size + sizeof(Block) + 7) & ~7UL);
+
+        for (Block *b = (Block *)SIM_RAM_BASE; b < heapEnd(); b = nextBlock(b))
+        {
+            if (!b->free)
+                continue;
+
+            // Merge the free blocks that follow.
+            while (nextBlock(b) < heapEnd() && nextBlock(b)->free)
+                b->size += nextBlock(b)->size;
+
+            if (b->size < needed)
+                continue;
+
+            if (b->size - needed >= 2 * sizeof(Block))
+            {
+                Block *rest = (Block *)((uint8_t *)b + needed);
+                rest->size = b->size - needed;
+                rest->free = 1;
+                b->size = needed;
+            }
+            b->free = 0;
+            return b + 1;
+        }
+
+        return NULL;
+    }
+
+    void ramFree(void *p)
+    {
+        if (p != NULL)
+            ((Block *)p - 1)->free = 1;
+    }
+
+    bool inRam(uint32_t address, uint32_t length)
+    {
+        return address >= SIM_RAM_BASE && (uint64_t)address + length <= SIM_RAM_BASE + SIM_HEAP_SIZE + SIM_STACK_SIZE;
+    }
+
+    int runProgram(int (*program)())
+    {
+        pthread_attr_t attr;
+        pthread_t thread;
+        void *result;
+
+        pthread_attr_init(&attr);
+        pthread_attr_setstack(&attr, (void *)(SIM_RAM_BASE + SIM_HEAP_SIZE), SIM_STACK_SIZE);
+        if (pthread_create(&thread, &attr, programThread, (void *)program) != 0)
+        {
+            fprintf(stderr, "sim: can not start the program\n");
+            exit(2);
+        }
+        pthread_join(thread, &result);
+        pthread_attr_destroy(&attr);
+
+        return (int)(intptr_t)result;
+    }
+}
+
+NrfRegister::operator uint32_t() const volatile
+{
+    uintptr_t address = (uintptr_t)this;
+
+    sim::cpu(SIM_ACCESS_CYCLES);
+
+    sim::Peripheral *p = sim::find(address);
+    return p != NULL ? p->read(address - p->base) : value;
+}
+
+void NrfRegister::operator=(uint32_t v) volatile
+{
+    uintptr_t address = (uintptr_t)this;
+
+    sim::cpu(SIM_ACCESS_CYCLES);
+
+    sim::Peripheral *p = sim::find(address);
+    if (p != NULL)
+        p->write(address - p->base, v);
+    else
+        value = v;
+}
+
+void NVIC_SetPriority(IRQn_Type IRQn, uint32_t priority)
+{
+    // All lines share one level, none preempts another.
+    (void)IRQn;
+    (void)priority;
+}
+
+void NVIC_ClearPendingIRQ(IRQn_Type IRQn)
+{
+    sim::lines_[IRQn].pending = false;
+}
+
+void NVIC_SetPendingIRQ(IRQn_Type IRQn)
+{
+    sim::latch(sim::lines_[IRQn]);
+}
+
+void NVIC_EnableIRQ(IRQn_Type IRQn)
+{
+    sim::lines_[IRQn].enabled = true;
+}
+
+void NVIC_DisableIRQ(IRQn_Type IRQn)
+{
+    sim::lines_[IRQn].enabled = false;
+}
+
+uint32_t NVIC_GetEnableIRQ(IRQn_Type IRQn)
+{
+    return sim::lines_[IRQn].enabled ? 1 : 0;
+}
+
+uint32_t __get_IPSR(void)
+{
+    // Exception number, external interrupts start at 16
+    return sim::activeIrq_ >= 0 ? 16 + sim::activeIrq_ : 0;
+}
@@ -0,0 +1,106 @@
+#ifndef IMQOPEN_HOST_SIM_H
+#define IMQOPEN_HOST_SIM_H
+
+// Discrete event simulation of the parts of an nRF52833 the driver touches.
+//
+// Time is counted in 64 MHz CPU cycles. Peripherals schedule actions at future times; the CPU
+// advances the time by the cycles it spends, 4 per register access, and when the program
+// waits it jumps to the next action. Interrupts are taken between two register accesses,
+// when their line is pending, enabled in the NVIC, not masked and their latency has elapsed.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <functional>
+#include "nrf.h"
+
+namespace sim
+{
+    typedef uint64_t cycles_t;
+
+    const uint32_t CPU_HZ = 64000000;
+
+    inline cycles_t us(uint64_t microseconds)
+    {
+        return microseconds * (CPU_HZ / 1000000);
+    }
+
+    /**
+     * Disturbances applied to the simulated system, see setFaults().
+     **/
+    struct Faults
+    {
+        uint32_t irqJitter;     // random extra latency of each interrupt, in cycles
+        uint32_t stallPerMille; // chance that an interrupt is also held back by higher priority code
+        uint32_t stallMax;      // longest such stall, in cycles
+        uint32_t lineErrorPpm;  // chance that a byte on the wire is hit by noise, in parts per million
+    };
+
+    /**
+     * A memory mapped peripheral. Reads and writes of its registers go through read() and write(),
+     * which by default behave like plain memory.
+     **/
+    class Peripheral
+    {
+    public:
+        uintptr_t base;
+        size_t size;
+
+        Peripheral(uintptr_t base, size_t size);
+        virtual ~Peripheral()
+        {
+        }
+
+        volatile NrfRegister &reg(uint32_t offset)
+        {
+            return *(volatile NrfRegister *)(base + offset);
+        }
+
+        virtual uint32_t read(uint32_t offset);
+        virtual void write(uint32_t offset, uint32_t value);
+    };
+
+    // Maps the peripheral, RAM and core debug address ranges. Must be called first.
+    void init();
+
+    cycles_t now();
+    void at(cycles_t when, std::function<void()> action);
+
+    // Spends CPU cycles in the current context, running whatever happens meanwhile.
+    void cpu(uint32_t cycles);
+
+    // Lets the time run until done() holds or the deadline passes, with the CPU idle.
+    bool waitUntil(std::function<bool()> done, cycles_t deadline);
+
+    // Register access from the peripherals themselves (PPI), which costs no CPU time.
+    void poke(uint32_t address, uint32_t value);
+
+    // A peripheral raised the event at this address, for PPI.
+    void eventRaised(uint32_t address);
+
+    void irqAttach(IRQn_Type irqn, void (*handler)(void *), void *arg);
+    void irqLevel(IRQn_Type irqn, bool level);
+    bool inIsr();
+
+    // PRIMASK, counted like target_disable_irq() and target_enable_irq() do
+    void irqMask();
+    void irqUnmask();
+    bool irqMasked();
+
+    // Number of interrupts taken on a line since the last reset
+    uint32_t irqCount(IRQn_Type irqn);
+    void resetIrqCounts();
+
+    void setFaults(const Faults &faults, uint32_t seed);
+    const Faults &faults();
+    uint32_t random();
+
+    // Allocation in the simulated data RAM, the only memory EasyDMA reaches
+    void *ramAlloc(size_t size);
+    void ramFree(void *p);
+    bool inRam(uint32_t address, uint32_t length);
+
+    // Runs the program on a stack in the simulated RAM, as local buffers may be sent by DMA.
+    int runProgram(int (*program)());
+}
+
+#endif // IMQOPEN_HOST_SIM_H
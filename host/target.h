@@ -0,0 +1,13 @@
+#ifndef IMQOPEN_HOST_TARGET_H
+#define IMQOPEN_HOST_TARGET_H
+
+// The codal target layer on the host, see codal.cpp.
+
+#include <stdint.h>
+
+// Starts the system timer and the message bus. Call after sim::init() and sim::initPeripherals().
+void target_init();
+
+int8_t target_get_irq_disabled();
+
+#endif // IMQOPEN_HOST_TARGET_H
@@ -1,8 +1,77 @@
 #include "pxt.h"
 #include "./NRF52Serial2.h"
+#include "./Serial2Framer.h"
 
 #define MICROBIT_SERIAL_READ_BUFFER_LENGTH 64
 
+// TIMER counting received bytes in coalesced RX mode, not used by the micro:bit runtime
+#ifndef SERIAL2_RX_COUNTER_TIMER
+#define SERIAL2_RX_COUNTER_TIMER NRF_TIMER4
+#endif
+
+// TIMER detecting an idle line, only used by the micro:bit runtime when Bluetooth is enabled
+#ifndef SERIAL2_IDLE_TIMER
+#define SERIAL2_IDLE_TIMER NRF_TIMER0
+#endif
+
+// Interrupt of SERIAL2_IDLE_TIMER, to be overridden together with it
+#ifndef SERIAL2_IDLE_TIMER_IRQn
+#define SERIAL2_IDLE_TIMER_IRQn TIMER0_IRQn
+#endif
+
+// TIMER timestamping edges while serial2.autoBaud() runs, which fails while
+// serial2.setRxCoalescing() or serial2.setRxTimestamps() use it
+#ifndef SERIAL2_AUTOBAUD_TIMER
+#define SERIAL2_AUTOBAUD_TIMER NRF_TIMER4
+#endif
+
+// TIMER keeping the RS-485 driver enabled for the guard time after transmitting. The micro:bit runtime
+// uses it for capacitive touch, so a guard time can not be combined with touch input.
+#ifndef SERIAL2_RS485_TIMER
+#define SERIAL2_RS485_TIMER NRF_TIMER3
+#endif
+
+// TIMER timestamping received data, shared with serial2.setRxCoalescing()
+#ifndef SERIAL2_RX_TIMESTAMP_TIMER
+#define SERIAL2_RX_TIMESTAMP_TIMER NRF_TIMER4
+#endif
+
+// Number of serial2 ports, including the default one, each with its own device ID from SERIAL2_DEVICE_ID on.
+// The nRF52833 has a single UARTE left besides uBit.serial, so only one of them can be open at a time.
+#ifndef SERIAL2_MAX_PORTS
+#define SERIAL2_MAX_PORTS 2
+#endif
+
+// Size of the stack buffer lines are assembled in by writeLine(), writeNumbers() and writeValue()
+#ifndef SERIAL2_LINE_BUFFER_LENGTH
+#define SERIAL2_LINE_BUFFER_LENGTH 128
+#endif
+
+// Size of a static arena holding the RX and TX buffers of the default port, 0 to allocate them on the heap
+#ifndef SERIAL2_BUFFER_ARENA_SIZE
+#define SERIAL2_BUFFER_ARENA_SIZE 0
+#endif
+
+// Period at which the USB bridge moves data between the default port and the USB serial port, in milliseconds
+#ifndef SERIAL2_BRIDGE_POLL_MS
+#define SERIAL2_BRIDGE_POLL_MS 1
+#endif
+
+// Size the RX and TX buffers of uBit.serial are raised to while the USB bridge runs, at most 255.
+// They must hold what arrives in one poll period: the default 20 bytes overflow above about 150 kbaud.
+#ifndef SERIAL2_BRIDGE_USB_BUFFER_SIZE
+#define SERIAL2_BRIDGE_USB_BUFFER_SIZE 254
+#endif
+
+// Size of the buffer holding data from the USB serial port until the default port has room for it
+#ifndef SERIAL2_BRIDGE_BUFFER_LENGTH
+#define SERIAL2_BRIDGE_BUFFER_LENGTH 256
+#endif
+
+// Tags of the chunks sent to the USB serial port in tagged bridge mode
+#define SERIAL2_BRIDGE_TAG_RECEIVED 'R'
+#define SERIAL2_BRIDGE_TAG_SENT 'T'
+
 // make sure USB_TX and USB_RX don't overlap with other pin ids
 // also, 1001,1002 need to be kept in sync with getPin() function
 enum SerialPin
@@ -37,6 +106,18 @@ enum EventBusValue
     SERIAL2_EVT_ERROR_FRAMING = IMQOPEN_NRF52SERIAL2_EVT_ERROR_FRAMING,
     //% blockIdentity="control.eventValueId"
     SERIAL2_EVT_ERROR_BREAK = IMQOPEN_NRF52SERIAL2_EVT_ERROR_BREAK,
+    //% blockIdentity="control.eventValueId"
+    SERIAL2_EVT_TX_COMPLETE = IMQOPEN_NRF52SERIAL2_EVT_TX_COMPLETE,
+    //% blockIdentity="control.eventValueId"
+    SERIAL2_EVT_IDLE = IMQOPEN_NRF52SERIAL2_EVT_IDLE,
+    //% blockIdentity="control.eventValueId"
+    SERIAL2_EVT_FRAME = IMQOPEN_NRF52SERIAL2_EVT_FRAME,
+    //% blockIdentity="control.eventValueId"
+    SERIAL2_EVT_FRAME_ERROR = IMQOPEN_NRF52SERIAL2_EVT_FRAME_ERROR,
+    //% blockIdentity="control.eventValueId"
+    SERIAL2_EVT_TX_IDLE = IMQOPEN_NRF52SERIAL2_EVT_TX_IDLE,
+    //% blockIdentity="control.eventValueId"
+    SERIAL2_EVT_TOKEN = IMQOPEN_NRF52SERIAL2_EVT_TOKEN,
 };
 #else
 enum EventBusSource
@@ -61,131 +142,1261 @@ enum EventBusValue
     SERIAL2_EVT_ERROR_FRAMING = 12,
     //% blockIdentity="control.eventValueId"
     SERIAL2_EVT_ERROR_BREAK = 13,
+    //% blockIdentity="control.eventValueId"
+    SERIAL2_EVT_TX_COMPLETE = 20,
+    //% blockIdentity="control.eventValueId"
+    SERIAL2_EVT_IDLE = 21,
+    //% blockIdentity="control.eventValueId"
+    SERIAL2_EVT_FRAME = 22,
+    //% blockIdentity="control.eventValueId"
+    SERIAL2_EVT_FRAME_ERROR = 23,
+    //% blockIdentity="control.eventValueId"
+    SERIAL2_EVT_TX_IDLE = 24,
+    //% blockIdentity="control.eventValueId"
+    SERIAL2_EVT_TOKEN = 32,
 };
 #endif
 
+// Index of each 32-bit little endian value in the buffer returned by getStats()
+enum Serial2Stat
+{
+    RxBytes = 0,
+    TxBytes = 1,
+    RxDmaTransfers = 2,
+    TxDmaTransfers = 3,
+    RxLateFlushes = 4,
+    OverrunErrors = 5,
+    FramingErrors = 6,
+    BreakErrors = 7,
+    RxHighWater = 8,
+    TxHighWater = 9,
+    IrqCount = 10,
+    IrqCyclesMin = 11,
+    IrqCyclesAvg = 12,
+    IrqCyclesMax = 13,
+    RxDropped = 14,
+};
+
+enum Serial2Framing
+{
+    //% block="none"
+    None = 0,
+    //% block="COBS"
+    COBS = 1,
+    //% block="SLIP"
+    SLIP = 2,
+};
+
 //%
 namespace serial2
 {
 
-    imqopen::NRF52Serial2 serial2(uBit.io.P13, uBit.io.P14);
+    // ports[0] is the default port used by the serial2 functions, the others are created by createPort()
+    imqopen::NRF52Serial2 *ports[SERIAL2_MAX_PORTS];
+    imqopen::Serial2Framer *framers[SERIAL2_MAX_PORTS];
+
+    // Buffers queued with portQueueBuffer(), pinned until the port has completed the given number of sendDirect() buffers
+    struct QueuedBuffer
+    {
+        Buffer buffer;
+        uint32_t done;
+    };
+    QueuedBuffer queuedBuffers[SERIAL2_MAX_PORTS][IMQOPEN_NRF52SERIAL2_TX_QUEUE_LENGTH];
+    bool isTxCompleteListened[SERIAL2_MAX_PORTS];
+    codal::NRFLowLevelTimer *idleTimer;
     // bool is_redirected;
 
+    // The default port claims its UARTE on first use, so that it remains available to createPort() otherwise.
+#if SERIAL2_BUFFER_ARENA_SIZE > 0
+    static uint8_t bufferArena[SERIAL2_BUFFER_ARENA_SIZE];
+#endif
+
+    /**
+     * Returns the default port, or NULL if createPort() has already taken the free UARTE.
+     **/
+    imqopen::NRF52Serial2 *defaultPort()
+    {
+        if (!ports[0])
+        {
+            ports[0] = imqopen::NRF52Serial2::create(uBit.io.P13, uBit.io.P14, IMQOPEN_NRF52SERIAL2_DEFAULT_DEVICE_ID);
+#if SERIAL2_BUFFER_ARENA_SIZE > 0
+            if (ports[0])
+                ports[0]->setBufferArena(bufferArena, sizeof(bufferArena));
+#endif
+        }
+
+        return ports[0];
+    }
+
+    imqopen::NRF52Serial2 *getPort(int port)
+    {
+        if (port == 0)
+            return defaultPort();
+
+        if (port < 0 || port >= SERIAL2_MAX_PORTS)
+            return NULL;
+
+        return ports[port];
+    }
+
     // note that at least one // followed by % is needed per declaration!
 
     //%
     bool isEnabled()
     {
-        return serial2.isEnabled();
+        auto p = defaultPort();
+        if (!p)
+            return false;
+
+        return p->isEnabled();
     }
 
     //%
     bool setEnabled(bool enabled)
     {
-        return DEVICE_OK == serial2.setEnabled(enabled);
+        auto p = defaultPort();
+        if (!p)
+            return false;
+
+        return DEVICE_OK == p->setEnabled(enabled);
+    }
+
+    static void setEnabledFiber(void *enabled)
+    {
+        auto p = defaultPort();
+        if (!p)
+            return;
+
+        p->setEnabled(enabled != NULL);
     }
 
     //%
-    String readUntil(String delimiter)
+    void setEnabledAsync(bool enabled)
     {
-        return PSTR(serial2.readUntil(MSTR(delimiter)));
+        codal::create_fiber(setEnabledFiber, enabled ? (void *)1 : NULL);
     }
 
     //%
-    String readString()
+    void flush()
+    {
+        auto p = defaultPort();
+        if (!p)
+            return;
+
+        p->flush(SYNC_SLEEP);
+    }
+
+    //%
+    int createPort(SerialPin tx, SerialPin rx, BaudRate rate)
+    {
+        if (!getPin(tx) || !getPin(rx))
+            return 0;
+
+        for (int port = 1; port < SERIAL2_MAX_PORTS; port++)
+        {
+            if (ports[port])
+                continue;
+
+            ports[port] = imqopen::NRF52Serial2::create(*getPin(tx), *getPin(rx), SERIAL2_DEVICE_ID + port);
+            if (!ports[port])
+                return 0;
+
+            ports[port]->setBaud(rate);
+            return port;
+        }
+
+        return 0;
+    }
+
+    //%
+    int portDeviceId(int port)
+    {
+        auto p = getPort(port);
+        return p ? p->id : 0;
+    }
+
+    //%
+    String portReadUntil(int port, String delimiter)
     {
-        int n = serial2.getRxBufferSize();
-        if (n == 0)
+        auto p = getPort(port);
+        if (!p)
             return mkString("", 0);
-        return PSTR(serial2.read(n, MicroBitSerialMode::ASYNC));
+        return PSTR(p->readUntil(MSTR(delimiter)));
     }
 
     //%
-    void onDataReceived(String delimiters, Action body)
+    int portPeekLineLength(int port, String delimiters)
+    {
+        auto p = getPort(port);
+        if (!p)
+            return -1;
+
+        p->setLineDelimiters(MSTR(delimiters));
+        int length = p->peekLineLength();
+        return length < 0 ? -1 : length;
+    }
+
+    //%
+    int portAvailableLines(int port, String delimiters)
     {
-        serial2.eventOn(MSTR(delimiters));
-        registerWithDal(SERIAL2_DEVICE_ID, MICROBIT_SERIAL_EVT_DELIM_MATCH, body);
+        auto p = getPort(port);
+        if (!p)
+            return 0;
+
+        p->setLineDelimiters(MSTR(delimiters));
+        return p->availableLines();
+    }
+
+    //%
+    int portAddToken(int port, String token)
+    {
+        auto p = getPort(port);
+        if (!p || !token)
+            return -1;
+
+        int index = p->addToken(MSTR(token));
+        return index >= 0 ? index : -1;
+    }
+
+    //%
+    int portTokenOffset(int port, int index)
+    {
+        auto p = getPort(port);
+        if (!p)
+            return -1;
+
+        int offset = p->tokenOffset(index);
+        return offset > 0 ? offset : -1;
+    }
+
+    //%
+    void portClearTokens(int port)
+    {
+        auto p = getPort(port);
+        if (p)
+            p->clearTokens();
+    }
+
+    //%
+    String portReadString(int port)
+    {
+        auto p = getPort(port);
+        if (!p)
+            return mkString("", 0);
+
+        const uint8_t *data;
+        int length = p->peekRxSpan(&data);
+        if (length <= 0)
+            return mkString("", 0);
+
+        int total = p->rxBufferedSize();
+        if (length >= total)
+        {
+            String s = mkString((const char *)data, length);
+            p->consumeRx(length);
+            return s;
+        }
+
+        // The data wraps around the end of the RX buffer: both parts are copied straight into the String.
+        String s = mkStringCore(NULL, total);
+        memcpy(s->ascii.data, data, length);
+        p->consumeRx(length);
+        p->peekRxSpan(&data);
+        memcpy(s->ascii.data + length, data, total - length);
+        p->consumeRx(total - length);
+
+#if PXT_UTF8
+        // Other than ASCII, the String layout depends on the characters, which mkString() works out.
+        for (int i = 0; i < total; i++)
+        {
+            if (s->ascii.data[i] & 0x80)
+            {
+                registerGCObj(s);
+                String utf8 = mkString(s->ascii.data, total);
+                unregisterGCObj(s);
+                return utf8;
+            }
+        }
+#endif
+
+        return s;
+    }
+
+    //%
+    void portOnDataReceived(int port, String delimiters, Action body)
+    {
+        auto p = getPort(port);
+        if (!p)
+            return;
+
+        p->eventOn(MSTR(delimiters));
+        registerWithDal(p->id, MICROBIT_SERIAL_EVT_DELIM_MATCH, body);
         // lazy initialization of serial buffers
-        serial2.read(MicroBitSerialMode::ASYNC);
+        p->read(MicroBitSerialMode::ASYNC);
     }
 
     //%
-    void writeString(String text)
+    void portWriteString(int port, String text)
     {
-        if (!text)
+        auto p = getPort(port);
+        if (!text || !p)
             return;
 
-        serial2.send(MSTR(text));
+        p->send(MSTR(text));
     }
 
+    // Assembles a line on the stack, so that it is handed to the port in one send()
+    // unless it is longer than SERIAL2_LINE_BUFFER_LENGTH.
+    class LineWriter
+    {
+        imqopen::NRF52Serial2 *port_;
+        int length_;
+        int written_;
+        uint8_t data_[SERIAL2_LINE_BUFFER_LENGTH];
+
+        void flush()
+        {
+            if (length_ > 0)
+                port_->send(data_, length_);
+            length_ = 0;
+        }
+
+    public:
+        LineWriter(imqopen::NRF52Serial2 *port) : port_(port), length_(0), written_(0)
+        {
+        }
+
+        void write(const char *s, int len)
+        {
+            written_ += len;
+            while (len > 0)
+            {
+                if (length_ == SERIAL2_LINE_BUFFER_LENGTH)
+                    flush();
+
+                int n = SERIAL2_LINE_BUFFER_LENGTH - length_ < len ? SERIAL2_LINE_BUFFER_LENGTH - length_ : len;
+                memcpy(data_ + length_, s, n);
+                length_ += n;
+                s += n;
+                len -= n;
+            }
+        }
+
+        void write(String s)
+        {
+            if (!s)
+                return;
+            codal::ManagedString m = MSTR(s);
+            write(m.toCharArray(), m.length());
+        }
+
+        void writeNumber(TNumber value)
+        {
+            double d = toDouble(value);
+
+            // Integers are formatted here, anything else like JavaScript's toString().
+            if (d >= -2147483647.0 && d <= 2147483647.0 && d == (int)d)
+            {
+                char digits[12];
+                int n = (int)d;
+                unsigned u = n < 0 ? -n : n;
+                int i = sizeof(digits);
+                do
+                {
+                    digits[--i] = '0' + u % 10;
+                    u /= 10;
+                } while (u > 0);
+                if (n < 0)
+                    digits[--i] = '-';
+                write(digits + i, sizeof(digits) - i);
+            }
+            else
+            {
+                write(numops::toString(value));
+            }
+        }
+
+        // Pads to a multiple of padding bytes, including the new line, then sends the line.
+        void endLine(String newLine, int padding)
+        {
+            int newLineLength = newLine ? MSTR(newLine).length() : 0;
+            if (padding > 0)
+            {
+                for (int r = (padding - (written_ + newLineLength) % padding) % padding; r > 0; r--)
+                    write(" ", 1);
+            }
+            write(newLine);
+            flush();
+        }
+    };
+
     //%
-    void writeBuffer(Buffer buffer)
+    void portWriteLine(int port, String text, String newLine, int padding)
     {
-        if (!buffer)
+        auto p = getPort(port);
+        if (!p)
             return;
 
-        serial2.send(buffer->data, buffer->length);
+        LineWriter line(p);
+        line.write(text);
+        line.endLine(newLine, padding);
     }
 
     //%
-    Buffer readBuffer(int length)
+    void portWriteNumbers(int port, RefCollection *values, String newLine, int padding)
     {
-        auto mode = SYNC_SLEEP;
+        auto p = getPort(port);
+        if (!p || !values)
+            return;
+
+        LineWriter line(p);
+        for (unsigned i = 0; i < values->length(); i++)
+        {
+            if (i > 0)
+                line.write(",", 1);
+            line.writeNumber(values->getAt(i));
+        }
+        line.endLine(newLine, padding);
+    }
+
+    //%
+    void portWriteValue(int port, String name, TNumber value, String newLine, int padding)
+    {
+        auto p = getPort(port);
+        if (!p)
+            return;
+
+        LineWriter line(p);
+        if (name && MSTR(name).length() > 0)
+        {
+            line.write(name);
+            line.write(":", 1);
+        }
+        line.writeNumber(value);
+        line.endLine(newLine, padding);
+    }
+
+    //%
+    void portWriteBuffer(int port, Buffer buffer)
+    {
+        auto p = getPort(port);
+        if (!buffer || !p)
+            return;
+
+        // EasyDMA can only read RAM, Buffers in flash (hex literals) are copied into the TX buffer instead.
+        if (!nrfx_is_in_ram(buffer->data))
+        {
+            p->send(buffer->data, buffer->length);
+            return;
+        }
+
+        registerGCObj(buffer); // make sure buffer is pinned, while EasyDMA reads from it
+        p->sendDirect(buffer->data, buffer->length);
+        unregisterGCObj(buffer);
+    }
+
+    //%
+    Buffer portReadBuffer(int port, int length)
+    {
+        auto p = getPort(port);
+        if (!p)
+            return mkBuffer(NULL, 0);
+
         if (length <= 0)
         {
-            length = serial2.getRxBufferSize();
-            mode = ASYNC;
+            // Whatever has been received, copied once straight from the RX buffer.
+            const uint8_t *data;
+            int span = p->peekRxSpan(&data);
+            if (span <= 0)
+                return mkBuffer(NULL, 0);
+
+            int available = p->rxBufferedSize();
+            if (span == available)
+            {
+                auto buf = mkBuffer(data, span);
+                p->consumeRx(span);
+                return buf;
+            }
+
+            auto buf = mkBuffer(NULL, available);
+            p->read(buf->data, available, ASYNC);
+            return buf;
         }
 
         auto buf = mkBuffer(NULL, length);
         auto res = buf;
         registerGCObj(buf); // make sure buffer is pinned, while we wait for data
-        int read = serial2.read(buf->data, buf->length, mode);
+        int read = p->read(buf->data, buf->length, SYNC_SLEEP);
         if (read != length)
         {
-            res = mkBuffer(buf->data, read);
+            res = mkBuffer(buf->data, read > 0 ? read : 0);
         }
         unregisterGCObj(buf);
 
         return res;
     }
 
+    //%
+    int portReadInto(int port, Buffer buffer, int offset, int maxLength)
+    {
+        auto p = getPort(port);
+        if (!p || !buffer || offset < 0 || offset >= buffer->length)
+            return 0;
+
+        if (maxLength < 0 || maxLength > buffer->length - offset)
+            maxLength = buffer->length - offset;
+
+        // Copied straight from the RX buffer, in at most two pieces.
+        int read = p->read(buffer->data + offset, maxLength, ASYNC);
+        return read > 0 ? read : 0;
+    }
+
+    static bool setPortFramer(int port, int mode, bool crc, const imqopen::Serial2PacketFormat *format)
+    {
+        auto p = getPort(port);
+        if (!p)
+            return false;
+
+        if (p->setFramer(NULL) != DEVICE_OK)
+            return false;
+        delete framers[port];
+        framers[port] = NULL;
+
+        if (mode == Serial2Framing::None)
+            return true;
+
+        auto framer = new imqopen::Serial2Framer(*p, (imqopen::Serial2FramingMode)mode, crc, format);
+        if (!framer->isValid() || p->setFramer(framer) != DEVICE_OK)
+        {
+            delete framer;
+            return false;
+        }
+
+        framers[port] = framer;
+        return true;
+    }
+
+    static bool setPacketSync(imqopen::Serial2PacketFormat &format, Buffer sync)
+    {
+        int length = sync ? sync->length : 0;
+        if (length > IMQOPEN_SERIAL2FRAMER_SYNC_MAX_LENGTH)
+            return false;
+
+        if (length > 0)
+            memcpy(format.sync, sync->data, length);
+        format.syncLength = length;
+        return true;
+    }
+
+    //%
+    bool portSetFraming(int port, Serial2Framing framing, bool crc)
+    {
+        return setPortFramer(port, framing, crc, NULL);
+    }
+
+    //%
+    bool portSetFixedPackets(int port, int size, Buffer sync, bool crc)
+    {
+        imqopen::Serial2PacketFormat format = imqopen::Serial2PacketFormat();
+        if (size <= 0 || size > IMQOPEN_SERIAL2FRAMER_MAX_LENGTH || !setPacketSync(format, sync))
+            return false;
+
+        format.size = size;
+        return setPortFramer(port, imqopen::SERIAL2_FRAMING_FIXED, crc, &format);
+    }
+
+    //%
+    bool portSetLengthPackets(int port, int lengthOffset, int lengthWidth, bool bigEndian, Buffer sync, bool crc)
+    {
+        imqopen::Serial2PacketFormat format = imqopen::Serial2PacketFormat();
+        if (lengthOffset < 0 || lengthOffset > IMQOPEN_SERIAL2FRAMER_MAX_LENGTH || !setPacketSync(format, sync))
+            return false;
+
+        format.lengthOffset = lengthOffset;
+        format.lengthWidth = lengthWidth;
+        format.bigEndian = bigEndian;
+        return setPortFramer(port, imqopen::SERIAL2_FRAMING_LENGTH, crc, &format);
+    }
+
+    //%
+    Buffer portReadFrame(int port)
+    {
+        auto framer = port >= 0 && port < SERIAL2_MAX_PORTS ? framers[port] : NULL;
+        int length = framer ? framer->frameLength() : DEVICE_NO_DATA;
+        if (length < 0)
+            return mkBuffer(NULL, 0);
+
+        auto buf = mkBuffer(NULL, length);
+        framer->readFrame(buf->data, buf->length);
+        return buf;
+    }
+
+    //%
+    bool portWriteFrame(int port, Buffer buffer)
+    {
+        auto framer = port >= 0 && port < SERIAL2_MAX_PORTS ? framers[port] : NULL;
+        if (!framer || !buffer)
+            return false;
+
+        // The frame is encoded into the framer's own buffer, so the Buffer need not stay pinned.
+        return framer->writeFrame(buffer->data, buffer->length, SYNC_SLEEP) > 0;
+    }
+
+    void releaseQueuedBuffers(int port)
+    {
+        uint32_t completed = ports[port]->getTxDirectCompleted();
+
+        for (auto &queued : queuedBuffers[port])
+        {
+            if (queued.buffer && (int32_t)(completed - queued.done) >= 0)
+            {
+                unregisterGCObj(queued.buffer);
+                queued.buffer = NULL;
+            }
+        }
+    }
+
+    void onTxComplete(MicroBitEvent e)
+    {
+        for (int port = 0; port < SERIAL2_MAX_PORTS; port++)
+            if (ports[port] && ports[port]->id == e.source)
+                releaseQueuedBuffers(port);
+    }
+
+    //%
+    void portQueueBuffer(int port, Buffer buffer)
+    {
+        auto p = getPort(port);
+        if (!buffer || !p || buffer->length == 0)
+            return;
+
+        if (!isTxCompleteListened[port])
+        {
+            uBit.messageBus.listen(p->id, IMQOPEN_NRF52SERIAL2_EVT_TX_COMPLETE, onTxComplete);
+            isTxCompleteListened[port] = true;
+        }
+
+        // Wait for a free slot in the port's queue.
+        while (p->txQueueLength() >= IMQOPEN_NRF52SERIAL2_TX_QUEUE_LENGTH - 1)
+            p->waitForTxDirect(SYNC_SLEEP, IMQOPEN_NRF52SERIAL2_TX_QUEUE_LENGTH - 2);
+
+        releaseQueuedBuffers(port);
+
+        // EasyDMA can only read RAM, so Buffers in flash (hex literals) are queued as a copy.
+        if (!nrfx_is_in_ram(buffer->data))
+            buffer = mkBuffer(buffer->data, buffer->length);
+
+        for (auto &queued : queuedBuffers[port])
+        {
+            if (queued.buffer)
+                continue;
+
+            // EasyDMA reads the Buffer until it has been sent, so keep it from being collected until then.
+            registerGCObj(buffer);
+            queued.buffer = buffer;
+            queued.done = p->getTxDirectCompleted() + p->txQueueLength() + 1;
+
+            // No TX_COMPLETE will release a Buffer that was not queued.
+            if (p->sendDirect(buffer->data, buffer->length, ASYNC) < 0)
+            {
+                unregisterGCObj(buffer);
+                queued.buffer = NULL;
+            }
+            return;
+        }
+    }
+
+    //%
+    void portSetBaudRate(int port, int rate)
+    {
+        auto p = getPort(port);
+        if (p && rate > 0)
+            p->setBaud(rate);
+    }
+
+    //%
+    void portFlush(int port)
+    {
+        auto p = getPort(port);
+        if (p)
+            p->flush(SYNC_SLEEP);
+    }
+
+    //%
+    Buffer portGetStats(int port)
+    {
+        auto p = getPort(port);
+        imqopen::NRF52Serial2Stats stats;
+        if (!p || p->getStats(stats) != DEVICE_OK)
+            return NULL;
+
+        uint32_t values[] = {
+            stats.rxBytes,
+            stats.txBytes,
+            stats.rxDmaTransfers,
+            stats.txDmaTransfers,
+            stats.rxLateFlushes,
+            stats.overrunErrors,
+            stats.framingErrors,
+            stats.breakErrors,
+            stats.rxHighWater,
+            stats.txHighWater,
+            stats.irqCount,
+            stats.irqCyclesMin,
+            stats.irqCount > 0 ? (uint32_t)(stats.irqCycles / stats.irqCount) : 0,
+            stats.irqCyclesMax,
+            stats.rxDropped,
+        };
+        return mkBuffer(values, sizeof(values));
+    }
+
+    //%
+    void portResetStats(int port)
+    {
+        auto p = getPort(port);
+        if (p)
+            p->resetStats();
+    }
+
+    //%
+    Buffer getStats()
+    {
+        return portGetStats(0);
+    }
+
+    //%
+    void resetStats()
+    {
+        portResetStats(0);
+    }
+
+    //%
+    String readUntil(String delimiter)
+    {
+        return portReadUntil(0, delimiter);
+    }
+
+    //%
+    String readString()
+    {
+        return portReadString(0);
+    }
+
+    //%
+    void onDataReceived(String delimiters, Action body)
+    {
+        portOnDataReceived(0, delimiters, body);
+    }
+
+    //%
+    void writeString(String text)
+    {
+        portWriteString(0, text);
+    }
+
+    //%
+    void writeBuffer(Buffer buffer)
+    {
+        portWriteBuffer(0, buffer);
+    }
+
+    //%
+    Buffer readBuffer(int length)
+    {
+        return portReadBuffer(0, length);
+    }
+
+    //%
+    int readInto(Buffer buffer, int offset, int maxLength)
+    {
+        return portReadInto(0, buffer, offset, maxLength);
+    }
+
+    //%
+    void queueBuffer(Buffer buffer)
+    {
+        portQueueBuffer(0, buffer);
+    }
+
+    //%
+    bool setFraming(Serial2Framing framing, bool crc)
+    {
+        return portSetFraming(0, framing, crc);
+    }
+
+    //%
+    Buffer readFrame()
+    {
+        return portReadFrame(0);
+    }
+
+    //%
+    bool setFixedPackets(int size, Buffer sync, bool crc)
+    {
+        return portSetFixedPackets(0, size, sync, crc);
+    }
+
+    //%
+    bool setLengthPackets(int lengthOffset, int lengthWidth, bool bigEndian, Buffer sync, bool crc)
+    {
+        return portSetLengthPackets(0, lengthOffset, lengthWidth, bigEndian, sync, crc);
+    }
+
+    //%
+    Buffer readPacket()
+    {
+        return portReadFrame(0);
+    }
+
+    //%
+    bool writeFrame(Buffer buffer)
+    {
+        return portWriteFrame(0, buffer);
+    }
+
     //%
     void redirect(SerialPin tx, SerialPin rx, BaudRate rate)
     {
+        auto p = defaultPort();
+        if (!p)
+            return;
 
         if (getPin(tx) && getPin(rx))
         {
-            serial2.redirect(*getPin(tx), *getPin(rx));
+            p->redirect(*getPin(tx), *getPin(rx));
             // is_redirected = 1;
         }
-        serial2.setBaud(rate);
+        p->setBaud(rate);
+    }
+
+    //%
+    void redirectWithFlowControl(SerialPin tx, SerialPin rx, SerialPin rts, SerialPin cts, BaudRate rate)
+    {
+        auto p = defaultPort();
+        if (!p)
+            return;
+
+        if (getPin(tx) && getPin(rx) && getPin(rts) && getPin(cts))
+        {
+            p->redirect(*getPin(tx), *getPin(rx), getPin(rts), getPin(cts));
+        }
+        p->setBaud(rate);
+    }
+
+    //%
+    bool setFlowControlThreshold(int highWater)
+    {
+        auto p = defaultPort();
+        if (!p)
+            return false;
+
+        return DEVICE_OK == p->setFlowControlThreshold(highWater);
     }
 
     //%
     void setBaudRate(BaudRate rate)
     {
-        serial2.setBaud(rate);
+        auto p = defaultPort();
+        if (!p)
+            return;
+
+        p->setBaud(rate);
+    }
+
+    //%
+    int setCustomBaudRate(int rate)
+    {
+        auto p = defaultPort();
+        if (!p)
+            return 0;
+
+        if (rate <= 0 || p->setBaud(rate) != DEVICE_OK)
+            return 0;
+
+        return p->getBaudrate();
+    }
+
+    //%
+    int autoBaud(int timeout)
+    {
+        auto p = defaultPort();
+        if (!p)
+            return 0;
+
+        int res = p->autoBaud(SERIAL2_AUTOBAUD_TIMER, timeout > 0 ? timeout : 0);
+
+        return res > 0 ? res : 0;
     }
 
     //%
     void redirectToUSB()
     {
+        auto p = defaultPort();
+        if (!p)
+            return;
+
         // is_redirected = false;
-        serial2.redirect(uBit.io.usbTx, uBit.io.usbRx);
-        serial2.setBaud(115200);
+        p->redirect(uBit.io.usbTx, uBit.io.usbRx);
+        p->setBaud(115200);
     }
 
     //%
-    void setRxBufferSize(uint8_t size)
+    void setRxBufferSize(int size)
     {
-        serial2.setRxBufferSize(size);
+        auto p = defaultPort();
+        if (!p)
+            return;
+
+        if (size > 0xFFFF)
+            size = 0xFFFF;
+        if (size > 0)
+            p->setRxBufferSize(size);
     }
 
     //%
-    void setTxBufferSize(uint8_t size)
+    void setTxBufferSize(int size)
     {
-        serial2.setTxBufferSize(size);
+        auto p = defaultPort();
+        if (!p)
+            return;
+
+        if (size > 0xFFFF)
+            size = 0xFFFF;
+        if (size > 0)
+            p->setTxBufferSize(size);
+    }
+
+    //%
+    bool setRxDmaBuffers(int count, int size)
+    {
+        auto p = defaultPort();
+        if (!p)
+            return false;
+
+        return DEVICE_OK == p->setRxDmaBuffers(count, size);
+    }
+
+    //%
+    bool setIdleTimeout(int bitTimes)
+    {
+        auto p = defaultPort();
+        if (!p)
+            return false;
+
+        if (bitTimes <= 0)
+            return DEVICE_OK == p->setIdleTimeout(NULL, 0);
+
+        if (!idleTimer)
+            idleTimer = new codal::NRFLowLevelTimer(SERIAL2_IDLE_TIMER, SERIAL2_IDLE_TIMER_IRQn);
+
+        return DEVICE_OK == p->setIdleTimeout(idleTimer, bitTimes);
+    }
+
+    //%
+    bool setRs485(int de, int re, int guardUs)
+    {
+        auto p = defaultPort();
+        if (!p)
+            return false;
+
+        if (de < 0)
+            return DEVICE_OK == p->setRs485(NULL);
+
+        auto dePin = getPin(de);
+        auto rePin = re >= 0 ? getPin(re) : NULL;
+        if (!dePin || (re >= 0 && !rePin))
+            return false;
+
+        return DEVICE_OK == p->setRs485(dePin, rePin, SERIAL2_RS485_TIMER, guardUs > 0 ? guardUs : 0);
+    }
+
+    //%
+    bool setRxTimestamps(bool enabled)
+    {
+        auto p = defaultPort();
+        if (!p)
+            return false;
+
+        return DEVICE_OK == p->setRxTimestamps(enabled ? SERIAL2_RX_TIMESTAMP_TIMER : NULL);
+    }
+
+    //%
+    Buffer readTimestamped()
+    {
+        auto p = defaultPort();
+        if (!p)
+            return mkBuffer(NULL, 0);
+
+        int length = p->rxChunkLength();
+        if (length < 0)
+            return mkBuffer(NULL, 0);
+
+        auto buf = mkBuffer(NULL, 4 + length);
+        auto res = buf;
+        uint32_t timestamp = 0;
+        int read = p->readTimestamped(buf->data + 4, length, &timestamp);
+
+        // Same range as control.micros()
+        timestamp &= 0x3FFFFFFF;
+        memcpy(buf->data, &timestamp, 4);
+
+        if (read != length)
+        {
+            registerGCObj(buf);
+            res = mkBuffer(buf->data, 4 + (read > 0 ? read : 0));
+            unregisterGCObj(buf);
+        }
+
+        return res;
+    }
+
+    //%
+    int lastRxTimestamp()
+    {
+        auto p = defaultPort();
+        if (!p)
+            return 0;
+
+        return p->lastRxTimestamp() & 0x3FFFFFFF;
+    }
+
+    //%
+    int lastRxIdleTimestamp()
+    {
+        auto p = defaultPort();
+        if (!p)
+            return 0;
+
+        return p->lastRxIdleTimestamp() & 0x3FFFFFFF;
+    }
+
+    //%
+    bool setRxDirect(bool direct)
+    {
+        auto p = defaultPort();
+        if (!p)
+            return false;
+
+        return DEVICE_OK == p->setRxDirect(direct);
+    }
+
+    //%
+    bool setRxCoalescing(int threshold, int idleTimeout)
+    {
+        auto p = defaultPort();
+        if (!p)
+            return false;
+
+        if (threshold <= 0)
+            return DEVICE_OK == p->setRxCoalescing(NULL);
+
+        return DEVICE_OK == p->setRxCoalescing(SERIAL2_RX_COUNTER_TIMER, threshold, idleTimeout > 0 ? idleTimeout : 0);
+    }
+
+    //%
+    bool setEventInterval(int interval)
+    {
+        auto p = defaultPort();
+        if (!p)
+            return false;
+
+        return DEVICE_OK == p->setEventInterval(interval > 0 ? interval : 0);
+    }
+
+    //%
+    int eventCount(int value)
+    {
+        auto p = defaultPort();
+        if (!p)
+            return 0;
+
+        return p->getEventCount(value);
+    }
+
+    // Bridge between the default port and uBit.serial, run by a native fiber woken every SERIAL2_BRIDGE_POLL_MS
+    struct UsbBridge
+    {
+        bool enabled;
+        bool running;
+        bool tagged;
+        bool timestamps;
+        // Data read from uBit.serial, not yet accepted by the default port
+        uint8_t fromUsb[SERIAL2_BRIDGE_BUFFER_LENGTH];
+        int fromUsbLength;
+        // Bytes lost on the way to each port
+        uint32_t toUsbLost;
+        uint32_t toSerial2Lost;
+        uint32_t rxDroppedBase;
+    };
+    static UsbBridge usbBridge;
+
+    static uint32_t rxDropped()
+    {
+        auto p = defaultPort();
+        if (!p)
+            return 0;
+
+        imqopen::NRF52Serial2Stats stats;
+        if (p->getStats(stats) != DEVICE_OK)
+            return 0;
+        return stats.rxDropped;
+    }
+
+    /**
+     * Sends a tagged chunk to uBit.serial: tag, length, optional 32-bit little endian timestamp, then the data.
+     * The timestamp is cut to 30 bits like control.micros().
+     * Returns false, without sending anything, if it does not fit in the TX buffer.
+     **/
+    static bool sendUsbChunk(uint8_t tag, const uint8_t *data, int length, uint32_t time)
+    {
+        uint8_t header[6] = {tag, (uint8_t)length};
+        int headerLength = 2;
+        if (usbBridge.timestamps)
+        {
+            time &= 0x3FFFFFFF;
+            memcpy(header + 2, &time, 4);
+            headerLength = 6;
+        }
+
+        int room = uBit.serial.getTxBufferSize() - uBit.serial.txBufferedSize() - 1;
+        if (room < headerLength + length || uBit.serial.txInUse())
+            return false;
+
+        uBit.serial.send(header, headerLength, ASYNC);
+        uBit.serial.send((uint8_t *)data, length, ASYNC);
+        return true;
+    }
+
+    static void moveToUsb(imqopen::NRF52Serial2 &p)
+    {
+        const uint8_t *data;
+        int span;
+        while ((span = p.peekRxSpan(&data)) > 0)
+        {
+            int sent;
+            if (usbBridge.tagged)
+            {
+                // Chunks are sent whole, so that the tags stay in step with the data.
+                int room = uBit.serial.getTxBufferSize() - uBit.serial.txBufferedSize() - 1 - (usbBridge.timestamps ? 6 : 2);
+                sent = span < room ? span : room;
+                if (sent > 255)
+                    sent = 255;
+
+                // With serial2.setRxTimestamps(true), chunks do not span bursts and carry their arrival time.
+                uint32_t time = codal::system_timer_current_time_us();
+                int burst = usbBridge.timestamps ? p.rxChunkLength(&time) : 0;
+                if (burst > 0 && burst < sent)
+                    sent = burst;
+
+                if (sent <= 0 || !sendUsbChunk(SERIAL2_BRIDGE_TAG_RECEIVED, data, sent, time))
+                    break;
+            }
+            else
+            {
+                sent = uBit.serial.send((uint8_t *)data, span, ASYNC);
+                if (sent <= 0)
+                    break;
+            }
+
+            p.consumeRx(sent);
+            if (sent < span)
+                break;
+        }
+    }
+
+    static void moveToSerial2(imqopen::NRF52Serial2 &p)
+    {
+        // Drain uBit.serial, whose small buffer would otherwise overflow silently.
+        int room = SERIAL2_BRIDGE_BUFFER_LENGTH - usbBridge.fromUsbLength;
+        if (room > 0 && uBit.serial.rxBufferedSize() > 0)
+        {
+            int read = uBit.serial.read(usbBridge.fromUsb + usbBridge.fromUsbLength, room, ASYNC);
+            if (read > 0)
+                usbBridge.fromUsbLength += read;
+        }
+
+        if (usbBridge.fromUsbLength == SERIAL2_BRIDGE_BUFFER_LENGTH)
+        {
+            uint8_t discard[32];
+            int lost;
+            while (uBit.serial.rxBufferedSize() > 0 && (lost = uBit.serial.read(discard, sizeof(discard), ASYNC)) > 0)
+                usbBridge.toSerial2Lost += lost;
+        }
+
+        int length = usbBridge.fromUsbLength;
+        if (length == 0)
+            return;
+
+        // In tagged mode, what is sent is reported to USB too, as long as it fits.
+        if (usbBridge.tagged && length > 255)
+            length = 255;
+
+        int sent = p.send(usbBridge.fromUsb, length, ASYNC);
+        if (sent <= 0)
+            return;
+
+        if (usbBridge.tagged && !sendUsbChunk(SERIAL2_BRIDGE_TAG_SENT, usbBridge.fromUsb, sent, codal::system_timer_current_time_us()))
+            usbBridge.toUsbLost += sent;
+
+        usbBridge.fromUsbLength -= sent;
+        memmove(usbBridge.fromUsb, usbBridge.fromUsb + sent, usbBridge.fromUsbLength);
+    }
+
+    static void usbBridgeFiber(void *)
+    {
+        // Only started once setUsbBridge() has got the default port.
+        auto &p = *defaultPort();
+
+        while (usbBridge.enabled)
+        {
+            moveToUsb(p);
+            moveToSerial2(p);
+            codal::fiber_sleep(SERIAL2_BRIDGE_POLL_MS);
+        }
+
+        usbBridge.running = false;
+    }
+
+    //%
+    void setUsbBridge(bool enabled, bool tagged, bool timestamps)
+    {
+        auto p = defaultPort();
+        if (!p)
+            return;
+
+        usbBridge.tagged = tagged || timestamps;
+        usbBridge.timestamps = timestamps;
+        usbBridge.enabled = enabled;
+
+        if (!enabled || usbBridge.running)
+            return;
+
+        usbBridge.running = true;
+        usbBridge.fromUsbLength = 0;
+        usbBridge.toUsbLost = 0;
+        usbBridge.toSerial2Lost = 0;
+        usbBridge.rxDroppedBase = rxDropped();
+
+        // Resizing drops what they hold, which is why it is only done here.
+        if (uBit.serial.getRxBufferSize() < SERIAL2_BRIDGE_USB_BUFFER_SIZE)
+            uBit.serial.setRxBufferSize(SERIAL2_BRIDGE_USB_BUFFER_SIZE);
+        if (uBit.serial.getTxBufferSize() < SERIAL2_BRIDGE_USB_BUFFER_SIZE)
+            uBit.serial.setTxBufferSize(SERIAL2_BRIDGE_USB_BUFFER_SIZE);
+
+        // Start reception, which is otherwise lazy.
+        const uint8_t *data;
+        p->peekRxSpan(&data);
+
+        codal::create_fiber(usbBridgeFiber, NULL);
+    }
+
+    //%
+    int getUsbBridgeOverflow(bool toUsb)
+    {
+        if (!toUsb)
+            return usbBridge.toSerial2Lost;
+
+        return usbBridge.toUsbLost + (rxDropped() - usbBridge.rxDroppedBase);
     }
 
 } // namespace serial2
@@ -22,16 +22,13 @@ namespace serial2 {
     //% blockId=serial2_writeline block="serial2|write line %text"
     //% text.shadowOptions.toString=true
     export function writeLine(text: string): void {
-        if (!text) text = "";
-        serial2.writeString(text);
+        writePortLine(0, text);
+    }
+
+    function writePortLine(port: number, text: string): void {
         // pad data to the 32 byte boundary
         // to ensure apps receive the packet
-        if (writeLinePadding > 0) {
-            let r = (writeLinePadding - (text.length + NEW_LINE.length) % writeLinePadding) % writeLinePadding;
-            for (let i = 0; i < r; ++i)
-                serial2.writeString(" ");
-        }
-        serial2.writeString(NEW_LINE);
+        serial2.portWriteLine(port, text || "", NEW_LINE, writeLinePadding);
     }
 
     /**
@@ -66,11 +63,7 @@ namespace serial2 {
     //% blockId=serial2_writenumbers block="serial2|write numbers %values"
     export function writeNumbers(values: number[]): void {
         if (!values) return;
-        for (let i = 0; i < values.length; ++i) {
-            if (i > 0) writeString(",");
-            writeNumber(values[i]);
-        }
-        writeLine("")
+        serial2.portWriteNumbers(0, values, NEW_LINE, writeLinePadding);
     }
 
     /**
@@ -82,7 +75,7 @@ namespace serial2 {
     //% help=serial/write-value
     //% blockId=serial2_writevalue block="serial2|write value %name|= %value"
     export function writeValue(name: string, value: number): void {
-        writeLine((name ? name + ":" : "") + value);
+        serial2.portWriteValue(0, name || "", value, NEW_LINE, writeLinePadding);
     }
 
     /**
@@ -94,4 +87,192 @@ namespace serial2 {
     export function readLine(): string {
         return serial2.readUntil(serial.delimiters(NEW_LINE_DELIMITER));
     }
+
+    /**
+     * Get the length of the next complete line in the receive buffer, without its delimiter,
+     * or -1 if no complete line has been received.
+     */
+    //% blockId=serial2_peek_line_length block="serial2|next line length"
+    //% weight=19 blockGap=8
+    //% advanced=true
+    export function peekLineLength(): number {
+        return serial2.portPeekLineLength(0, serial.delimiters(NEW_LINE_DELIMITER));
+    }
+
+    /**
+     * Get the number of complete lines in the receive buffer (at most 16),
+     * so that they can all be read with "read line" without waiting.
+     */
+    //% blockId=serial2_available_lines block="serial2|available lines"
+    //% weight=18 blockGap=8
+    //% advanced=true
+    export function availableLines(): number {
+        return serial2.portAvailableLines(0, serial.delimiters(NEW_LINE_DELIMITER));
+    }
+
+    /**
+     * Run some code when a token, such as a modem response, is received. Up to 8 tokens are matched
+     * as the data arrives, without reading it. The handler gets the number of characters in the
+     * receive buffer up to and including the token, or -1 if they have been read in the meantime.
+     * @param token the characters to look for, eg: "OK\r\n"
+     */
+    //% blockId=serial2_on_token block="serial2|on token %token" draggableParameters=reporter
+    //% weight=17 advanced=true
+    export function onToken(token: string, handler: (offset: number) => void): void {
+        onPortToken(0, token, handler);
+    }
+
+    function onPortToken(port: number, token: string, handler: (offset: number) => void): void {
+        const index = serial2.portAddToken(port, token);
+        if (index < 0 || !handler) return;
+        control.onEvent(serial2.portDeviceId(port), EventBusValue.SERIAL2_EVT_TOKEN + index, function () {
+            handler(serial2.portTokenOffset(port, index));
+        });
+    }
+
+    /**
+     * Stop looking for the tokens passed to "on token".
+     */
+    //% advanced=true
+    export function clearTokens(): void {
+        serial2.portClearTokens(0);
+    }
+
+    /**
+     * A serial port on its own UARTE, created with serial2.create().
+     * Its events are raised with deviceId() as the source instead of SERIAL2_DEVICE_ID.
+     */
+    export class SerialPort {
+        private port: number;
+
+        constructor(port: number) {
+            this.port = port;
+        }
+
+        /**
+         * The event source ID of this port
+         */
+        deviceId(): number {
+            return serial2.portDeviceId(this.port);
+        }
+
+        writeString(text: string): void {
+            serial2.portWriteString(this.port, text);
+        }
+
+        writeLine(text: string): void {
+            writePortLine(this.port, text);
+        }
+
+        writeNumbers(values: number[]): void {
+            if (!values) return;
+            serial2.portWriteNumbers(this.port, values, NEW_LINE, writeLinePadding);
+        }
+
+        writeValue(name: string, value: number): void {
+            serial2.portWriteValue(this.port, name || "", value, NEW_LINE, writeLinePadding);
+        }
+
+        writeBuffer(buffer: Buffer): void {
+            serial2.portWriteBuffer(this.port, buffer);
+        }
+
+        queueBuffer(buffer: Buffer): void {
+            serial2.portQueueBuffer(this.port, buffer);
+        }
+
+        readString(): string {
+            return serial2.portReadString(this.port);
+        }
+
+        readUntil(delimiter: string): string {
+            return serial2.portReadUntil(this.port, delimiter);
+        }
+
+        readLine(): string {
+            return serial2.portReadUntil(this.port, serial.delimiters(NEW_LINE_DELIMITER));
+        }
+
+        peekLineLength(): number {
+            return serial2.portPeekLineLength(this.port, serial.delimiters(NEW_LINE_DELIMITER));
+        }
+
+        availableLines(): number {
+            return serial2.portAvailableLines(this.port, serial.delimiters(NEW_LINE_DELIMITER));
+        }
+
+        readBuffer(length: number): Buffer {
+            return serial2.portReadBuffer(this.port, length);
+        }
+
+        readInto(buffer: Buffer, offset: number, maxLength: number): number {
+            return serial2.portReadInto(this.port, buffer, offset, maxLength);
+        }
+
+        onDataReceived(delimiters: string, body: () => void): void {
+            serial2.portOnDataReceived(this.port, delimiters, body);
+        }
+
+        onToken(token: string, handler: (offset: number) => void): void {
+            onPortToken(this.port, token, handler);
+        }
+
+        clearTokens(): void {
+            serial2.portClearTokens(this.port);
+        }
+
+        setFraming(framing: Serial2Framing, crc: boolean = true): boolean {
+            return serial2.portSetFraming(this.port, framing, crc);
+        }
+
+        readFrame(): Buffer {
+            return serial2.portReadFrame(this.port);
+        }
+
+        setFixedPackets(size: number, sync: Buffer = null, crc: boolean = false): boolean {
+            return serial2.portSetFixedPackets(this.port, size, sync, crc);
+        }
+
+        setLengthPackets(lengthOffset: number, lengthWidth: number, bigEndian: boolean = false, sync: Buffer = null, crc: boolean = false): boolean {
+            return serial2.portSetLengthPackets(this.port, lengthOffset, lengthWidth, bigEndian, sync, crc);
+        }
+
+        readPacket(): Buffer {
+            return serial2.portReadFrame(this.port);
+        }
+
+        writeFrame(buffer: Buffer): boolean {
+            return serial2.portWriteFrame(this.port, buffer);
+        }
+
+        setBaudRate(rate: number): void {
+            serial2.portSetBaudRate(this.port, rate);
+        }
+
+        flush(): void {
+            serial2.portFlush(this.port);
+        }
+
+        getStats(): Buffer {
+            return serial2.portGetStats(this.port);
+        }
+
+        resetStats(): void {
+            serial2.portResetStats(this.port);
+        }
+    }
+
+    /**
+     * Create an additional serial port on a free UARTE.
+     * The nRF52833 has two UARTEs, one used by the USB serial port and one by the default serial2 port
+     * once any other serial2 function is used.
+     * @param tx the transmission pin, eg: SerialPin.P0
+     * @param rx the reception pin, eg: SerialPin.P1
+     * @param rate the baud rate, eg: 115200
+     * @returns the port, or undefined if no UARTE is free
+     */
+    export function create(tx: SerialPin, rx: SerialPin, rate: BaudRate): SerialPort {
+        const port = serial2.createPort(tx, rx, rate);
+        return port > 0 ? new SerialPort(port) : undefined;
+    }
 }
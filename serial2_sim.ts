@@ -1,6 +1,145 @@
 //%
 namespace serial2 {
 
+    /**
+     * Create a port on a free UARTE, see serial2.create().
+     * @returns the port number, or 0 if no UARTE is free
+     */
+    //% shim=serial2::createPort
+    export function createPort(tx: SerialPin, rx: SerialPin, rate: BaudRate): number {
+        return 0
+    }
+
+    //% shim=serial2::portDeviceId
+    export function portDeviceId(port: number): number {
+        return 0
+    }
+
+    //% shim=serial2::portReadUntil
+    export function portReadUntil(port: number, delimiter: string): string {
+        return ""
+    }
+
+    //% shim=serial2::portPeekLineLength
+    export function portPeekLineLength(port: number, delimiters: string): number {
+        return -1
+    }
+
+    //% shim=serial2::portAvailableLines
+    export function portAvailableLines(port: number, delimiters: string): number {
+        return 0
+    }
+
+    //% shim=serial2::portAddToken
+    export function portAddToken(port: number, token: string): number {
+        return -1
+    }
+
+    //% shim=serial2::portTokenOffset
+    export function portTokenOffset(port: number, index: number): number {
+        return -1
+    }
+
+    //% shim=serial2::portClearTokens
+    export function portClearTokens(port: number): void {
+        return
+    }
+
+    //% shim=serial2::portReadString
+    export function portReadString(port: number): string {
+        return ""
+    }
+
+    //% shim=serial2::portOnDataReceived
+    export function portOnDataReceived(port: number, delimiters: string, body: () => void): void {
+        return
+    }
+
+    //% shim=serial2::portWriteString
+    export function portWriteString(port: number, text: string): void {
+        return
+    }
+
+    //% shim=serial2::portWriteLine
+    export function portWriteLine(port: number, text: string, newLine: string, padding: number): void {
+        return
+    }
+
+    //% shim=serial2::portWriteNumbers
+    export function portWriteNumbers(port: number, values: number[], newLine: string, padding: number): void {
+        return
+    }
+
+    //% shim=serial2::portWriteValue
+    export function portWriteValue(port: number, name: string, value: number, newLine: string, padding: number): void {
+        return
+    }
+
+    //% shim=serial2::portWriteBuffer
+    export function portWriteBuffer(port: number, buffer: Buffer): void {
+        return
+    }
+
+    //% shim=serial2::portReadBuffer
+    export function portReadBuffer(port: number, length: number): Buffer {
+        return null
+    }
+
+    //% shim=serial2::portReadInto
+    export function portReadInto(port: number, buffer: Buffer, offset: number, maxLength: number): number {
+        return 0
+    }
+
+    //% shim=serial2::portSetFraming
+    export function portSetFraming(port: number, framing: Serial2Framing, crc: boolean): boolean {
+        return true
+    }
+
+    //% shim=serial2::portSetFixedPackets
+    export function portSetFixedPackets(port: number, size: number, sync: Buffer, crc: boolean): boolean {
+        return true
+    }
+
+    //% shim=serial2::portSetLengthPackets
+    export function portSetLengthPackets(port: number, lengthOffset: number, lengthWidth: number, bigEndian: boolean, sync: Buffer, crc: boolean): boolean {
+        return true
+    }
+
+    //% shim=serial2::portReadFrame
+    export function portReadFrame(port: number): Buffer {
+        return null
+    }
+
+    //% shim=serial2::portWriteFrame
+    export function portWriteFrame(port: number, buffer: Buffer): boolean {
+        return true
+    }
+
+    //% shim=serial2::portQueueBuffer
+    export function portQueueBuffer(port: number, buffer: Buffer): void {
+        return
+    }
+
+    //% shim=serial2::portSetBaudRate
+    export function portSetBaudRate(port: number, rate: number): void {
+        return
+    }
+
+    //% shim=serial2::portFlush
+    export function portFlush(port: number): void {
+        return
+    }
+
+    //% shim=serial2::portGetStats
+    export function portGetStats(port: number): Buffer {
+        return null
+    }
+
+    //% shim=serial2::portResetStats
+    export function portResetStats(port: number): void {
+        return
+    }
+
     /**
      * Read a line of text from the serial port and return the buffer when the delimiter is met.
      * @param delimiter text delimiter that separates each text chunk
@@ -44,7 +183,8 @@ namespace serial2 {
     }
 
     /**
-     * Send a buffer through serial connection
+     * Send a buffer through serial connection.
+     * The buffer is transmitted without being copied, and SERIAL2_EVT_TX_COMPLETE is raised once it has been sent.
      */
     //% blockId=serial2_writebuffer block="serial2|write buffer %buffer=serial_readbuffer"
     //% help=serial/write-buffer advanced=true weight=6 shim=serial2::writeBuffer
@@ -52,6 +192,94 @@ namespace serial2 {
         return
     }
 
+    /**
+     * Decode received data as COBS or SLIP frames, each followed by a CRC-16/CCITT-FALSE if crc is true.
+     * Complete frames raise SERIAL2_EVT_FRAME and are read with readFrame(), instead of readString() and readBuffer().
+     * @param framing the framing, eg: Serial2Framing.COBS
+     * @param crc whether frames end with a big-endian CRC-16, eg: true
+     * @returns whether the operation was successful
+     */
+    //% blockId=serial2_setframing block="serial2|set framing %framing||with CRC %crc"
+    //% advanced=true
+    //% group="Frames" shim=serial2::setFraming
+    export function setFraming(framing: Serial2Framing, crc: boolean = true): boolean {
+        return true
+    }
+
+    /**
+     * Read the oldest received frame, or an empty buffer if there is none.
+     */
+    //% blockId=serial2_readframe block="serial2|read frame"
+    //% advanced=true
+    //% group="Frames" shim=serial2::readFrame
+    export function readFrame(): Buffer {
+        return null
+    }
+
+    /**
+     * Split received data into packets of a fixed length, instead of COBS or SLIP frames.
+     * Each packet starts with the sync bytes, if any, and is followed by a CRC-16/CCITT-FALSE if crc is true.
+     * Complete packets raise SERIAL2_EVT_FRAME and are read with readPacket().
+     * @param size the length of a packet, sync bytes included, eg: 16
+     * @param sync up to 4 bytes every packet starts with, or null
+     * @param crc whether packets end with a big-endian CRC-16, eg: false
+     * @returns whether the operation was successful
+     */
+    //% advanced=true
+    //% group="Frames" shim=serial2::setFixedPackets
+    export function setFixedPackets(size: number, sync: Buffer = null, crc: boolean = false): boolean {
+        return true
+    }
+
+    /**
+     * Split received data into packets carrying their length, instead of COBS or SLIP frames.
+     * The length field holds the number of bytes following it, excluding the CRC.
+     * Complete packets raise SERIAL2_EVT_FRAME and are read with readPacket().
+     * @param lengthOffset the position of the length field in the packet, after the sync bytes, eg: 0
+     * @param lengthWidth the size of the length field, 1 or 2 bytes, eg: 1
+     * @param bigEndian whether a 2-byte length field is big-endian, eg: false
+     * @param sync up to 4 bytes every packet starts with, or null
+     * @param crc whether packets end with a big-endian CRC-16, eg: false
+     * @returns whether the operation was successful
+     */
+    //% advanced=true
+    //% group="Frames" shim=serial2::setLengthPackets
+    export function setLengthPackets(lengthOffset: number, lengthWidth: number, bigEndian: boolean = false, sync: Buffer = null, crc: boolean = false): boolean {
+        return true
+    }
+
+    /**
+     * Read the oldest received packet, sync bytes and length field included, or an empty buffer if there is none.
+     */
+    //% blockId=serial2_readpacket block="serial2|read packet"
+    //% advanced=true
+    //% group="Frames" shim=serial2::readPacket
+    export function readPacket(): Buffer {
+        return null
+    }
+
+    /**
+     * Encode a buffer as a frame and send it.
+     * @returns whether the frame was sent, false if it is too long or framing is not set
+     */
+    //% blockId=serial2_writeframe block="serial2|write frame %buffer"
+    //% advanced=true
+    //% group="Frames" shim=serial2::writeFrame
+    export function writeFrame(buffer: Buffer): boolean {
+        return true
+    }
+
+    /**
+     * Queue a buffer for sending and return without waiting for it to be sent, unless 7 buffers are already queued.
+     * Queued buffers go out back to back at full line rate, without gaps between them.
+     * SERIAL2_EVT_TX_COMPLETE is raised as each one has been sent.
+     */
+    //% blockId=serial2_queuebuffer block="serial2|queue buffer %buffer=serial_readbuffer"
+    //% advanced=true weight=6 shim=serial2::queueBuffer
+    export function queueBuffer(buffer: Buffer): void {
+        return
+    }
+
     /**
      * Read multiple characters from the receive buffer.
      * If length is positive, pauses until enough characters are present.
@@ -63,6 +291,18 @@ namespace serial2 {
         return null
     }
 
+    /**
+     * Read the received characters into an existing buffer, without waiting or allocating.
+     * @param buffer the buffer to fill
+     * @param offset the index in the buffer of the first character, eg: 0
+     * @param maxLength the most characters to read, or -1 for the rest of the buffer, eg: -1
+     * @returns the number of characters read
+     */
+    //% advanced=true weight=5 shim=serial2::readInto
+    export function readInto(buffer: Buffer, offset: number, maxLength: number): number {
+        return 0
+    }
+
     /**
      * Set the serial input and output to use pins instead of the USB connection.
      * @param tx the new transmission pin, eg: SerialPin.P0
@@ -82,6 +322,60 @@ namespace serial2 {
         return
     }
 
+    /**
+     * Set the baud rate of the serial port to any value up to 1000000
+     * @param rate the baud rate, eg: 19200
+     * @returns the baud rate actually produced, or 0 if it is not supported
+     */
+    //% blockId=serial2_setcustombaudrate block="serial2|set baud rate to %rate"
+    //% advanced=true
+    //% group="Configuration" shim=serial2::setCustomBaudRate
+    export function setCustomBaudRate(rate: number): number {
+        return rate
+    }
+
+    /**
+     * Detect the baud rate from an incoming 0x55 sync byte (optionally preceded by a break) and use it
+     * @param timeout how long to wait for the sync byte in milliseconds, at most 60000, eg: 5000
+     * @returns the detected baud rate, or 0 if no sync byte was received
+     */
+    //% blockId=serial2_autobaud block="serial2|detect baud rate within %timeout|ms"
+    //% advanced=true
+    //% group="Configuration" shim=serial2::autoBaud
+    export function autoBaud(timeout: number): number {
+        return 0
+    }
+
+    /**
+     * Set the serial input and output to use pins, with RTS/CTS hardware flow control.
+     * @param tx the new transmission pin, eg: SerialPin.P0
+     * @param rx the new reception pin, eg: SerialPin.P1
+     * @param rts the pin driven high when the receive buffer is almost full, eg: SerialPin.P2
+     * @param cts the pin pausing transmission while high, eg: SerialPin.P8
+     * @param rate the new baud rate. eg: 115200
+     */
+    //% weight=9
+    //% blockId=serial2_redirect_flow_control block="serial2|redirect to|TX %tx|RX %rx|RTS %rts|CTS %cts|at baud rate %rate"
+    //% blockExternalInputs=1
+    //% advanced=true
+    //% blockGap=8 shim=serial2::redirectWithFlowControl
+    export function redirectWithFlowControl(tx: SerialPin, rx: SerialPin, rts: SerialPin, cts: SerialPin, rate: BaudRate): void {
+        return
+    }
+
+    /**
+     * Set the number of bytes in the receive buffer at which RTS is deasserted.
+     * @param highWater the number of bytes, or 0 to leave room for two RX DMA buffers plus 8 bytes, eg: 0
+     * @returns whether the operation was successful
+     */
+    //% blockId=serial2SetFlowControlThreshold block="serial2 set flow control threshold to $highWater"
+    //% advanced=true
+    //% group="Configuration"
+    //% shim=serial2::setFlowControlThreshold
+    export function setFlowControlThreshold(highWater: number): boolean {
+        return true
+    }
+
     /**
      * Set the baud rate of the serial port
      */
@@ -120,6 +414,52 @@ namespace serial2 {
         return true
     }
 
+    /**
+     * Enable or disable the serial2 device in the background.
+     * Disabling waits for the transfer in progress without blocking the calling fiber.
+     * @param enabled enable or disable the device
+     */
+    //% blockId=serial2_set_enabled_async block="serial2|set enabled $enabled in background"
+    //% advanced=true
+    //% group="Configuration"
+    //% shim=serial2::setEnabledAsync
+    export function setEnabledAsync(enabled: boolean): void {
+        return
+    }
+
+    /**
+     * Wait until everything written so far has been sent.
+     * Other fibers keep running while waiting.
+     */
+    //% blockId=serial2_flush block="serial2|flush"
+    //% advanced=true
+    //% group="Configuration"
+    //% shim=serial2::flush
+    export function flush(): void {
+        return
+    }
+
+    /**
+     * Get the driver statistics, one 32-bit little endian number per Serial2Stat,
+     * or null if they have been compiled out.
+     */
+    //% advanced=true
+    //% group="Configuration"
+    //% shim=serial2::getStats
+    export function getStats(): Buffer {
+        return null
+    }
+
+    /**
+     * Reset the driver statistics.
+     */
+    //% advanced=true
+    //% group="Configuration"
+    //% shim=serial2::resetStats
+    export function resetStats(): void {
+        return
+    }
+
     /**
      * Direct the serial input and output to use the USB connection.
      */
@@ -130,7 +470,7 @@ namespace serial2 {
     }
 
     /**
-     * Sets the size of the RX buffer in bytes
+     * Sets the size of the RX buffer in bytes, up to 65535
      * @param size length of the rx buffer in bytes, eg: 32
      */
     //% help=serial/set-rx-buffer-size
@@ -141,7 +481,7 @@ namespace serial2 {
     }
 
     /**
-     * Sets the size of the TX buffer in bytes
+     * Sets the size of the TX buffer in bytes, up to 65535
      * @param size length of the tx buffer in bytes, eg: 32
      */
     //% help=serial/set-tx-buffer-size
@@ -151,5 +491,172 @@ namespace serial2 {
         return
     }
 
+    /**
+     * Sets the number and size of the buffers the hardware receives into.
+     * Larger buffers let serial2 keep up with fast data while the CPU is busy, at the cost of RAM (count * size bytes).
+     * More than 2 buffers do not help with that, the interrupt handler has to run once per buffer.
+     * @param count number of buffers, eg: 2
+     * @param size size of each buffer in bytes, eg: 32
+     * @returns whether the operation was successful
+     */
+    //% blockId=serial2SetRxDmaBuffers block="serial2 set rx dma buffers to $count|of $size bytes"
+    //% advanced=true
+    //% group="Configuration"
+    //% count.min=1 count.max=8
+    //% shim=serial2::setRxDmaBuffers
+    export function setRxDmaBuffers(count: number, size: number): boolean {
+        return true
+    }
+
+    /**
+     * Raise SERIAL2_EVT_IDLE when the line has been silent for the given time after receiving data,
+     * e.g. to detect the end of a frame. The timeout follows the baud rate.
+     * @param bitTimes length of the silence in bit-times (10 per byte), or 0 to disable, eg: 35
+     * @returns whether the operation was successful
+     */
+    //% blockId=serial2SetIdleTimeout block="serial2 set idle timeout to $bitTimes|bit-times"
+    //% advanced=true
+    //% group="Configuration"
+    //% shim=serial2::setIdleTimeout
+    export function setIdleTimeout(bitTimes: number): boolean {
+        return true
+    }
+
+    /**
+     * Drive the driver enable pin of an RS-485 transceiver in hardware: high while transmitting,
+     * low again once the last stop bit has been sent, plus the guard time.
+     * @param de the driver enable pin, or -1 to disable RS-485 mode, eg: DigitalPin.P2
+     * @param re the receiver enable pin (/RE) to disable while transmitting, or -1 if it is tied to DE, eg: -1
+     * @param guardUs the time the driver stays enabled after the last stop bit, in microseconds, eg: 0
+     * @returns whether the operation was successful
+     */
+    //% advanced=true
+    //% group="Configuration"
+    //% shim=serial2::setRs485
+    export function setRs485(de: number, re: number = -1, guardUs: number = 0): boolean {
+        return true
+    }
+
+    /**
+     * Timestamp received data in hardware. Data is split into chunks at idle lines, so setIdleTimeout() must be set first.
+     * The receive buffer is cleared.
+     * @param enabled true to timestamp received data, eg: true
+     * @returns whether the operation was successful
+     */
+    //% advanced=true
+    //% group="Configuration"
+    //% shim=serial2::setRxTimestamps
+    export function setRxTimestamps(enabled: boolean): boolean {
+        return true
+    }
+
+    /**
+     * Read the oldest received chunk, or an empty buffer if there is none.
+     * The first 4 bytes are the control.micros() time its first byte arrived (NumberFormat.UInt32LE), followed by the data.
+     */
+    //% advanced=true
+    //% shim=serial2::readTimestamped
+    export function readTimestamped(): Buffer {
+        return null
+    }
+
+    /**
+     * The control.micros() time the first byte of the latest chunk arrived, measured by hardware.
+     */
+    //% advanced=true
+    //% shim=serial2::lastRxTimestamp
+    export function lastRxTimestamp(): number {
+        return 0
+    }
+
+    /**
+     * The control.micros() time the line was last detected idle, the idle timeout after the last byte.
+     */
+    //% advanced=true
+    //% shim=serial2::lastRxIdleTimestamp
+    export function lastRxIdleTimestamp(): number {
+        return 0
+    }
+
+    /**
+     * Let the hardware write received data straight into the rx buffer, instead of copying it there from the dma buffers.
+     * Raises SERIAL2_EVT_RX_FULL when the rx buffer has no room left for the hardware.
+     * @param direct true to receive directly into the rx buffer
+     * @returns whether the operation was successful
+     */
+    //% blockId=serial2SetRxDirect block="serial2 receive directly into rx buffer $direct"
+    //% advanced=true
+    //% group="Configuration"
+    //% shim=serial2::setRxDirect
+    export function setRxDirect(direct: boolean): boolean {
+        return true
+    }
+
+    /**
+     * Receive data in blocks instead of one byte at a time, to reduce the interrupt load at high baud rates.
+     * A block is delivered, with a single "data received" event, once threshold bytes have been received
+     * or when no more data has been received for idleTimeout microseconds.
+     * @param threshold number of bytes per block, at most the rx dma buffer size, or 0 to receive byte by byte, eg: 32
+     * @param idleTimeout microseconds of silence after which a partial block is delivered, eg: 1000
+     * @returns whether the operation was successful
+     */
+    //% blockId=serial2SetRxCoalescing block="serial2 receive in blocks of $threshold|bytes, flush after $idleTimeout|us idle"
+    //% advanced=true
+    //% group="Configuration"
+    //% shim=serial2::setRxCoalescing
+    export function setRxCoalescing(threshold: number, idleTimeout: number): boolean {
+        return true
+    }
+
+    /**
+     * Raise the data received and error events at most once per interval, instead of from the interrupt handler
+     * every time, so that a noisy line cannot flood the program with events.
+     * @param interval microseconds between two events of the same kind, or 0 to raise them at once, eg: 10000
+     * @returns whether the operation was successful
+     */
+    //% blockId=serial2SetEventInterval block="serial2 raise receive and error events every $interval|us"
+    //% advanced=true
+    //% group="Configuration"
+    //% shim=serial2::setEventInterval
+    export function setEventInterval(interval: number): boolean {
+        return true
+    }
+
+    /**
+     * The number of bytes received, or errors detected, the latest event of the given value stands for.
+     * @param value SERIAL2_EVT_DATA_RECEIVED, SERIAL2_EVT_ERROR_OVERRUN, SERIAL2_EVT_ERROR_FRAMING or SERIAL2_EVT_ERROR_BREAK
+     */
+    //% advanced=true
+    //% shim=serial2::eventCount
+    export function eventCount(value: number): number {
+        return 0
+    }
+
+    /**
+     * Bridge the default serial2 port and the USB serial port: data received on one is sent on the other.
+     * In tagged mode, each chunk sent to USB starts with a tag ("R" received on serial2, "T" sent on serial2)
+     * and a length byte, followed by a 4 byte little endian control.micros() time if timestamps are enabled.
+     * @param enabled whether to bridge the ports
+     * @param tagged whether to tag the chunks sent to USB, to sniff both directions
+     * @param timestamps whether to timestamp the tagged chunks, with the arrival time if serial2.setRxTimestamps() is on
+     */
+    //% blockId=serial2SetUsbBridge block="serial2 bridge to USB $enabled|tagged $tagged|timestamps $timestamps"
+    //% advanced=true
+    //% group="Configuration"
+    //% shim=serial2::setUsbBridge
+    export function setUsbBridge(enabled: boolean, tagged: boolean, timestamps: boolean): void {
+        return
+    }
+
+    /**
+     * The number of bytes the USB bridge lost because the destination could not keep up.
+     * @param toUsb true for the bytes lost on their way to USB, false for those lost on their way to serial2
+     */
+    //% advanced=true
+    //% shim=serial2::getUsbBridgeOverflow
+    export function getUsbBridgeOverflow(toUsb: boolean): number {
+        return 0
+    }
+
 
 }
@@ -0,0 +1,67 @@
+// Throughput benchmark over a loopback: connect P13 (TX) to P14 (RX).
+// It must stay the only test file: nothing else may read serial2 or write to it while it runs.
+// Results are written to the USB serial port, one line per configuration:
+// baud, DMA buffers, DMA buffer size, bytes/s, interrupts per KB sent and received, worst RX headroom, bytes lost
+
+const BENCH_LENGTH = 4096
+const BENCH_CHUNK = 64
+const BENCH_RX_BUFFER = 128
+const BENCH_TIMEOUT_US = 5000000
+
+function statOf(stats: Buffer, stat: Serial2Stat): number {
+    return stats.getNumber(NumberFormat.UInt32LE, stat * 4)
+}
+
+function bench(baud: number, dmaCount: number, dmaSize: number) {
+    serial2.setCustomBaudRate(baud)
+    serial2.setRxBufferSize(BENCH_RX_BUFFER)
+    serial2.setRxDmaBuffers(dmaCount, dmaSize)
+    serial2.readBuffer(0)
+    serial2.resetStats()
+
+    let chunk = pins.createBuffer(BENCH_CHUNK)
+    for (let i = 0; i < BENCH_CHUNK; i++)
+        chunk[i] = i
+    // The writer is stopped and joined before the next configuration, so that it never sends into it.
+    let stopWriter = false
+    let writerDone = false
+    control.inBackground(function () {
+        for (let sent = 0; sent < BENCH_LENGTH && !stopWriter; sent += BENCH_CHUNK)
+            serial2.writeBuffer(chunk)
+        writerDone = true
+    })
+
+    let rx = pins.createBuffer(BENCH_RX_BUFFER)
+    let received = 0
+    let start = control.micros()
+    while (received < BENCH_LENGTH && control.micros() - start < BENCH_TIMEOUT_US) {
+        received += serial2.readInto(rx, 0, -1)
+        basic.pause(1)
+    }
+    let elapsed = control.micros() - start
+    stopWriter = true
+    while (!writerDone)
+        basic.pause(1)
+    serial2.flush()
+
+    let stats = serial2.getStats()
+    serial.writeNumbers([
+        baud,
+        dmaCount,
+        dmaSize,
+        Math.idiv(received * 1000, Math.max(1, Math.idiv(elapsed, 1000))),
+        Math.idiv(statOf(stats, Serial2Stat.IrqCount) * 1024, received + statOf(stats, Serial2Stat.TxBytes)),
+        BENCH_RX_BUFFER - statOf(stats, Serial2Stat.RxHighWater),
+        BENCH_LENGTH - received,
+    ])
+
+    // Bytes still on their way after a timeout must not count for the next configuration.
+    basic.pause(10)
+    serial2.readBuffer(0)
+}
+
+serial2.redirect(SerialPin.P13, SerialPin.P14, BaudRate.BaudRate115200)
+for (let baud of [115200, 460800, 1000000]) {
+    bench(baud, 2, 32)
+    bench(baud, 4, 128)
+}